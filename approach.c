@@ -0,0 +1,345 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+
+#include "simulation.h"
+#include "query.h"
+#include "approach.h"
+
+// Steps between candidate searches (at the step length of the search)
+#define APPROACH_REFRESH_STEPS 16
+
+// Allowance for bodies speeding up before the next search
+#define APPROACH_SPEED_MARGIN 1.5
+
+// Golden-section iterations locating the closest point inside a step
+#define APPROACH_REFINE_ITERATIONS 40
+
+// A body followed near one planet; the relative state is from the last step
+typedef struct {
+    int planet, body;
+    double radius;          // Search radius it was found in (dropped when receding beyond it)
+    double rx, ry, vx, vy;  // Body minus planet
+} ApproachPair;
+
+struct ApproachMonitor {
+    FILE* output;
+    double threshold;
+    double next_search;     // Time of the next candidate search
+    bool searched;          // A search has been made
+
+    ApproachPair* pairs;
+    int pair_count, pair_capacity;
+    unsigned int* followed; // Per body: bit p set while planet p follows it
+    int followed_capacity;
+
+    CelestialBody** found;  // Radius query results, body_count slots per planet
+    size_t found_capacity;
+
+    long events;
+    double closest;
+    char closest_planet[20], closest_body[20];  // Names, as the bodies may be removed later
+};
+
+// Opens the event log at path; passes closer than threshold (AU) are
+// reported. Returns NULL if the log cannot be written.
+ApproachMonitor* approach_monitor_create(const char* path, double threshold) {
+    FILE* output = fopen(path, "w");
+    if (output == NULL) {
+        fprintf(stderr, "Cannot write %s\n", path);
+        return NULL;
+    }
+    ApproachMonitor* monitor = (ApproachMonitor*)calloc(1, sizeof(ApproachMonitor));
+    if (monitor == NULL) {
+        fprintf(stderr, "Memory allocation failed for approach monitor\n");
+        exit(EXIT_FAILURE);
+    }
+    monitor->output = output;
+    monitor->threshold = threshold;
+    monitor->closest = INFINITY;
+    fprintf(output, "Time,Planet,Body,BodyId,Distance,RelativeSpeed\n");
+    return monitor;
+}
+
+// Relative position and velocity of a body seen from a planet
+static void relative_state(const CelestialBody* planet, const CelestialBody* body, double* rx, double* ry,
+                           double* vx, double* vy) {
+    *rx = body->x - planet->x;
+    *ry = body->y - planet->y;
+    *vx = body->vx - planet->vx;
+    *vy = body->vy - planet->vy;
+}
+
+// Point of the cubic Hermite path at fraction s of a step of length dt
+static void hermite_point(const ApproachPair* start, double rx1, double ry1, double vx1, double vy1, double dt,
+                          double s, double* x, double* y) {
+    double s2 = s * s, s3 = s2 * s;
+    double h00 = 2 * s3 - 3 * s2 + 1;
+    double h10 = s3 - 2 * s2 + s;
+    double h01 = -2 * s3 + 3 * s2;
+    double h11 = s3 - s2;
+    *x = h00 * start->rx + h10 * dt * start->vx + h01 * rx1 + h11 * dt * vx1;
+    *y = h00 * start->ry + h10 * dt * start->vy + h01 * ry1 + h11 * dt * vy1;
+}
+
+// Squared distance on the Hermite path at fraction s
+static double hermite_distance_squared(const ApproachPair* start, double rx1, double ry1, double vx1,
+                                       double vy1, double dt, double s) {
+    double x, y;
+    hermite_point(start, rx1, ry1, vx1, vy1, dt, s, &x, &y);
+    return x * x + y * y;
+}
+
+// Closest approach inside a step by golden-section search on the Hermite
+// path; returns the fraction of the step and the distance
+static double refine_closest(const ApproachPair* start, double rx1, double ry1, double vx1, double vy1,
+                             double dt, double* distance) {
+    const double ratio = 0.5 * (sqrt(5.0) - 1.0);
+    double low = 0.0, high = 1.0;
+    double a = high - ratio * (high - low), b = low + ratio * (high - low);
+    double fa = hermite_distance_squared(start, rx1, ry1, vx1, vy1, dt, a);
+    double fb = hermite_distance_squared(start, rx1, ry1, vx1, vy1, dt, b);
+    for (int i = 0; i < APPROACH_REFINE_ITERATIONS; i++) {
+        if (fa < fb) {
+            high = b;
+            b = a;
+            fb = fa;
+            a = high - ratio * (high - low);
+            fa = hermite_distance_squared(start, rx1, ry1, vx1, vy1, dt, a);
+        } else {
+            low = a;
+            a = b;
+            fa = fb;
+            b = low + ratio * (high - low);
+            fb = hermite_distance_squared(start, rx1, ry1, vx1, vy1, dt, b);
+        }
+    }
+    double s = 0.5 * (low + high);
+    *distance = sqrt(hermite_distance_squared(start, rx1, ry1, vx1, vy1, dt, s));
+    return s;
+}
+
+// Appends a pair unless it is already followed
+static void add_pair(ApproachMonitor* monitor, const CelestialBody bodies[], int planet, int body,
+                     double radius) {
+    if (monitor->followed[body] & (1u << planet)) {
+        return;
+    }
+    monitor->followed[body] |= 1u << planet;
+    if (monitor->pair_count == monitor->pair_capacity) {
+        monitor->pair_capacity = monitor->pair_capacity > 0 ? 2 * monitor->pair_capacity : 64;
+        monitor->pairs = (ApproachPair*)realloc(monitor->pairs, monitor->pair_capacity * sizeof(ApproachPair));
+        if (monitor->pairs == NULL) {
+            fprintf(stderr, "Memory allocation failed for approach pairs\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    ApproachPair* pair = &monitor->pairs[monitor->pair_count++];
+    pair->planet = planet;
+    pair->body = body;
+    pair->radius = radius;
+    relative_state(&bodies[planet], &bodies[body], &pair->rx, &pair->ry, &pair->vx, &pair->vy);
+}
+
+// Finds the bodies that could come within the threshold of a planet
+// before the next search, out to the threshold plus the distance closed
+// until then. Radius queries on tree if there is one (built one step
+// ago, hence the extra step of travel), run as one batch across pool's
+// workers, otherwise one sweep over the light bodies; either way this runs
+// only every few steps.
+static void search_candidates(ApproachMonitor* monitor, CelestialBody bodies[], int body_count,
+                              int massive_count, QuadTreeNode* tree, double time, double dt,
+                              ThreadPool* pool) {
+    double span = APPROACH_REFRESH_STEPS * dt;
+    monitor->next_search = time + span;
+    monitor->searched = true;
+    if (massive_count > 32) {
+        massive_count = 32;  // Planets are bits of followed
+    }
+
+    if (monitor->followed_capacity < body_count) {
+        monitor->followed = (unsigned int*)realloc(monitor->followed, body_count * sizeof(unsigned int));
+        if (monitor->followed == NULL) {
+            fprintf(stderr, "Memory allocation failed for approach candidates\n");
+            exit(EXIT_FAILURE);
+        }
+        memset(monitor->followed + monitor->followed_capacity, 0,
+               (body_count - monitor->followed_capacity) * sizeof(unsigned int));
+        monitor->followed_capacity = body_count;
+    }
+
+    double fastest = 0.0;
+    for (int i = massive_count; i < body_count; i++) {
+        double speed_squared = bodies[i].vx * bodies[i].vx + bodies[i].vy * bodies[i].vy;
+        if (speed_squared > fastest) fastest = speed_squared;
+    }
+    fastest = sqrt(fastest);
+
+    double radius[32];
+    for (int planet = 1; planet < massive_count; planet++) {
+        const CelestialBody* p = &bodies[planet];
+        double planet_speed = sqrt(p->vx * p->vx + p->vy * p->vy);
+        radius[planet] = monitor->threshold + APPROACH_SPEED_MARGIN * span * (fastest + planet_speed);
+        if (tree) {
+            radius[planet] += fastest * dt;
+        }
+    }
+
+    if (tree == NULL) {
+        for (int i = massive_count; i < body_count; i++) {
+            for (int planet = 1; planet < massive_count; planet++) {
+                double dx = bodies[i].x - bodies[planet].x;
+                double dy = bodies[i].y - bodies[planet].y;
+                if (dx * dx + dy * dy <= radius[planet] * radius[planet]) {
+                    add_pair(monitor, bodies, planet, i, radius[planet]);
+                }
+            }
+        }
+        return;
+    }
+
+    // One radius query per planet; each has room for every body, as a
+    // radius can cover them all
+    int planets = massive_count - 1;
+    if (planets <= 0) {
+        return;
+    }
+    size_t needed = (size_t)planets * body_count;
+    if (monitor->found_capacity < needed) {
+        monitor->found_capacity = needed;
+        monitor->found = (CelestialBody**)realloc(monitor->found, needed * sizeof(CelestialBody*));
+        if (monitor->found == NULL) {
+            fprintf(stderr, "Memory allocation failed for approach candidates\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    SpatialQuery queries[31];
+    for (int planet = 1; planet < massive_count; planet++) {
+        SpatialQuery* query = &queries[planet - 1];
+        memset(query, 0, sizeof(*query));
+        query->kind = QUERY_RADIUS;
+        query->x = bodies[planet].x;
+        query->y = bodies[planet].y;
+        query->radius = radius[planet];
+        query->results = monitor->found + (size_t)(planet - 1) * body_count;
+        query->max_results = body_count;
+    }
+    quadtree_query_batch(tree, queries, planets, pool);
+    for (int planet = 1; planet < massive_count; planet++) {
+        const SpatialQuery* query = &queries[planet - 1];
+        for (int f = 0; f < query->count; f++) {
+            int body = (int)(query->results[f] - bodies);
+            if (body >= massive_count) {
+                add_pair(monitor, bodies, planet, body, radius[planet]);
+            }
+        }
+    }
+}
+
+// Appends one pass to the log
+static void report_pass(ApproachMonitor* monitor, const CelestialBody bodies[], const ApproachPair* pair,
+                        double time, double distance, double speed) {
+    fprintf(monitor->output, "%.6f,%s,%s,%d,%.9f,%.9f\n", time, bodies[pair->planet].name,
+            bodies[pair->body].name, bodies[pair->body].id, distance, speed);
+    monitor->events++;
+    if (distance < monitor->closest) {
+        monitor->closest = distance;
+        snprintf(monitor->closest_planet, sizeof(monitor->closest_planet), "%s", bodies[pair->planet].name);
+        snprintf(monitor->closest_body, sizeof(monitor->closest_body), "%s", bodies[pair->body].name);
+    }
+}
+
+// Follows the bodies after a step that ended at time with step length dt.
+// The first massive_count bodies are the Sun (never checked) and the
+// planets; the rest are the bodies checked against them. tree is the
+// quadtree the step's forces came from (NULL if it built none); its
+// candidate queries are split across pool's workers (NULL = this thread).
+void approach_monitor_step(ApproachMonitor* monitor, CelestialBody bodies[], int body_count,
+                           int massive_count, QuadTreeNode* tree, double time, double dt, ThreadPool* pool) {
+    // Passes inside the step just taken, for the pairs already followed
+    int kept = 0;
+    for (int p = 0; p < monitor->pair_count; p++) {
+        ApproachPair pair = monitor->pairs[p];
+        if (pair.planet >= body_count || pair.body >= body_count) {
+            monitor->followed[pair.body] &= ~(1u << pair.planet);
+            continue;
+        }
+        double rx, ry, vx, vy;
+        relative_state(&bodies[pair.planet], &bodies[pair.body], &rx, &ry, &vx, &vy);
+        bool was_approaching = pair.rx * pair.vx + pair.ry * pair.vy < 0.0;
+        bool receding = rx * vx + ry * vy >= 0.0;
+        if (was_approaching && receding) {
+            double distance;
+            double s = refine_closest(&pair, rx, ry, vx, vy, dt, &distance);
+            if (distance < monitor->threshold) {
+                // Relative speed at the closest point, interpolated linearly
+                double cvx = pair.vx + s * (vx - pair.vx);
+                double cvy = pair.vy + s * (vy - pair.vy);
+                report_pass(monitor, bodies, &pair, time - (1.0 - s) * dt, distance,
+                            sqrt(cvx * cvx + cvy * cvy));
+            }
+        }
+        // Pairs receding beyond their search radius cannot come back
+        // before the next search finds them again
+        if (receding && rx * rx + ry * ry > pair.radius * pair.radius) {
+            monitor->followed[pair.body] &= ~(1u << pair.planet);
+            continue;
+        }
+        pair.rx = rx;
+        pair.ry = ry;
+        pair.vx = vx;
+        pair.vy = vy;
+        monitor->pairs[kept++] = pair;
+    }
+    monitor->pair_count = kept;
+
+    if (!monitor->searched || time >= monitor->next_search) {
+        search_candidates(monitor, bodies, body_count, massive_count, tree, time, dt, pool);
+    }
+}
+
+// Moves the followed pairs along when bodies are removed from the array:
+// body i is now at new_index[i] (-1 = removed, its pairs are dropped).
+// The planets must keep their indices.
+void approach_monitor_remap(ApproachMonitor* monitor, const int new_index[], int old_count) {
+    int kept = 0;
+    for (int p = 0; p < monitor->pair_count; p++) {
+        ApproachPair pair = monitor->pairs[p];
+        monitor->followed[pair.body] &= ~(1u << pair.planet);
+        if (pair.body >= old_count || new_index[pair.body] < 0) {
+            continue;
+        }
+        pair.body = new_index[pair.body];
+        monitor->pairs[kept++] = pair;
+    }
+    monitor->pair_count = kept;
+
+    // Every bit was cleared above; set the survivors' at their new places
+    for (int p = 0; p < kept; p++) {
+        monitor->followed[monitor->pairs[p].body] |= 1u << monitor->pairs[p].planet;
+    }
+}
+
+// Number of passes reported so far, and the names in the closest of them
+// (distance is INFINITY and the names empty while there is none)
+long approach_monitor_events(const ApproachMonitor* monitor, double* closest_distance,
+                             const char** closest_planet, const char** closest_body) {
+    if (closest_distance) *closest_distance = monitor->closest;
+    if (closest_planet) *closest_planet = monitor->closest_planet;
+    if (closest_body) *closest_body = monitor->closest_body;
+    return monitor->events;
+}
+
+// Closes the log and frees the monitor
+void approach_monitor_destroy(ApproachMonitor* monitor) {
+    if (monitor == NULL) {
+        return;
+    }
+    fclose(monitor->output);
+    free(monitor->pairs);
+    free(monitor->followed);
+    free(monitor->found);
+    free(monitor);
+}
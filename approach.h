@@ -0,0 +1,46 @@
+#ifndef APPROACH_H
+#define APPROACH_H
+
+#include "simulation.h"
+#include "thread_pool.h"
+
+// Close-approach monitor: reports every pass of a light body within a
+// threshold distance of a planet while the simulation runs. Every few
+// steps candidate pairs are searched around each planet (on the step's
+// quadtree when there is one), with the radius widened by how far any
+// body can travel until the next search. Between searches only the
+// candidate pairs are followed; when one turns from approaching to
+// receding, the minimum distance inside that step is found on the cubic
+// (Hermite) path through both ends' positions and velocities, and a pass
+// within the threshold is appended to the log as one CSV line:
+//     Time,Planet,Body,BodyId,Distance,RelativeSpeed
+// BodyId is the body's id, which stays with it when removals move it in
+// the array, so passes of one asteroid can be matched across the log.
+typedef struct ApproachMonitor ApproachMonitor;
+
+// Opens the event log at path; passes closer than threshold (AU) are
+// reported. Returns NULL if the log cannot be written.
+ApproachMonitor* approach_monitor_create(const char* path, double threshold);
+
+// Follows the bodies after a step that ended at time with step length dt.
+// The first massive_count bodies are the Sun (never checked) and the
+// planets; the rest are the bodies checked against them. tree is the
+// quadtree the step's forces came from (NULL if it built none); its
+// candidate queries are split across pool's workers (NULL = this thread).
+void approach_monitor_step(ApproachMonitor* monitor, CelestialBody bodies[], int body_count,
+                           int massive_count, QuadTreeNode* tree, double time, double dt, ThreadPool* pool);
+
+// Moves the followed pairs along when bodies are removed from the array:
+// body i is now at new_index[i] (-1 = removed, its pairs are dropped).
+// The planets must keep their indices.
+void approach_monitor_remap(ApproachMonitor* monitor, const int new_index[], int old_count);
+
+// Number of passes reported so far, and the names in the closest of them
+// (distance is INFINITY and the names empty while there is none)
+long approach_monitor_events(const ApproachMonitor* monitor, double* closest_distance,
+                             const char** closest_planet, const char** closest_body);
+
+// Closes the log and frees the monitor
+void approach_monitor_destroy(ApproachMonitor* monitor);
+
+#endif
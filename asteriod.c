@@ -57,16 +57,39 @@ typedef struct QuadTreeNode {
 // (Use your provided implementations)
 // ***********************
 // (See your code for create_quadtree(), is_in_bounds(), subdivide(),
-//  get_quadrant(), insert_body(), calculate_center_of_mass(), free_quadtree(),
+//  get_quadrant(), insert_body(), calculate_center_of_mass(), reset_quadtree_pool(),
 //  calculate_force_from_quadtree(), update_body(), etc.)
 
+// Tree nodes are handed out from blocks that are kept between steps, so
+// rebuilding the tree does not touch the heap once the pool has grown.
+#define NODE_BLOCK_SIZE 256
+static QuadTreeNode** node_blocks = NULL;  // Blocks never move once allocated
+static int node_block_count = 0;
+static int nodes_used = 0;                 // Nodes handed out since the last reset
+
+// Takes the next node from the pool, adding a block if all are in use.
+static QuadTreeNode* allocate_node(void) {
+    int block = nodes_used / NODE_BLOCK_SIZE;
+    if (block == node_block_count) {
+        QuadTreeNode** blocks = (QuadTreeNode**)realloc(node_blocks, (node_block_count + 1) * sizeof(QuadTreeNode*));
+        if (blocks == NULL) {
+            fprintf(stderr, "Memory allocation failed for quad-tree pool\n");
+            exit(EXIT_FAILURE);
+        }
+        node_blocks = blocks;
+        node_blocks[block] = (QuadTreeNode*)malloc(NODE_BLOCK_SIZE * sizeof(QuadTreeNode));
+        if (node_blocks[block] == NULL) {
+            fprintf(stderr, "Memory allocation failed for quad-tree node\n");
+            exit(EXIT_FAILURE);
+        }
+        node_block_count++;
+    }
+    return &node_blocks[block][nodes_used++ % NODE_BLOCK_SIZE];
+}
+
 // Creates a new quad tree node covering the given region.
 QuadTreeNode* create_quadtree(double x, double y, double width, double height) {
-    QuadTreeNode* node = (QuadTreeNode*)malloc(sizeof(QuadTreeNode));
-    if (node == NULL) {
-        fprintf(stderr, "Memory allocation failed for quad-tree node\n");
-        exit(EXIT_FAILURE);
-    }
+    QuadTreeNode* node = allocate_node();
     node->x = x;
     node->y = y;
     node->width = width;
@@ -175,13 +198,9 @@ void calculate_center_of_mass(QuadTreeNode* node) {
     }
 }
 
-void free_quadtree(QuadTreeNode* node) {
-    if (node == NULL) return;
-    free_quadtree(node->nw);
-    free_quadtree(node->ne);
-    free_quadtree(node->sw);
-    free_quadtree(node->se);
-    free(node);
+// Returns every node to the pool; trees built before are no longer valid.
+void reset_quadtree_pool(void) {
+    nodes_used = 0;
 }
 
 // Calculates the gravitational force on a body using Barnes-Hut approach.
@@ -270,32 +289,15 @@ void initialize_asteroids() {
 }
 
 // Updates asteroids using the Barnes-Hut quad tree.
-// It builds a quad tree including both planets and asteroids, computes forces,
-// updates asteroid states, and logs their data.
+// The tree is built over the asteroids in place. The few planets are summed
+// directly from their own array rather than converted into tree bodies, so
+// a step neither copies nor allocates anything. Asteroid data is logged.
 void update_asteroids_with_quadtree(Planet planets[], int num_planets, double dt, double current_time, FILE* log_file) {
-    // Create a quad tree for the simulation region.
+    // Create a quad tree for the simulation region from the pooled nodes.
+    reset_quadtree_pool();
     QuadTreeNode* root = create_quadtree(-SIMULATION_REGION, -SIMULATION_REGION,
                                           2 * SIMULATION_REGION, 2 * SIMULATION_REGION);
     
-    // Allocate temporary array to hold planet bodies (converted from Planet)
-    CelestialBody* planetBodies[num_planets];
-    for (int i = 0; i < num_planets; i++) {
-        planetBodies[i] = (CelestialBody*)malloc(sizeof(CelestialBody));
-        // Convert planet data to CelestialBody.
-        // Note: Since Planet's first field is name (char[20]), we access later fields accordingly.
-        // Assuming the layout as defined in planet.h:
-        planetBodies[i]->mass = planets[i].mass;
-        planetBodies[i]->x = planets[i].x;
-        planetBodies[i]->y = planets[i].y;
-        planetBodies[i]->vx = planets[i].vx;
-        planetBodies[i]->vy = planets[i].vy;
-        planetBodies[i]->radius = planets[i].radius;
-        planetBodies[i]->fx = 0.0;
-        planetBodies[i]->fy = 0.0;
-        // Insert this planet into the quad tree
-        insert_body(root, planetBodies[i]);
-    }
-    
     // Insert all asteroids into the quad tree.
     for (int i = 0; i < NUM_ASTEROIDS; i++) {
         insert_body(root, &asteroids[i]);
@@ -304,20 +306,30 @@ void update_asteroids_with_quadtree(Planet planets[], int num_planets, double dt
     // Compute the center of mass for the quad tree.
     calculate_center_of_mass(root);
     
-    // For each asteroid, calculate the total gravitational force from the quad tree,
-    // update its state, and log its data.
+    // Sum the forces on every asteroid before moving any of them.
     for (int i = 0; i < NUM_ASTEROIDS; i++) {
+        CelestialBody* asteroid = &asteroids[i];
         double fx = 0.0, fy = 0.0;
-        calculate_force_from_quadtree(&asteroids[i], root, THETA, &fx, &fy);
-        update_body(&asteroids[i], fx, fy, dt);
-        log_asteroid_data(log_file, &asteroids[i], current_time);
+        calculate_force_from_quadtree(asteroid, root, THETA, &fx, &fy);
+        for (int p = 0; p < num_planets; p++) {
+            double dx = planets[p].x - asteroid->x;
+            double dy = planets[p].y - asteroid->y;
+            double dist_sq = dx * dx + dy * dy;
+            double dist = sqrt(dist_sq);
+            if (dist < EPSILON) continue;
+            double force = G * asteroid->mass * planets[p].mass / dist_sq;
+            fx += force * dx / dist;
+            fy += force * dy / dist;
+        }
+        asteroid->fx = fx;
+        asteroid->fy = fy;
     }
     
-    // Free the dynamically allocated planet bodies.
-    for (int i = 0; i < num_planets; i++) {
-        free(planetBodies[i]);
+    // Update asteroid states and log their data.
+    for (int i = 0; i < NUM_ASTEROIDS; i++) {
+        update_body(&asteroids[i], asteroids[i].fx, asteroids[i].fy, dt);
+        log_asteroid_data(log_file, &asteroids[i], current_time);
     }
-    free_quadtree(root);
 }
 
 // ***********************
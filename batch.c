@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+
+#include "simulation.h"
+#include "batch.h"
+
+// Systems handled per pass over the bodies; all components of all bodies
+// of a tile stay in L1/L2 while its forces are summed and applied
+#define BATCH_TILE 256
+
+// Creates a batch of system_count systems of body_count bodies, all at
+// rest at the origin with unit mass until set
+SystemBatch* system_batch_create(int body_count, int system_count) {
+    SystemBatch* batch = (SystemBatch*)malloc(sizeof(SystemBatch));
+    if (batch == NULL) {
+        fprintf(stderr, "Memory allocation failed for system batch\n");
+        exit(EXIT_FAILURE);
+    }
+    batch->body_count = body_count;
+    batch->system_count = system_count;
+    batch->stride = (system_count + BATCH_LANES - 1) / BATCH_LANES * BATCH_LANES;
+
+    size_t values = (size_t)body_count * BATCH_COMPONENTS * batch->stride;
+    batch->data = (double*)calloc(values, sizeof(double));
+    batch->scratch = (double*)calloc(2 * BATCH_TILE, sizeof(double));
+    if (batch->data == NULL || batch->scratch == NULL) {
+        fprintf(stderr, "Memory allocation failed for system batch\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Unit masses keep the padding lanes finite (coincident bodies exert
+    // no force, so they simply never move)
+    for (int body = 0; body < body_count; body++) {
+        double* mass = system_batch_lane(batch, body, BATCH_MASS);
+        for (int s = 0; s < batch->stride; s++) {
+            mass[s] = 1.0;
+        }
+    }
+    return batch;
+}
+
+// One component of one body across all systems (stride entries)
+double* system_batch_lane(SystemBatch* batch, int body, int component) {
+    return batch->data + ((size_t)body * BATCH_COMPONENTS + component) * batch->stride;
+}
+
+// Read-only lane of a const batch
+static const double* batch_lane_const(const SystemBatch* batch, int body, int component) {
+    return batch->data + ((size_t)body * BATCH_COMPONENTS + component) * batch->stride;
+}
+
+// Copies position, velocity and mass of a body into a system
+void system_batch_set_body(SystemBatch* batch, int system, int body, const CelestialBody* source) {
+    system_batch_lane(batch, body, BATCH_X)[system] = source->x;
+    system_batch_lane(batch, body, BATCH_Y)[system] = source->y;
+    system_batch_lane(batch, body, BATCH_VX)[system] = source->vx;
+    system_batch_lane(batch, body, BATCH_VY)[system] = source->vy;
+    system_batch_lane(batch, body, BATCH_MASS)[system] = source->mass;
+}
+
+// Copies position, velocity, mass and last force of a body out of a system
+void system_batch_get_body(const SystemBatch* batch, int system, int body, CelestialBody* target) {
+    target->x = batch_lane_const(batch, body, BATCH_X)[system];
+    target->y = batch_lane_const(batch, body, BATCH_Y)[system];
+    target->vx = batch_lane_const(batch, body, BATCH_VX)[system];
+    target->vy = batch_lane_const(batch, body, BATCH_VY)[system];
+    target->mass = batch_lane_const(batch, body, BATCH_MASS)[system];
+    target->fx = batch_lane_const(batch, body, BATCH_FX)[system];
+    target->fy = batch_lane_const(batch, body, BATCH_FY)[system];
+}
+
+// Adds the pull between bodies i and j in count systems: j's pull on i to
+// sum_x/sum_y, i's pull on j to fxj/fyj. The arrays never overlap, which
+// restrict tells the compiler, so the loop runs one system per lane.
+static void pair_lanes(int count, const double* restrict xi, const double* restrict yi,
+                       const double* restrict mi, const double* restrict xj, const double* restrict yj,
+                       const double* restrict mj, double* restrict sum_x, double* restrict sum_y,
+                       double* restrict fxj, double* restrict fyj) {
+    for (int s = 0; s < count; s++) {
+        double dx = xj[s] - xi[s];
+        double dy = yj[s] - yi[s];
+        double distance_squared = dx * dx + dy * dy;
+        // Coincident bodies divide by one and then get a zero factor, so
+        // both are selects rather than a branch
+        bool apart = distance_squared > EPSILON * EPSILON;
+        double safe_squared = apart ? distance_squared : 1.0;
+        double inverse_cube = 1.0 / (safe_squared * sqrt(safe_squared));
+        inverse_cube = apart ? inverse_cube : 0.0;
+        double factor = G * mi[s] * mj[s] * inverse_cube;
+        sum_x[s] += factor * dx;
+        sum_y[s] += factor * dy;
+        fxj[s] -= factor * dx;
+        fyj[s] -= factor * dy;
+    }
+}
+
+// update_body for one body in count systems
+static void update_lanes(int count, double* restrict x, double* restrict y, double* restrict vx,
+                         double* restrict vy, const double* restrict mass, const double* restrict fx,
+                         const double* restrict fy, double dt) {
+    for (int s = 0; s < count; s++) {
+        vx[s] += fx[s] / mass[s] * dt;
+        vy[s] += fy[s] / mass[s] * dt;
+        x[s] += vx[s] * dt;
+        y[s] += vy[s] * dt;
+    }
+}
+
+// Forces between all pairs of bodies for systems [first, first + count).
+// The pair order and sums match compute_direct_forces, so each lane gets
+// the same forces a single system would.
+static void batch_forces(SystemBatch* batch, int first, int count) {
+    double* sum_x = batch->scratch;
+    double* sum_y = batch->scratch + BATCH_TILE;
+
+    for (int i = 0; i < batch->body_count; i++) {
+        memset(system_batch_lane(batch, i, BATCH_FX) + first, 0, count * sizeof(double));
+        memset(system_batch_lane(batch, i, BATCH_FY) + first, 0, count * sizeof(double));
+    }
+
+    for (int i = 0; i < batch->body_count; i++) {
+        memset(sum_x, 0, count * sizeof(double));
+        memset(sum_y, 0, count * sizeof(double));
+        for (int j = i + 1; j < batch->body_count; j++) {
+            pair_lanes(count,
+                       system_batch_lane(batch, i, BATCH_X) + first,
+                       system_batch_lane(batch, i, BATCH_Y) + first,
+                       system_batch_lane(batch, i, BATCH_MASS) + first,
+                       system_batch_lane(batch, j, BATCH_X) + first,
+                       system_batch_lane(batch, j, BATCH_Y) + first,
+                       system_batch_lane(batch, j, BATCH_MASS) + first,
+                       sum_x, sum_y,
+                       system_batch_lane(batch, j, BATCH_FX) + first,
+                       system_batch_lane(batch, j, BATCH_FY) + first);
+        }
+
+        double* fxi = system_batch_lane(batch, i, BATCH_FX) + first;
+        double* fyi = system_batch_lane(batch, i, BATCH_FY) + first;
+        for (int s = 0; s < count; s++) {
+            fxi[s] += sum_x[s];
+            fyi[s] += sum_y[s];
+        }
+    }
+}
+
+// update_body for every body of systems [first, first + count)
+static void batch_update(SystemBatch* batch, int first, int count, double dt) {
+    for (int i = 0; i < batch->body_count; i++) {
+        update_lanes(count,
+                     system_batch_lane(batch, i, BATCH_X) + first,
+                     system_batch_lane(batch, i, BATCH_Y) + first,
+                     system_batch_lane(batch, i, BATCH_VX) + first,
+                     system_batch_lane(batch, i, BATCH_VY) + first,
+                     system_batch_lane(batch, i, BATCH_MASS) + first,
+                     system_batch_lane(batch, i, BATCH_FX) + first,
+                     system_batch_lane(batch, i, BATCH_FY) + first, dt);
+    }
+}
+
+// Advances every system by dt: direct forces between all bodies, then a
+// semi-implicit Euler step
+void system_batch_step(SystemBatch* batch, double dt) {
+    for (int first = 0; first < batch->stride; first += BATCH_TILE) {
+        int count = batch->stride - first < BATCH_TILE ? batch->stride - first : BATCH_TILE;
+        batch_forces(batch, first, count);
+        batch_update(batch, first, count, dt);
+    }
+}
+
+// Frees the batch
+void system_batch_free(SystemBatch* batch) {
+    if (batch == NULL) {
+        return;
+    }
+    free(batch->data);
+    free(batch->scratch);
+    free(batch);
+}
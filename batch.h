@@ -0,0 +1,58 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "simulation.h"
+
+// Systems advanced together by one instruction stream. The system count is
+// padded to a multiple of this, which fills one AVX-512 register of
+// doubles (narrower units take a few registers per group).
+#define BATCH_LANES 8
+
+// Quantities stored per body and system
+enum {
+    BATCH_X,
+    BATCH_Y,
+    BATCH_VX,
+    BATCH_VY,
+    BATCH_MASS,
+    BATCH_FX,
+    BATCH_FY,
+    BATCH_COMPONENTS
+};
+
+// Many small independent systems with the same number of bodies (a Sun, a
+// planet or two and one asteroid clone, say), far too small to split one
+// across threads or vector lanes. Instead each SIMD lane holds a different
+// system: the data is laid out [body][component][system], so a component
+// of one body is contiguous across systems and every pair interaction is
+// a loop over systems that the compiler vectorizes. Forces and steps are
+// the same as compute_direct_forces and update_body on each system alone.
+typedef struct {
+    int body_count;     // Bodies in every system
+    int system_count;
+    int stride;         // system_count rounded up to BATCH_LANES
+    double* data;       // [body][component][stride]
+    double* scratch;    // Per-lane force sums of the body being paired
+} SystemBatch;
+
+// Creates a batch of system_count systems of body_count bodies, all at
+// rest at the origin with unit mass until set
+SystemBatch* system_batch_create(int body_count, int system_count);
+
+// One component of one body across all systems (stride entries)
+double* system_batch_lane(SystemBatch* batch, int body, int component);
+
+// Copies position, velocity and mass of a body into a system
+void system_batch_set_body(SystemBatch* batch, int system, int body, const CelestialBody* source);
+
+// Copies position, velocity, mass and last force of a body out of a system
+void system_batch_get_body(const SystemBatch* batch, int system, int body, CelestialBody* target);
+
+// Advances every system by dt: direct forces between all bodies, then a
+// semi-implicit Euler step
+void system_batch_step(SystemBatch* batch, double dt);
+
+// Frees the batch
+void system_batch_free(SystemBatch* batch);
+
+#endif
@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "simulation.h"
+#include "thread_pool.h"
+#include "elements.h"
+
+// Most workers one pass is split across
+#define ELEMENT_MAX_WORKERS 64
+
+// Bodies gathered into contiguous arrays at a time, so the element
+// formulas run as one vectorized loop over plain doubles
+#define ELEMENT_BLOCK 256
+
+// Histogram ranges: the main belt and its Kirkwood gaps (3:1 at 2.50 AU,
+// 5:2 at 2.82, 7:3 at 2.95, 2:1 at 3.27) with room either side
+static const double element_ranges[ELEMENT_QUANTITIES][2] = {
+    {1.5, 5.5},  // Semi-major axis
+    {0.0, 1.0},  // Eccentricity
+    {0.2, 1.0}   // Period ratio with Jupiter
+};
+
+static const char* element_names[ELEMENT_QUANTITIES] = {"SemiMajorAxis", "Eccentricity", "PeriodRatio"};
+
+// Elements of one block of relative states: a, e and the period ratio
+// from the energy and angular momentum, in one loop without branches so
+// it vectorizes (open orbits fall out as a < 0, e >= 1 and a ratio of 0)
+static void elements_block(int n, const double* restrict rx, const double* restrict ry,
+                           const double* restrict vx, const double* restrict vy, const double* restrict mu,
+                           double inverse_reference, double* restrict a, double* restrict e,
+                           double* restrict period_ratio) {
+    for (int k = 0; k < n; k++) {
+        double r = sqrt(rx[k] * rx[k] + ry[k] * ry[k]);
+        double energy = 0.5 * (vx[k] * vx[k] + vy[k] * vy[k]) - mu[k] / r;
+        double h = rx[k] * vy[k] - ry[k] * vx[k];
+        double axis = -0.5 * mu[k] / energy;
+        double bound_axis = axis > 0.0 ? axis : 0.0;  // Selects vectorize, fmax (NaN rules) does not
+        double e_squared = 1.0 + 2.0 * energy * h * h / (mu[k] * mu[k]);
+        a[k] = axis;
+        e[k] = sqrt(e_squared > 0.0 ? e_squared : 0.0);
+        period_ratio[k] = 2.0 * M_PI * sqrt(bound_axis * bound_axis * bound_axis / mu[k]) * inverse_reference;
+    }
+}
+
+// Elements of bodies [first, last), gathered block by block into states
+// relative to the central body
+static void elements_range(const CelestialBody bodies[], int first, int last, const CelestialBody* central,
+                           double reference_period, double a[], double e[], double period_ratio[]) {
+    double rx[ELEMENT_BLOCK], ry[ELEMENT_BLOCK], vx[ELEMENT_BLOCK], vy[ELEMENT_BLOCK], mu[ELEMENT_BLOCK];
+    double inverse_reference = reference_period > 0.0 ? 1.0 / reference_period : 0.0;
+    for (int start = first; start < last; start += ELEMENT_BLOCK) {
+        int n = last - start < ELEMENT_BLOCK ? last - start : ELEMENT_BLOCK;
+        for (int k = 0; k < n; k++) {
+            const CelestialBody* body = &bodies[start + k];
+            rx[k] = body->x - central->x;
+            ry[k] = body->y - central->y;
+            vx[k] = body->vx - central->vx;
+            vy[k] = body->vy - central->vy;
+            mu[k] = G * (central->mass + body->mass);
+        }
+        elements_block(n, rx, ry, vx, vy, mu, inverse_reference, a + start, e + start, period_ratio + start);
+    }
+}
+
+// Adds a value to a histogram
+static void histogram_add(ElementHistogram* histogram, double value) {
+    if (!(value >= histogram->low)) {
+        histogram->below++;
+        return;
+    }
+    int bin = (int)((value - histogram->low) * (ELEMENT_BINS / (histogram->high - histogram->low)));
+    if (bin >= ELEMENT_BINS) {
+        histogram->above++;
+        return;
+    }
+    histogram->counts[bin]++;
+}
+
+// Empties the histograms of every element, keeping their ranges
+static void histograms_clear(ElementHistogram histograms[ELEMENT_QUANTITIES]) {
+    for (int q = 0; q < ELEMENT_QUANTITIES; q++) {
+        memset(&histograms[q], 0, sizeof(ElementHistogram));
+        histograms[q].low = element_ranges[q][0];
+        histograms[q].high = element_ranges[q][1];
+    }
+}
+
+// Adds the counts of one set of histograms to another
+static void histograms_add(ElementHistogram target[ELEMENT_QUANTITIES],
+                           const ElementHistogram source[ELEMENT_QUANTITIES]) {
+    for (int q = 0; q < ELEMENT_QUANTITIES; q++) {
+        for (int b = 0; b < ELEMENT_BINS; b++) {
+            target[q].counts[b] += source[q].counts[b];
+        }
+        target[q].below += source[q].below;
+        target[q].above += source[q].above;
+    }
+}
+
+// One worker's share of a pass: bodies [first, last), and with
+// histograms set also their counts
+typedef struct {
+    const CelestialBody* bodies;
+    const CelestialBody* central;
+    double reference_period;
+    double *a, *e, *period_ratio;
+    int first, last;
+    ElementHistogram* histograms;  // ELEMENT_QUANTITIES of them (NULL = elements only)
+    int unbound;
+} ElementTask;
+
+static void run_element_task(void* arg) {
+    ElementTask* task = (ElementTask*)arg;
+    elements_range(task->bodies, task->first, task->last, task->central, task->reference_period,
+                   task->a, task->e, task->period_ratio);
+    if (task->histograms == NULL) {
+        return;
+    }
+    histograms_clear(task->histograms);
+    task->unbound = 0;
+    for (int i = task->first; i < task->last; i++) {
+        histogram_add(&task->histograms[ELEMENT_ECCENTRICITY], task->e[i]);
+        if (task->a[i] <= 0.0) {
+            task->unbound++;  // No axis or period to speak of
+            continue;
+        }
+        histogram_add(&task->histograms[ELEMENT_SEMI_MAJOR_AXIS], task->a[i]);
+        if (task->reference_period > 0.0) {
+            histogram_add(&task->histograms[ELEMENT_PERIOD_RATIO], task->period_ratio[i]);
+        }
+    }
+}
+
+// Splits a pass over count bodies into contiguous ranges; returns the
+// number of tasks filled in (histograms, if given, holds room for
+// ELEMENT_QUANTITIES per task)
+static int element_tasks(ElementTask tasks[], int workers, const CelestialBody bodies[], int count,
+                         const CelestialBody* central, double reference_period, double a[], double e[],
+                         double period_ratio[], ElementHistogram* histograms) {
+    if (workers > ELEMENT_MAX_WORKERS) {
+        workers = ELEMENT_MAX_WORKERS;
+    }
+    if (workers < 1 || count < 2 * ELEMENT_BLOCK * workers) {
+        workers = 1;  // Not worth waking the pool
+    }
+    for (int w = 0; w < workers; w++) {
+        ElementTask* task = &tasks[w];
+        task->bodies = bodies;
+        task->central = central;
+        task->reference_period = reference_period;
+        task->a = a;
+        task->e = e;
+        task->period_ratio = period_ratio;
+        task->first = (int)((long)count * w / workers);
+        task->last = (int)((long)count * (w + 1) / workers);
+        task->histograms = histograms ? histograms + w * ELEMENT_QUANTITIES : NULL;
+        task->unbound = 0;
+    }
+    return workers;
+}
+
+// Runs the tasks of a pass, on pool's workers if there is more than one
+static void run_element_tasks(ElementTask tasks[], int task_count, ThreadPool* pool) {
+    if (task_count == 1) {
+        run_element_task(&tasks[0]);
+        return;
+    }
+    for (int t = 0; t < task_count; t++) {
+        thread_pool_submit(pool, run_element_task, &tasks[t]);
+    }
+    thread_pool_wait(pool);
+}
+
+// Semi-major axis and eccentricity of bodies[0..count) about central, and
+// their period over reference_period (0 = no ratio, left 0). a is
+// negative and e at least 1 on open orbits, whose ratio is 0. Contiguous
+// ranges are split across pool's workers (NULL = this thread).
+void orbital_elements_compute(const CelestialBody bodies[], int count, const CelestialBody* central,
+                              double reference_period, double a[], double e[], double period_ratio[],
+                              ThreadPool* pool) {
+    ElementTask tasks[ELEMENT_MAX_WORKERS];
+    int task_count = element_tasks(tasks, pool ? thread_pool_size(pool) : 1, bodies, count, central,
+                                   reference_period, a, e, period_ratio, NULL);
+    run_element_tasks(tasks, task_count, pool);
+}
+
+// Orbital period of body about central (0 on an open orbit)
+double orbital_period(const CelestialBody* body, const CelestialBody* central) {
+    double a, e, ratio;
+    elements_range(body, 0, 1, central, 0.0, &a, &e, &ratio);
+    if (a <= 0.0) {
+        return 0.0;
+    }
+    return 2.0 * M_PI * sqrt(a * a * a / (G * (central->mass + body->mass)));
+}
+
+// Starts empty statistics; output_path may be NULL. Returns NULL if the
+// output cannot be written.
+ElementStats* element_stats_create(const char* output_path, int interval) {
+    FILE* output = NULL;
+    if (output_path) {
+        output = fopen(output_path, "w");
+        if (output == NULL) {
+            fprintf(stderr, "Cannot write %s\n", output_path);
+            return NULL;
+        }
+        fprintf(output, "Time,Element,Low,High,Below,Above");
+        for (int b = 0; b < ELEMENT_BINS; b++) {
+            fprintf(output, ",B%d", b);
+        }
+        fprintf(output, "\n");
+    }
+    ElementStats* stats = (ElementStats*)calloc(1, sizeof(ElementStats));
+    if (stats == NULL) {
+        fprintf(stderr, "Memory allocation failed for element statistics\n");
+        exit(EXIT_FAILURE);
+    }
+    stats->interval = interval;
+    stats->output = output;
+    histograms_clear(stats->histograms.latest);
+    histograms_clear(stats->histograms.total);
+    return stats;
+}
+
+// Appends the latest snapshot's histograms to the output
+static void write_histograms(ElementStats* stats) {
+    const ElementHistograms* histograms = &stats->histograms;
+    for (int q = 0; q < ELEMENT_QUANTITIES; q++) {
+        const ElementHistogram* histogram = &histograms->latest[q];
+        fprintf(stats->output, "%.6f,%s,%g,%g,%ld,%ld", histograms->time, element_names[q], histogram->low,
+                histogram->high, histogram->below, histogram->above);
+        for (int b = 0; b < ELEMENT_BINS; b++) {
+            fprintf(stats->output, ",%ld", histogram->counts[b]);
+        }
+        fprintf(stats->output, "\n");
+    }
+}
+
+// Takes a snapshot of bodies[first..body_count) about bodies[0], with
+// period ratios against bodies[reference] (-1 = none)
+void element_stats_update(ElementStats* stats, const CelestialBody bodies[], int body_count, int first,
+                          int reference, double time, ThreadPool* pool) {
+    int count = body_count - first;
+    if (count < 0) {
+        count = 0;
+    }
+    if (stats->capacity < count) {
+        stats->capacity = count;
+        stats->a = (double*)realloc(stats->a, count * sizeof(double));
+        stats->e = (double*)realloc(stats->e, count * sizeof(double));
+        stats->period_ratio = (double*)realloc(stats->period_ratio, count * sizeof(double));
+        if (stats->a == NULL || stats->e == NULL || stats->period_ratio == NULL) {
+            fprintf(stderr, "Memory allocation failed for orbital elements\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    int workers = pool ? thread_pool_size(pool) : 1;
+    if (workers > ELEMENT_MAX_WORKERS) {
+        workers = ELEMENT_MAX_WORKERS;
+    }
+    if (stats->partial_count < workers) {
+        stats->partial_count = workers;
+        stats->partial = (ElementHistogram*)realloc(stats->partial,
+                                                    workers * ELEMENT_QUANTITIES * sizeof(ElementHistogram));
+        if (stats->partial == NULL) {
+            fprintf(stderr, "Memory allocation failed for element histograms\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    double reference_period = 0.0;
+    if (reference >= 0 && reference < body_count) {
+        reference_period = orbital_period(&bodies[reference], &bodies[0]);
+    }
+    ElementTask tasks[ELEMENT_MAX_WORKERS];
+    int task_count = element_tasks(tasks, workers, bodies + first, count, &bodies[0], reference_period,
+                                   stats->a, stats->e, stats->period_ratio, stats->partial);
+    run_element_tasks(tasks, task_count, pool);
+
+    ElementHistograms* histograms = &stats->histograms;
+    histograms_clear(histograms->latest);
+    histograms->unbound = 0;
+    for (int t = 0; t < task_count; t++) {
+        histograms_add(histograms->latest, tasks[t].histograms);
+        histograms->unbound += tasks[t].unbound;
+    }
+    histograms_add(histograms->total, histograms->latest);
+    histograms->time = time;
+    histograms->bodies = count;
+    histograms->snapshots++;
+    if (stats->output) {
+        write_histograms(stats);
+    }
+}
+
+// Closes the output and frees the statistics
+void element_stats_destroy(ElementStats* stats) {
+    if (stats == NULL) {
+        return;
+    }
+    if (stats->output) {
+        fclose(stats->output);
+    }
+    free(stats->a);
+    free(stats->e);
+    free(stats->period_ratio);
+    free(stats->partial);
+    free(stats);
+}
@@ -0,0 +1,76 @@
+#ifndef ELEMENTS_H
+#define ELEMENTS_H
+
+#include <stdio.h>
+#include "simulation.h"
+#include "thread_pool.h"
+
+// Bins of every element histogram
+#define ELEMENT_BINS 100
+
+// Osculating two-body elements of the light bodies about the Sun (body 0),
+// computed straight from the state vectors every few steps so the belt's
+// distributions (the Kirkwood gaps in a and in the period ratio with
+// Jupiter) can be watched live instead of being worked out offline from
+// dumped positions and velocities.
+typedef enum {
+    ELEMENT_SEMI_MAJOR_AXIS,  // a (AU) over [1.5, 5.5)
+    ELEMENT_ECCENTRICITY,     // e over [0, 1)
+    ELEMENT_PERIOD_RATIO,     // Orbital period over Jupiter's, over [0.2, 1.0)
+    ELEMENT_QUANTITIES
+} ElementQuantity;
+
+// Counts of one element in equal bins over [low, high)
+typedef struct {
+    double low, high;
+    long counts[ELEMENT_BINS];
+    long below, above;        // Values outside the range
+} ElementHistogram;
+
+// Histograms of the latest snapshot and of all snapshots together
+typedef struct {
+    double time;                                  // Simulation time of the latest snapshot
+    long snapshots;
+    int bodies;                                   // Bodies in the latest snapshot
+    int unbound;                                  // Of those, on open orbits (in the e histogram only)
+    ElementHistogram latest[ELEMENT_QUANTITIES];
+    ElementHistogram total[ELEMENT_QUANTITIES];   // Summed over every snapshot
+} ElementHistograms;
+
+// Semi-major axis and eccentricity of bodies[0..count) about central, and
+// their period over reference_period (0 = no ratio, left 0). a is
+// negative and e at least 1 on open orbits, whose ratio is 0. Contiguous
+// ranges are split across pool's workers (NULL = this thread).
+void orbital_elements_compute(const CelestialBody bodies[], int count, const CelestialBody* central,
+                              double reference_period, double a[], double e[], double period_ratio[],
+                              ThreadPool* pool);
+
+// Orbital period of body about central (0 on an open orbit)
+double orbital_period(const CelestialBody* body, const CelestialBody* central);
+
+// Element statistics updated every interval steps; snapshots are also
+// appended to output (may be NULL) as one CSV line per element:
+//     Time,Element,Low,High,Below,Above,B0,...,B99
+typedef struct {
+    int interval;
+    FILE* output;
+    ElementHistograms histograms;
+    double *a, *e, *period_ratio;  // Elements of the latest snapshot
+    int capacity;
+    ElementHistogram* partial;     // Per-worker counts, ELEMENT_QUANTITIES each
+    int partial_count;
+} ElementStats;
+
+// Starts empty statistics; output_path may be NULL. Returns NULL if the
+// output cannot be written.
+ElementStats* element_stats_create(const char* output_path, int interval);
+
+// Takes a snapshot of bodies[first..body_count) about bodies[0], with
+// period ratios against bodies[reference] (-1 = none)
+void element_stats_update(ElementStats* stats, const CelestialBody bodies[], int body_count, int first,
+                          int reference, double time, ThreadPool* pool);
+
+// Closes the output and frees the statistics
+void element_stats_destroy(ElementStats* stats);
+
+#endif
@@ -0,0 +1,698 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+
+#include "simulation.h"
+#include "engine.h"
+
+// Body counts the cost model is fitted at
+#define CALIBRATION_DIRECT_BODIES 256
+#define CALIBRATION_TREE_SMALL 256
+#define CALIBRATION_TREE_LARGE 2048
+
+// Time spent timing each measurement
+#define CALIBRATION_SECONDS 0.01
+
+// Test particles handled per tile; a tile's positions and accelerations
+// stay in L1 while every massive body is applied to it
+#define PARTICLE_TILE 64
+
+// Largest subtree whose bodies are paired as one group in the tree engine
+#define TREE_BUCKET_SIZE 16
+
+// Most workers one tree evaluation is split across
+#define TREE_MAX_WORKERS 64
+
+// Grows a workspace to hold count bodies
+static void reserve_direct(ForceWorkspace* workspace, int count) {
+    if (count <= workspace->capacity) {
+        return;
+    }
+    int capacity = workspace->capacity > 0 ? workspace->capacity : 64;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    workspace->x = (double*)realloc(workspace->x, capacity * sizeof(double));
+    workspace->y = (double*)realloc(workspace->y, capacity * sizeof(double));
+    workspace->mass = (double*)realloc(workspace->mass, capacity * sizeof(double));
+    workspace->fx = (double*)realloc(workspace->fx, capacity * sizeof(double));
+    workspace->fy = (double*)realloc(workspace->fy, capacity * sizeof(double));
+    if (!workspace->x || !workspace->y || !workspace->mass || !workspace->fx || !workspace->fy) {
+        fprintf(stderr, "Memory allocation failed for direct-sum buffers\n");
+        exit(EXIT_FAILURE);
+    }
+    workspace->capacity = capacity;
+}
+
+// Copies positions and masses into the SoA arrays and clears the forces
+static void gather_direct(ForceWorkspace* workspace, const CelestialBody bodies[], int body_count) {
+    reserve_direct(workspace, body_count);
+    for (int i = 0; i < body_count; i++) {
+        workspace->x[i] = bodies[i].x;
+        workspace->y[i] = bodies[i].y;
+        workspace->mass[i] = bodies[i].mass;
+        workspace->fx[i] = 0.0;
+        workspace->fy[i] = 0.0;
+    }
+}
+
+// Frees the arrays of a workspace
+void force_workspace_free(ForceWorkspace* workspace) {
+    free(workspace->x);
+    free(workspace->y);
+    free(workspace->mass);
+    free(workspace->fx);
+    free(workspace->fy);
+    free(workspace->buckets);
+    free(workspace->bucket_start);
+    free(workspace->bucket_bodies);
+    free(workspace->in_bucket);
+    free(workspace->thread_forces);
+    memset(workspace, 0, sizeof(*workspace));
+}
+
+// Sums the forces between all pairs into fx/fy (both are overwritten)
+void compute_direct_forces(ForceWorkspace* workspace, CelestialBody bodies[], int body_count) {
+    gather_direct(workspace, bodies, body_count);
+    const double* direct_x = workspace->x;
+    const double* direct_y = workspace->y;
+    const double* direct_mass = workspace->mass;
+    double* direct_fx = workspace->fx;
+    double* direct_fy = workspace->fy;
+
+    // Each pair is evaluated once and applied to both bodies. Coincident
+    // bodies get a zero factor instead of a branch, so the loop stays
+    // straight-line code.
+    for (int i = 0; i < body_count; i++) {
+        double xi = direct_x[i], yi = direct_y[i];
+        double gmi = G * direct_mass[i];
+        double fxi = 0.0, fyi = 0.0;
+        for (int j = i + 1; j < body_count; j++) {
+            double dx = direct_x[j] - xi;
+            double dy = direct_y[j] - yi;
+            double distance_squared = dx * dx + dy * dy;
+            double inverse_cube = distance_squared > EPSILON * EPSILON
+                                ? 1.0 / (distance_squared * sqrt(distance_squared)) : 0.0;
+            double factor = gmi * direct_mass[j] * inverse_cube;
+            fxi += factor * dx;
+            fyi += factor * dy;
+            direct_fx[j] -= factor * dx;
+            direct_fy[j] -= factor * dy;
+        }
+        direct_fx[i] += fxi;
+        direct_fy[i] += fyi;
+    }
+
+    for (int i = 0; i < body_count; i++) {
+        bodies[i].fx = direct_fx[i];
+        bodies[i].fy = direct_fy[i];
+    }
+}
+
+// Sums the exact forces on the first target_count bodies from all bodies
+// into their fx/fy (overwritten); the other bodies are not touched
+void compute_direct_forces_on(ForceWorkspace* workspace, CelestialBody bodies[], int body_count,
+                              int target_count) {
+    gather_direct(workspace, bodies, body_count);
+    const double* direct_x = workspace->x;
+    const double* direct_y = workspace->y;
+    const double* direct_mass = workspace->mass;
+
+    for (int i = 0; i < target_count && i < body_count; i++) {
+        double xi = direct_x[i], yi = direct_y[i];
+        double fxi = 0.0, fyi = 0.0;
+        for (int j = 0; j < body_count; j++) {
+            double dx = direct_x[j] - xi;
+            double dy = direct_y[j] - yi;
+            double distance_squared = dx * dx + dy * dy;
+            double inverse_cube = distance_squared > EPSILON * EPSILON
+                                ? 1.0 / (distance_squared * sqrt(distance_squared)) : 0.0;
+            double factor = direct_mass[j] * inverse_cube;  // Also zero for i itself
+            fxi += factor * dx;
+            fyi += factor * dy;
+        }
+        bodies[i].fx = G * direct_mass[i] * fxi;
+        bodies[i].fy = G * direct_mass[i] * fyi;
+    }
+}
+
+// Exact force on bodies[target] from each of the first massive_count
+// bodies (massive_fx/fy, zero from the target itself) and from all the
+// others together (light_fx/fy), summed directly in one pass; for
+// inspecting a single body
+void force_breakdown(const CelestialBody bodies[], int body_count, int massive_count, int target,
+                     double massive_fx[], double massive_fy[], double* light_fx, double* light_fy) {
+    const CelestialBody* body = &bodies[target];
+    double gm = G * body->mass;
+    *light_fx = 0.0;
+    *light_fy = 0.0;
+    for (int j = 0; j < body_count; j++) {
+        double dx = bodies[j].x - body->x;
+        double dy = bodies[j].y - body->y;
+        double distance_squared = dx * dx + dy * dy;
+        double inverse_cube = distance_squared > EPSILON * EPSILON
+                            ? 1.0 / (distance_squared * sqrt(distance_squared)) : 0.0;
+        double factor = gm * bodies[j].mass * inverse_cube;  // Also zero for the target itself
+        if (j < massive_count) {
+            massive_fx[j] = factor * dx;
+            massive_fy[j] = factor * dy;
+        } else {
+            *light_fx += factor * dx;
+            *light_fy += factor * dy;
+        }
+    }
+}
+
+// Adds the pull between two bodies to both, in a force buffer holding
+// fx, fy per body index, and their potential energy to *potential unless
+// it is NULL
+static void mutual_pair(double* forces, double* potential, const CelestialBody* bodies, const CelestialBody* a,
+                        const CelestialBody* b) {
+    double dx = b->x - a->x;
+    double dy = b->y - a->y;
+    double distance = sqrt(dx * dx + dy * dy);
+    if (distance < EPSILON) {
+        return;
+    }
+    double factor = G * a->mass * b->mass / (distance * distance * distance);
+    double* fa = &forces[2 * (a - bodies)];
+    double* fb = &forces[2 * (b - bodies)];
+    fa[0] += factor * dx;
+    fa[1] += factor * dy;
+    fb[0] -= factor * dx;
+    fb[1] -= factor * dy;
+    if (potential) {
+        *potential -= factor * distance * distance;
+    }
+}
+
+// Appends the bodies of a subtree to the current bucket
+static void gather_bucket_bodies(ForceWorkspace* workspace, const CelestialBody bodies[],
+                                 const QuadTreeNode* node) {
+    if (node == NULL || node->body_count == 0) {
+        return;
+    }
+    if (node->body != NULL) {
+        workspace->bucket_bodies[workspace->member_count++] = node->body;
+        workspace->in_bucket[node->body - bodies] = 1;
+        return;
+    }
+    gather_bucket_bodies(workspace, bodies, node->nw);
+    gather_bucket_bodies(workspace, bodies, node->ne);
+    gather_bucket_bodies(workspace, bodies, node->sw);
+    gather_bucket_bodies(workspace, bodies, node->se);
+}
+
+// Cuts the tree into buckets, the largest subtrees holding at most
+// TREE_BUCKET_SIZE bodies
+static void collect_buckets(ForceWorkspace* workspace, const CelestialBody bodies[], QuadTreeNode* node) {
+    if (node == NULL || node->body_count == 0) {
+        return;
+    }
+    if (node->body_count > TREE_BUCKET_SIZE) {
+        collect_buckets(workspace, bodies, node->nw);
+        collect_buckets(workspace, bodies, node->ne);
+        collect_buckets(workspace, bodies, node->sw);
+        collect_buckets(workspace, bodies, node->se);
+        return;
+    }
+    if (workspace->bucket_count + 1 >= workspace->bucket_capacity) {
+        workspace->bucket_capacity = workspace->bucket_capacity > 0 ? 2 * workspace->bucket_capacity : 256;
+        workspace->buckets = (QuadTreeNode**)realloc(workspace->buckets,
+                                                     workspace->bucket_capacity * sizeof(QuadTreeNode*));
+        workspace->bucket_start = (int*)realloc(workspace->bucket_start,
+                                                workspace->bucket_capacity * sizeof(int));
+        if (workspace->buckets == NULL || workspace->bucket_start == NULL) {
+            fprintf(stderr, "Memory allocation failed for tree buckets\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    workspace->buckets[workspace->bucket_count] = node;
+    workspace->bucket_start[workspace->bucket_count] = workspace->member_count;
+    workspace->bucket_count++;
+    gather_bucket_bodies(workspace, bodies, node);
+}
+
+// Gap between two node boxes (zero if they touch or overlap)
+static double box_gap(const QuadTreeNode* a, const QuadTreeNode* b) {
+    double gap_x = fmax(a->x - (b->x + b->width), b->x - (a->x + a->width));
+    double gap_y = fmax(a->y - (b->y + b->height), b->y - (a->y + a->height));
+    return fmax(0.0, fmax(gap_x, gap_y));
+}
+
+// Buckets whose boxes touch are neighbours and are paired body by body. A
+// node that does not touch a bucket holds none of its neighbours.
+static bool touches(const QuadTreeNode* bucket, const QuadTreeNode* node) {
+    return box_gap(bucket, node) <= 1e-12 * fmax(bucket->width, node->width);
+}
+
+// Orders buckets by their corner (disjoint boxes never share one), so each
+// pair of neighbours is summed by exactly one of the two
+static bool bucket_before(const QuadTreeNode* a, const QuadTreeNode* b) {
+    return a->x < b->x || (a->x == b->x && a->y < b->y);
+}
+
+// Mutual pull between every body of a bucket and every body of a subtree
+static void mutual_with_subtree(double* forces, double* potential, const CelestialBody bodies[],
+                                CelestialBody* const* members, int member_count, const QuadTreeNode* node) {
+    if (node == NULL || node->body_count == 0) {
+        return;
+    }
+    if (node->body != NULL) {
+        for (int m = 0; m < member_count; m++) {
+            mutual_pair(forces, potential, bodies, members[m], node->body);
+        }
+        return;
+    }
+    mutual_with_subtree(forces, potential, bodies, members, member_count, node->nw);
+    mutual_with_subtree(forces, potential, bodies, members, member_count, node->ne);
+    mutual_with_subtree(forces, potential, bodies, members, member_count, node->sw);
+    mutual_with_subtree(forces, potential, bodies, members, member_count, node->se);
+}
+
+// Adds what a bucket feels from a subtree: neighbouring buckets pair by
+// pair (each pair once, for both sides), everything else through the
+// Barnes-Hut walk of each member. Potential energy goes to *potential
+// unless it is NULL; a walked term is seen from both ends, so each end
+// adds half.
+static void bucket_walk(double* forces, double* potential, const CelestialBody bodies[],
+                        const QuadTreeNode* bucket, CelestialBody* const* members, int member_count,
+                        QuadTreeNode* node, double theta) {
+    if (node == NULL || node->body_count == 0 || node == bucket) {
+        return;
+    }
+    if (touches(bucket, node)) {
+        COUNT_VISIT(node);
+        if (node->body_count > TREE_BUCKET_SIZE) {
+            bucket_walk(forces, potential, bodies, bucket, members, member_count, node->nw, theta);
+            bucket_walk(forces, potential, bodies, bucket, members, member_count, node->ne, theta);
+            bucket_walk(forces, potential, bodies, bucket, members, member_count, node->sw, theta);
+            bucket_walk(forces, potential, bodies, bucket, members, member_count, node->se, theta);
+        } else if (bucket_before(bucket, node)) {
+            mutual_with_subtree(forces, potential, bodies, members, member_count, node);
+        }
+        return;
+    }
+    for (int m = 0; m < member_count; m++) {
+        double fx = 0.0, fy = 0.0, phi = 0.0;
+        calculate_force_and_potential_from_quadtree(members[m], node, theta, &fx, &fy, potential ? &phi : NULL);
+        forces[2 * (members[m] - bodies)] += fx;
+        forces[2 * (members[m] - bodies) + 1] += fy;
+        if (potential) {
+            *potential += 0.5 * members[m]->mass * phi;
+        }
+    }
+}
+
+// One worker's share of compute_tree_forces: buckets [first, last)
+typedef struct {
+    const ForceWorkspace* workspace;
+    QuadTreeNode* root;
+    const CelestialBody* bodies;
+    double theta;
+    double* forces;  // The worker's own buffer, fx, fy per body
+    bool want_potential;
+    double potential;  // The worker's share of the potential energy
+    int first, last;
+} TreeForceTask;
+
+static void run_tree_force_task(void* arg) {
+    TreeForceTask* task = (TreeForceTask*)arg;
+    const ForceWorkspace* workspace = task->workspace;
+    double* potential = task->want_potential ? &task->potential : NULL;
+    for (int b = task->first; b < task->last; b++) {
+        CelestialBody* const* members = &workspace->bucket_bodies[workspace->bucket_start[b]];
+        int member_count = workspace->bucket_start[b + 1] - workspace->bucket_start[b];
+        for (int i = 0; i < member_count; i++) {
+            for (int j = i + 1; j < member_count; j++) {
+                mutual_pair(task->forces, potential, task->bodies, members[i], members[j]);
+            }
+        }
+        bucket_walk(task->forces, potential, task->bodies, workspace->buckets[b], members, member_count,
+                    task->root, task->theta);
+    }
+}
+
+// Barnes-Hut forces on all bodies into fx/fy (overwritten), with each
+// near pair evaluated once for both bodies
+void compute_tree_forces(ForceWorkspace* workspace, QuadTreeNode* root, CelestialBody bodies[], int body_count,
+                         double theta, ThreadPool* pool, double* potential) {
+    if (workspace->member_capacity < body_count) {
+        workspace->member_capacity = body_count;
+        workspace->bucket_bodies = (CelestialBody**)realloc(workspace->bucket_bodies,
+                                                            body_count * sizeof(CelestialBody*));
+        workspace->in_bucket = (unsigned char*)realloc(workspace->in_bucket, body_count);
+        if (workspace->bucket_bodies == NULL || workspace->in_bucket == NULL) {
+            fprintf(stderr, "Memory allocation failed for tree buckets\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memset(workspace->in_bucket, 0, body_count);
+    workspace->bucket_count = 0;
+    workspace->member_count = 0;
+    collect_buckets(workspace, bodies, root);
+    if (workspace->bucket_capacity == 0) {
+        // No bodies in the tree; still room for the closing entry
+        workspace->bucket_capacity = 1;
+        workspace->bucket_start = (int*)malloc(sizeof(int));
+        if (workspace->bucket_start == NULL) {
+            fprintf(stderr, "Memory allocation failed for tree buckets\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    workspace->bucket_start[workspace->bucket_count] = workspace->member_count;
+
+    // One force buffer per worker, so no two workers add to the same body
+    int workers = pool ? thread_pool_size(pool) : 1;
+    if (workers > TREE_MAX_WORKERS) {
+        workers = TREE_MAX_WORKERS;
+    }
+    if (workers > workspace->bucket_count) {
+        workers = workspace->bucket_count > 0 ? workspace->bucket_count : 1;
+    }
+    size_t buffer_size = 2 * (size_t)body_count;
+    if (workspace->thread_capacity < workers * buffer_size) {
+        workspace->thread_capacity = workers * buffer_size;
+        workspace->thread_forces = (double*)realloc(workspace->thread_forces,
+                                                    workspace->thread_capacity * sizeof(double));
+        if (workspace->thread_forces == NULL) {
+            fprintf(stderr, "Memory allocation failed for tree force buffers\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memset(workspace->thread_forces, 0, workers * buffer_size * sizeof(double));
+
+    TreeForceTask tasks[TREE_MAX_WORKERS];
+    for (int w = 0; w < workers; w++) {
+        tasks[w].workspace = workspace;
+        tasks[w].root = root;
+        tasks[w].bodies = bodies;
+        tasks[w].theta = theta;
+        tasks[w].forces = workspace->thread_forces + w * buffer_size;
+        tasks[w].want_potential = potential != NULL;
+        tasks[w].potential = 0.0;
+        tasks[w].first = (int)((long)workspace->bucket_count * w / workers);
+        tasks[w].last = (int)((long)workspace->bucket_count * (w + 1) / workers);
+    }
+    if (workers > 1) {
+        for (int w = 0; w < workers; w++) {
+            thread_pool_submit(pool, run_tree_force_task, &tasks[w]);
+        }
+        thread_pool_wait(pool);
+    } else {
+        run_tree_force_task(&tasks[0]);
+    }
+
+    double total_potential = 0.0;
+    for (int w = 0; w < workers; w++) {
+        total_potential += tasks[w].potential;
+    }
+    for (int i = 0; i < body_count; i++) {
+        double fx = 0.0, fy = 0.0;
+        for (int w = 0; w < workers; w++) {
+            fx += workspace->thread_forces[w * buffer_size + 2 * i];
+            fy += workspace->thread_forces[w * buffer_size + 2 * i + 1];
+        }
+        bodies[i].fx = fx;
+        bodies[i].fy = fy;
+        // Bodies outside the tree's region still feel the ones inside
+        if (!workspace->in_bucket[i]) {
+            double phi = 0.0;
+            calculate_force_and_potential_from_quadtree(&bodies[i], root, theta, &bodies[i].fx, &bodies[i].fy,
+                                                        &phi);
+            total_potential += 0.5 * bodies[i].mass * phi;
+        }
+    }
+    if (potential) {
+        *potential = total_potential;
+    }
+}
+
+// Fills bodies with a Sun and a light belt out to 30 AU
+static void make_calibration_system(CelestialBody bodies[], int body_count) {
+    Uint32 state = 2463534242u;  // Private xorshift32; rand() is left alone
+    memset(bodies, 0, body_count * sizeof(CelestialBody));
+    bodies[0].mass = 1.0;
+    for (int i = 1; i < body_count; i++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        double radius = 0.4 + 29.6 * (state / 4294967296.0);
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        double angle = 2.0 * M_PI * (state / 4294967296.0);
+        bodies[i].x = radius * cos(angle);
+        bodies[i].y = radius * sin(angle);
+        bodies[i].mass = 1e-9;
+    }
+}
+
+// One full tree evaluation as the simulation does it: build, forces,
+// free
+static void run_tree_step(ForceWorkspace* workspace, CelestialBody bodies[], int body_count, double theta,
+                          ThreadPool* pool) {
+    QuadTreeNode* root = create_quadtree(-SIMULATION_REGION, -SIMULATION_REGION,
+                                         2 * SIMULATION_REGION, 2 * SIMULATION_REGION);
+    for (int i = 0; i < body_count; i++) {
+        insert_body(root, &bodies[i]);
+    }
+    calculate_center_of_mass(root);
+    compute_tree_forces(workspace, root, bodies, body_count, theta, pool, NULL);
+    free_quadtree(root);
+}
+
+// Fastest of repeated runs of one engine, in seconds
+static double time_engine(ForceWorkspace* workspace, CelestialBody bodies[], int body_count, bool tree,
+                          double theta, ThreadPool* pool) {
+    double frequency = (double)SDL_GetPerformanceFrequency();
+    double best = 0.0;
+    double spent = 0.0;
+    int runs = 0;
+    while (runs < 3 || spent < CALIBRATION_SECONDS) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        if (tree) {
+            run_tree_step(workspace, bodies, body_count, theta, pool);
+        } else {
+            compute_direct_forces(workspace, bodies, body_count);
+        }
+        double seconds = (SDL_GetPerformanceCounter() - start) / frequency;
+        if (runs == 0 || seconds < best) {
+            best = seconds;
+        }
+        spent += seconds;
+        runs++;
+    }
+    return best;
+}
+
+// Predicted seconds for a direct step
+static double direct_cost(const ForceEngine* engine, int body_count) {
+    return engine->pair_cost * 0.5 * body_count * (body_count - 1.0);
+}
+
+// Predicted seconds for a tree step
+static double tree_cost(const ForceEngine* engine, int body_count) {
+    return body_count * (engine->build_cost + engine->walk_cost * log2(body_count > 1 ? body_count : 2));
+}
+
+// Times both engines and fits the cost model (takes a few tens of ms)
+void force_engine_calibrate(ForceEngine* engine, ForceEngineKind mode, double theta, ThreadPool* pool) {
+    memset(engine, 0, sizeof(*engine));
+    engine->mode = mode;
+    engine->last = mode == FORCE_ENGINE_AUTO ? FORCE_ENGINE_TREE : mode;
+    engine->mixed_allowance = 0.1;
+    engine->particle_mass_ratio = 1e-6;
+
+    CelestialBody* bodies = (CelestialBody*)malloc(CALIBRATION_TREE_LARGE * sizeof(CelestialBody));
+    if (bodies == NULL) {
+        fprintf(stderr, "Memory allocation failed for engine calibration\n");
+        exit(EXIT_FAILURE);
+    }
+
+    ForceWorkspace workspace;
+    memset(&workspace, 0, sizeof(workspace));
+    int n = CALIBRATION_DIRECT_BODIES;
+    make_calibration_system(bodies, n);
+    engine->pair_cost = time_engine(&workspace, bodies, n, false, theta, NULL) / (0.5 * n * (n - 1.0));
+
+    // Per-body tree time at two sizes gives the build and per-level costs
+    int small = CALIBRATION_TREE_SMALL, large = CALIBRATION_TREE_LARGE;
+    make_calibration_system(bodies, small);
+    double small_per_body = time_engine(&workspace, bodies, small, true, theta, pool) / small;
+    make_calibration_system(bodies, large);
+    double large_per_body = time_engine(&workspace, bodies, large, true, theta, pool) / large;
+    force_workspace_free(&workspace);
+    free(bodies);
+
+    engine->walk_cost = (large_per_body - small_per_body) / (log2(large) - log2(small));
+    if (engine->walk_cost < 0.0) {
+        engine->walk_cost = 0.0;  // Timing noise; treat the tree cost as flat
+    }
+    engine->build_cost = small_per_body - engine->walk_cost * log2(small);
+    if (engine->build_cost < 0.0) {
+        engine->build_cost = 0.0;
+    }
+
+    engine->crossover = 2;
+    while (engine->crossover < (1 << 20) && direct_cost(engine, engine->crossover) <= tree_cost(engine, engine->crossover)) {
+        engine->crossover++;
+    }
+}
+
+// Picks the engine for a step over body_count bodies, of which the first
+// massive_count carry nearly all the mass; light_mass_ratio is the mass
+// of the others over theirs
+ForceEngineKind force_engine_choose(ForceEngine* engine, int body_count, int massive_count,
+                                    double light_mass_ratio) {
+    if (engine->mode != FORCE_ENGINE_AUTO) {
+        engine->last = engine->mode;
+    } else if (massive_count > 0 && massive_count <= NUM_PLANETS && body_count > massive_count &&
+               light_mass_ratio <= engine->particle_mass_ratio) {
+        // The light bodies' own pull is below the tree's force error, and
+        // a few exact terms per body beat both the walk and the full sum
+        engine->last = FORCE_ENGINE_PARTICLES;
+    } else if (body_count < engine->crossover) {
+        engine->last = FORCE_ENGINE_DIRECT;
+    } else {
+        // Exact sums for the massive bodies replace their tree walks; take
+        // them whenever they cost little next to the whole step
+        double tree = tree_cost(engine, body_count);
+        double extra = massive_count * (engine->pair_cost * body_count -
+                                        engine->walk_cost * log2(body_count));
+        engine->last = (massive_count > 0 && extra <= engine->mixed_allowance * tree)
+                     ? FORCE_ENGINE_MIXED : FORCE_ENGINE_TREE;
+    }
+    return engine->last;
+}
+
+// Total mass of the bodies after the first massive_count over the total
+// mass of the first massive_count
+double light_mass_ratio(const CelestialBody bodies[], int body_count, int massive_count) {
+    double massive = 0.0, light = 0.0;
+    for (int i = 0; i < body_count; i++) {
+        if (i < massive_count) {
+            massive += bodies[i].mass;
+        } else {
+            light += bodies[i].mass;
+        }
+    }
+    return massive > 0.0 ? light / massive : 0.0;
+}
+
+// Test-particle step for the bodies after the first massive_count (at most
+// NUM_PLANETS): computes their accelerations from the massive bodies and
+// integrates them in the same pass, storing the force in fx/fy. The
+// massive bodies are read but not moved. Returns the smallest
+// (r / |a|)^2 of the particles, r their distance from body 0, at the
+// positions their accelerations were taken at (INFINITY if none), and
+// stores that particle's index in *limiting_body (-1 if none).
+double advance_test_particles(CelestialBody bodies[], int body_count, int massive_count, double dt,
+                              int* limiting_body) {
+    // The few sources are copied once per step and broadcast over a tile
+    double source_x[NUM_PLANETS], source_y[NUM_PLANETS], source_gm[NUM_PLANETS];
+    if (massive_count > NUM_PLANETS) {
+        massive_count = NUM_PLANETS;
+    }
+    for (int k = 0; k < massive_count; k++) {
+        source_x[k] = bodies[k].x;
+        source_y[k] = bodies[k].y;
+        source_gm[k] = G * bodies[k].mass;
+    }
+
+    double x[PARTICLE_TILE], y[PARTICLE_TILE];
+    double ax[PARTICLE_TILE], ay[PARTICLE_TILE];
+    double ratio_sq[PARTICLE_TILE];
+    double min_ratio_sq = INFINITY;
+    *limiting_body = -1;
+    for (int start = massive_count; start < body_count; start += PARTICLE_TILE) {
+        CelestialBody* tile = &bodies[start];
+        int count = body_count - start < PARTICLE_TILE ? body_count - start : PARTICLE_TILE;
+
+        for (int j = 0; j < count; j++) {
+            x[j] = tile[j].x;
+            y[j] = tile[j].y;
+            ax[j] = 0.0;
+            ay[j] = 0.0;
+        }
+
+        // Source outside, particles inside: the inner loop runs over
+        // contiguous lanes with the source held in registers
+        for (int k = 0; k < massive_count; k++) {
+            double sx = source_x[k], sy = source_y[k], gm = source_gm[k];
+            for (int j = 0; j < count; j++) {
+                double dx = sx - x[j];
+                double dy = sy - y[j];
+                double distance_squared = dx * dx + dy * dy;
+                double inverse_cube = distance_squared > EPSILON * EPSILON
+                                    ? 1.0 / (distance_squared * sqrt(distance_squared)) : 0.0;
+                ax[j] += gm * inverse_cube * dx;
+                ay[j] += gm * inverse_cube * dy;
+            }
+        }
+
+        // Time-step measure of each particle, as timestep_choose takes it
+        // from the forces; the divisions are vectorized, the search is not
+        for (int j = 0; j < count; j++) {
+            double rx = x[j] - source_x[0];
+            double ry = y[j] - source_y[0];
+            double accel_squared = ax[j] * ax[j] + ay[j] * ay[j];
+            ratio_sq[j] = accel_squared > EPSILON * EPSILON ? (rx * rx + ry * ry) / accel_squared : INFINITY;
+        }
+        for (int j = 0; j < count; j++) {
+            if (ratio_sq[j] < min_ratio_sq) {
+                min_ratio_sq = ratio_sq[j];
+                *limiting_body = start + j;
+            }
+        }
+
+        // Integrate while the tile is still in cache (same scheme as update_body)
+        for (int j = 0; j < count; j++) {
+            CelestialBody* body = &tile[j];
+            body->fx = body->mass * ax[j];
+            body->fy = body->mass * ay[j];
+            body->vx += ax[j] * dt;
+            body->vy += ay[j] * dt;
+            body->x = x[j] + body->vx * dt;
+            body->y = y[j] + body->vy * dt;
+        }
+    }
+    return min_ratio_sq;
+}
+
+// Short engine name for messages and the HUD
+const char* force_engine_name(ForceEngineKind kind) {
+    switch (kind) {
+        case FORCE_ENGINE_AUTO: return "auto";
+        case FORCE_ENGINE_DIRECT: return "direct";
+        case FORCE_ENGINE_TREE: return "tree";
+        case FORCE_ENGINE_MIXED: return "mixed";
+        case FORCE_ENGINE_PARTICLES: return "particles";
+        case FORCE_ENGINE_TREEPM: return "treepm";
+    }
+    return "?";
+}
+
+// Parses "auto", "direct", "tree", "mixed", "particles" or "treepm"; returns
+// 0 on success
+int force_engine_parse(const char* name, ForceEngineKind* kind) {
+    if (strcmp(name, "auto") == 0) {
+        *kind = FORCE_ENGINE_AUTO;
+    } else if (strcmp(name, "direct") == 0) {
+        *kind = FORCE_ENGINE_DIRECT;
+    } else if (strcmp(name, "tree") == 0) {
+        *kind = FORCE_ENGINE_TREE;
+    } else if (strcmp(name, "mixed") == 0) {
+        *kind = FORCE_ENGINE_MIXED;
+    } else if (strcmp(name, "particles") == 0) {
+        *kind = FORCE_ENGINE_PARTICLES;
+    } else if (strcmp(name, "treepm") == 0) {
+        *kind = FORCE_ENGINE_TREEPM;
+    } else {
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,125 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stdbool.h>
+#include "simulation.h"
+#include "thread_pool.h"
+
+// Force engine selection. Small systems are cheaper to sum directly than to
+// build and walk a tree for, large ones are not; where the two meet depends
+// on the machine. At startup both paths are timed on a synthetic belt and
+// fitted to a cost model
+//     direct(N) = pair_cost * N(N-1)/2
+//     tree(N)   = N * (build_cost + walk_cost * log2 N)
+// which then picks the engine for every step from the current body count.
+//
+// When the light bodies together weigh next to nothing (asteroids against
+// the planets) they are treated as test particles instead: the massive
+// bodies are summed exactly among themselves, and the light ones only feel
+// the massive ones, in one fused force-and-integrate pass over tiles.
+typedef enum {
+    FORCE_ENGINE_AUTO,      // Chosen per step
+    FORCE_ENGINE_DIRECT,    // All pairs, exact
+    FORCE_ENGINE_TREE,      // Barnes-Hut for every body
+    FORCE_ENGINE_MIXED,     // Barnes-Hut for the light bodies, exact sums for the massive ones
+    FORCE_ENGINE_PARTICLES, // Light bodies as test particles of the massive ones
+    FORCE_ENGINE_TREEPM     // Tree within a cutoff, particle mesh beyond (never picked by auto)
+} ForceEngineKind;
+
+typedef struct {
+    ForceEngineKind mode;       // FORCE_ENGINE_AUTO or a fixed engine
+    ForceEngineKind last;       // Engine used by the last step
+    double pair_cost;           // Seconds per pair in the direct sum
+    double build_cost;          // Seconds per body to build the tree
+    double walk_cost;           // Seconds per body and tree level walked
+    int crossover;              // Smallest body count at which the tree is cheaper
+    double mixed_allowance;     // Extra cost (fraction of a tree step) worth paying
+                                // for exact forces on the massive bodies
+    double particle_mass_ratio; // Largest light/massive mass ratio for test particles
+} ForceEngine;
+
+// Positions, masses and forces gathered for a direct sum (SoA, so the
+// inner loops run over contiguous arrays and can be vectorized). Every
+// thread summing forces needs its own; start from all zeros.
+typedef struct {
+    double* x;
+    double* y;
+    double* mass;
+    double* fx;
+    double* fy;
+    int capacity;
+
+    // Tree engine: the tree cut into buckets of a few bodies, their
+    // bodies (bucket b holds bucket_bodies[bucket_start[b] .. bucket_start[b + 1]))
+    // and one force buffer per worker
+    QuadTreeNode** buckets;
+    int* bucket_start;
+    int bucket_count, bucket_capacity;
+    CelestialBody** bucket_bodies;
+    unsigned char* in_bucket;   // Per body: found in the tree
+    int member_count, member_capacity;
+    double* thread_forces;
+    size_t thread_capacity;
+} ForceWorkspace;
+
+// Times both engines and fits the cost model (takes a few tens of ms); the
+// tree is timed on pool's workers (NULL = this thread), as it will run
+void force_engine_calibrate(ForceEngine* engine, ForceEngineKind mode, double theta, ThreadPool* pool);
+
+// Picks the engine for a step over body_count bodies, of which the first
+// massive_count carry nearly all the mass; light_mass_ratio is the mass
+// of the others over theirs
+ForceEngineKind force_engine_choose(ForceEngine* engine, int body_count, int massive_count,
+                                    double light_mass_ratio);
+
+// Total mass of the bodies after the first massive_count over the total
+// mass of the first massive_count
+double light_mass_ratio(const CelestialBody bodies[], int body_count, int massive_count);
+
+// Sums the forces between all pairs into fx/fy (both are overwritten)
+void compute_direct_forces(ForceWorkspace* workspace, CelestialBody bodies[], int body_count);
+
+// Sums the exact forces on the first target_count bodies from all bodies
+// into their fx/fy (overwritten); the other bodies are not touched
+void compute_direct_forces_on(ForceWorkspace* workspace, CelestialBody bodies[], int body_count,
+                              int target_count);
+
+// Barnes-Hut forces on all bodies into fx/fy (overwritten). The tree
+// (centres of mass computed) is cut into buckets of up to 16 bodies;
+// bodies in touching buckets are summed exactly, each pair once and
+// applied to both, and everything further away comes from each body's
+// walk. The buckets are split across pool's workers (NULL = this thread),
+// each adding into its own buffer, and the buffers are summed at the end.
+// Unless potential is NULL, the total potential energy of the same
+// approximation is stored there, accumulated in the same pass.
+void compute_tree_forces(ForceWorkspace* workspace, QuadTreeNode* root, CelestialBody bodies[], int body_count,
+                         double theta, ThreadPool* pool, double* potential);
+
+// Frees the arrays of a workspace
+void force_workspace_free(ForceWorkspace* workspace);
+
+// Test-particle step for the bodies after the first massive_count (at most
+// NUM_PLANETS): computes their accelerations from the massive bodies and
+// integrates them in the same pass, storing the force in fx/fy. The
+// massive bodies are read but not moved. Returns the smallest
+// (r / |a|)^2 of the particles, r their distance from body 0, at the
+// positions their accelerations were taken at (INFINITY if none), and
+// stores that particle's index in *limiting_body (-1 if none).
+double advance_test_particles(CelestialBody bodies[], int body_count, int massive_count, double dt,
+                              int* limiting_body);
+
+// Exact force on bodies[target] from each of the first massive_count
+// bodies (massive_fx/fy, zero from the target itself) and from all the
+// others together (light_fx/fy), summed directly in one pass; for
+// inspecting a single body
+void force_breakdown(const CelestialBody bodies[], int body_count, int massive_count, int target,
+                     double massive_fx[], double massive_fy[], double* light_fx, double* light_fy);
+
+// Short engine name for messages and the HUD
+const char* force_engine_name(ForceEngineKind kind);
+
+// Parses "auto", "direct", "tree", "mixed", "particles" or "treepm"; returns
+// 0 on success
+int force_engine_parse(const char* name, ForceEngineKind* kind);
+
+#endif
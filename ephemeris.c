@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "simulation.h"
+#include "ephemeris.h"
+
+#define EPHEMERIS_MAGIC "EPHEM01"
+
+// Largest RK4 step used while building (the live simulation uses ~0.01)
+#define EPHEMERIS_MAX_STEP 1e-3
+
+struct Ephemeris {
+    void* mapping;                  // Whole file
+    size_t size;
+    const EphemerisHeader* header;
+    const double* coefficients;     // [segment][body][axis][degree + 1]
+};
+
+// State of the integrated bodies
+typedef struct {
+    double x[EPHEMERIS_MAX_BODIES], y[EPHEMERIS_MAX_BODIES];
+    double vx[EPHEMERIS_MAX_BODIES], vy[EPHEMERIS_MAX_BODIES];
+} OrbitState;
+
+// Accelerations of all bodies from each other (direct summation)
+static void orbit_accelerations(const OrbitState* state, const double masses[], int count,
+                                double ax[], double ay[]) {
+    for (int i = 0; i < count; i++) {
+        ax[i] = 0.0;
+        ay[i] = 0.0;
+    }
+    for (int i = 0; i < count; i++) {
+        for (int j = i + 1; j < count; j++) {
+            double dx = state->x[j] - state->x[i];
+            double dy = state->y[j] - state->y[i];
+            double distance_squared = dx * dx + dy * dy;
+            if (distance_squared < EPSILON * EPSILON) {
+                continue;
+            }
+            double inverse_cube = 1.0 / (distance_squared * sqrt(distance_squared));
+            ax[i] += G * masses[j] * inverse_cube * dx;
+            ay[i] += G * masses[j] * inverse_cube * dy;
+            ax[j] -= G * masses[i] * inverse_cube * dx;
+            ay[j] -= G * masses[i] * inverse_cube * dy;
+        }
+    }
+}
+
+// One classical Runge-Kutta step of length h
+static void orbit_rk4_step(OrbitState* state, const double masses[], int count, double h) {
+    OrbitState k[4];
+    OrbitState stage = *state;
+    double ax[EPHEMERIS_MAX_BODIES], ay[EPHEMERIS_MAX_BODIES];
+    static const double stage_factor[4] = { 0.0, 0.5, 0.5, 1.0 };
+
+    for (int s = 0; s < 4; s++) {
+        if (s > 0) {
+            for (int i = 0; i < count; i++) {
+                stage.x[i] = state->x[i] + stage_factor[s] * h * k[s - 1].x[i];
+                stage.y[i] = state->y[i] + stage_factor[s] * h * k[s - 1].y[i];
+                stage.vx[i] = state->vx[i] + stage_factor[s] * h * k[s - 1].vx[i];
+                stage.vy[i] = state->vy[i] + stage_factor[s] * h * k[s - 1].vy[i];
+            }
+        }
+        orbit_accelerations(&stage, masses, count, ax, ay);
+        for (int i = 0; i < count; i++) {
+            k[s].x[i] = stage.vx[i];
+            k[s].y[i] = stage.vy[i];
+            k[s].vx[i] = ax[i];
+            k[s].vy[i] = ay[i];
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        state->x[i] += h / 6.0 * (k[0].x[i] + 2.0 * k[1].x[i] + 2.0 * k[2].x[i] + k[3].x[i]);
+        state->y[i] += h / 6.0 * (k[0].y[i] + 2.0 * k[1].y[i] + 2.0 * k[2].y[i] + k[3].y[i]);
+        state->vx[i] += h / 6.0 * (k[0].vx[i] + 2.0 * k[1].vx[i] + 2.0 * k[2].vx[i] + k[3].vx[i]);
+        state->vy[i] += h / 6.0 * (k[0].vy[i] + 2.0 * k[1].vy[i] + 2.0 * k[2].vy[i] + k[3].vy[i]);
+    }
+}
+
+// Integrates the state forward by duration in equal steps of at most
+// EPHEMERIS_MAX_STEP, so it lands exactly on the requested time
+static void orbit_advance(OrbitState* state, const double masses[], int count, double duration) {
+    if (duration <= 0.0) {
+        return;
+    }
+    int steps = (int)ceil(duration / EPHEMERIS_MAX_STEP);
+    double h = duration / steps;
+    for (int s = 0; s < steps; s++) {
+        orbit_rk4_step(state, masses, count, h);
+    }
+}
+
+// Integrates the first body_count bodies from their current state at
+// start_time for span time units and writes the ephemeris to path.
+// The file is written under a temporary name and renamed over path when
+// complete, so runs that have the old file mapped keep reading it intact.
+// Returns 0 on success.
+int ephemeris_build(const char* path, const CelestialBody bodies[], int body_count, double start_time,
+                    double span, double segment_length, int degree) {
+    if (body_count < 1 || body_count > EPHEMERIS_MAX_BODIES ||
+        degree < 1 || degree > EPHEMERIS_MAX_DEGREE || segment_length <= 0.0 || span <= 0.0) {
+        fprintf(stderr, "Invalid ephemeris parameters\n");
+        return -1;
+    }
+
+    // Truncating path in place would pull the pages out from under any
+    // process that has it mapped (SIGBUS on its next read)
+    size_t temp_size = strlen(path) + 32;
+    char* temp_path = (char*)malloc(temp_size);
+    if (temp_path == NULL) {
+        fprintf(stderr, "Memory allocation failed for ephemeris path\n");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(temp_path, temp_size, "%s.%ld.tmp", path, (long)getpid());
+    FILE* file = fopen(temp_path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to create ephemeris %s\n", temp_path);
+        free(temp_path);
+        return -1;
+    }
+
+    EphemerisHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, EPHEMERIS_MAGIC, sizeof(EPHEMERIS_MAGIC));
+    header.body_count = body_count;
+    header.degree = degree;
+    header.segment_count = (int)ceil(span / segment_length);
+    header.start_time = start_time;
+    header.segment_length = segment_length;
+
+    OrbitState state;
+    memset(&state, 0, sizeof(state));
+    for (int i = 0; i < body_count; i++) {
+        header.masses[i] = bodies[i].mass;
+        state.x[i] = bodies[i].x;
+        state.y[i] = bodies[i].y;
+        state.vx[i] = bodies[i].vx;
+        state.vy[i] = bodies[i].vy;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+
+    // Chebyshev nodes on [-1, 1] in ascending order, and the cosine table
+    // turning samples at them into coefficients
+    int nodes = degree + 1;
+    double node_u[EPHEMERIS_MAX_DEGREE + 1];
+    double basis[EPHEMERIS_MAX_DEGREE + 1][EPHEMERIS_MAX_DEGREE + 1];  // [coefficient][node]
+    for (int k = 0; k < nodes; k++) {
+        double angle = M_PI * (nodes - k - 0.5) / nodes;
+        node_u[k] = cos(angle);
+        for (int j = 0; j < nodes; j++) {
+            basis[j][k] = cos(j * angle);
+        }
+    }
+
+    double samples_x[EPHEMERIS_MAX_BODIES][EPHEMERIS_MAX_DEGREE + 1];
+    double samples_y[EPHEMERIS_MAX_BODIES][EPHEMERIS_MAX_DEGREE + 1];
+    double series[EPHEMERIS_MAX_DEGREE + 1];
+    double half = 0.5 * segment_length;
+    double time = start_time;
+    for (int segment = 0; segment < header.segment_count; segment++) {
+        double middle = start_time + segment * segment_length + half;
+
+        // Sample every body at the nodes, then finish the segment
+        for (int k = 0; k < nodes; k++) {
+            double node_time = middle + half * node_u[k];
+            orbit_advance(&state, header.masses, body_count, node_time - time);
+            time = node_time;
+            for (int i = 0; i < body_count; i++) {
+                samples_x[i][k] = state.x[i];
+                samples_y[i][k] = state.y[i];
+            }
+        }
+        orbit_advance(&state, header.masses, body_count, middle + half - time);
+        time = middle + half;
+
+        for (int i = 0; i < body_count; i++) {
+            for (int axis = 0; axis < 2; axis++) {
+                const double* samples = axis == 0 ? samples_x[i] : samples_y[i];
+                for (int j = 0; j < nodes; j++) {
+                    double sum = 0.0;
+                    for (int k = 0; k < nodes; k++) {
+                        sum += samples[k] * basis[j][k];
+                    }
+                    series[j] = (j == 0 ? 1.0 : 2.0) * sum / nodes;
+                }
+                fwrite(series, sizeof(double), nodes, file);
+            }
+        }
+    }
+
+    bool written = !ferror(file);
+    if (fclose(file) != 0 || !written) {
+        fprintf(stderr, "Failed to write ephemeris %s\n", temp_path);
+        remove(temp_path);
+        free(temp_path);
+        return -1;
+    }
+    if (rename(temp_path, path) != 0) {
+        fprintf(stderr, "Failed to replace ephemeris %s\n", path);
+        remove(temp_path);
+        free(temp_path);
+        return -1;
+    }
+    free(temp_path);
+    return 0;
+}
+
+// Maps an ephemeris file (NULL if it is missing or not valid)
+Ephemeris* ephemeris_open(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(EphemerisHeader)) {
+        close(fd);
+        return NULL;
+    }
+    void* mapping = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);  // The mapping stays valid
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+
+    const EphemerisHeader* header = (const EphemerisHeader*)mapping;
+    size_t expected = sizeof(EphemerisHeader);
+    bool valid = memcmp(header->magic, EPHEMERIS_MAGIC, sizeof(EPHEMERIS_MAGIC)) == 0 &&
+                 header->body_count >= 1 && header->body_count <= EPHEMERIS_MAX_BODIES &&
+                 header->degree >= 1 && header->degree <= EPHEMERIS_MAX_DEGREE &&
+                 header->segment_count >= 1 && header->segment_length > 0.0;
+    if (valid) {
+        expected += (size_t)header->segment_count * header->body_count * 2 *
+                    (header->degree + 1) * sizeof(double);
+        valid = (size_t)info.st_size == expected;
+    }
+    if (!valid) {
+        fprintf(stderr, "Ignoring invalid ephemeris %s\n", path);
+        munmap(mapping, (size_t)info.st_size);
+        return NULL;
+    }
+
+    Ephemeris* ephemeris = (Ephemeris*)malloc(sizeof(Ephemeris));
+    if (ephemeris == NULL) {
+        fprintf(stderr, "Memory allocation failed for ephemeris\n");
+        exit(EXIT_FAILURE);
+    }
+    ephemeris->mapping = mapping;
+    ephemeris->size = (size_t)info.st_size;
+    ephemeris->header = header;
+    ephemeris->coefficients = (const double*)(header + 1);
+    return ephemeris;
+}
+
+// True if the ephemeris holds the first body_count bodies, with the same
+// masses and the same positions and velocities at its start time
+bool ephemeris_matches(const Ephemeris* ephemeris, const CelestialBody bodies[], int body_count) {
+    const EphemerisHeader* header = ephemeris->header;
+    if (header->body_count != body_count) {
+        return false;
+    }
+    for (int i = 0; i < body_count; i++) {
+        double x, y, vx, vy;
+        ephemeris_state(ephemeris, i, header->start_time, &x, &y, &vx, &vy);
+        if (header->masses[i] != bodies[i].mass ||
+            fabs(x - bodies[i].x) > 1e-6 || fabs(y - bodies[i].y) > 1e-6 ||
+            fabs(vx - bodies[i].vx) > 1e-6 || fabs(vy - bodies[i].vy) > 1e-6) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Last time the ephemeris covers
+double ephemeris_end_time(const Ephemeris* ephemeris) {
+    const EphemerisHeader* header = ephemeris->header;
+    return header->start_time + header->segment_count * header->segment_length;
+}
+
+// Sums a Chebyshev series and its derivative at u in [-1, 1]
+static void evaluate_series(const double* series, int degree, double u, double* value, double* slope) {
+    // T_k by the usual recurrence, T'_k = k U_(k-1) with U the second kind
+    double t_previous = 1.0, t_current = u;
+    double u_previous = 1.0, u_current = 2.0 * u;
+    double sum = series[0] + series[1] * u;
+    double derivative = series[1];
+    for (int k = 2; k <= degree; k++) {
+        double t_next = 2.0 * u * t_current - t_previous;
+        sum += series[k] * t_next;
+        derivative += series[k] * k * u_current;
+        double u_next = 2.0 * u * u_current - u_previous;
+        t_previous = t_current;
+        t_current = t_next;
+        u_previous = u_current;
+        u_current = u_next;
+    }
+    *value = sum;
+    *slope = derivative;
+}
+
+// Position and velocity of a body at time t (clamped to the covered span)
+void ephemeris_state(const Ephemeris* ephemeris, int body, double t,
+                     double* x, double* y, double* vx, double* vy) {
+    const EphemerisHeader* header = ephemeris->header;
+    double offset = (t - header->start_time) / header->segment_length;
+    int segment = (int)floor(offset);
+    if (segment < 0) {
+        segment = 0;
+    } else if (segment >= header->segment_count) {
+        segment = header->segment_count - 1;
+    }
+    double u = 2.0 * (offset - segment) - 1.0;
+    if (u < -1.0) u = -1.0;
+    if (u > 1.0) u = 1.0;
+
+    int length = header->degree + 1;
+    const double* series = ephemeris->coefficients +
+                           ((size_t)segment * header->body_count + body) * 2 * length;
+    double scale = 2.0 / header->segment_length;  // du/dt
+    double slope;
+    evaluate_series(series, header->degree, u, x, &slope);
+    *vx = slope * scale;
+    evaluate_series(series + length, header->degree, u, y, &slope);
+    *vy = slope * scale;
+}
+
+// Unmaps the file and frees the handle
+void ephemeris_close(Ephemeris* ephemeris) {
+    if (ephemeris == NULL) {
+        return;
+    }
+    munmap(ephemeris->mapping, ephemeris->size);
+    free(ephemeris);
+}
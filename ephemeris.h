@@ -0,0 +1,60 @@
+#ifndef EPHEMERIS_H
+#define EPHEMERIS_H
+
+#include <stdbool.h>
+#include "simulation.h"
+
+// Largest number of bodies and Chebyshev degree an ephemeris file may hold
+#define EPHEMERIS_MAX_BODIES 16
+#define EPHEMERIS_MAX_DEGREE 32
+
+// Precomputed planet motion. When the asteroids are test particles the
+// planets do not depend on them, so their orbits can be integrated once
+// (with RK4 and a small step, far more accurately than the live
+// simulation) and reused by every later run. The span is cut into equal
+// segments; in each, every coordinate of every body is a Chebyshev series
+// interpolating the integrated orbit at the Chebyshev nodes. Velocities
+// come from the derivative of the series.
+//
+// The file is the header below followed by the coefficients, laid out
+// [segment][body][x, y][degree + 1] as native doubles, and is mapped into
+// memory as it is, so several processes can share one copy.
+typedef struct {
+    char magic[8];                          // "EPHEM01"
+    int body_count;
+    int degree;                             // Chebyshev degree of every series
+    int segment_count;
+    int reserved;
+    double start_time;
+    double segment_length;                  // Simulated time per segment
+    double masses[EPHEMERIS_MAX_BODIES];    // To check the file fits the bodies
+} EphemerisHeader;
+
+typedef struct Ephemeris Ephemeris;
+
+// Integrates the first body_count bodies from their current state at
+// start_time for span time units and writes the ephemeris to path.
+// The file is written under a temporary name and renamed over path when
+// complete, so runs that have the old file mapped keep reading it intact.
+// Returns 0 on success.
+int ephemeris_build(const char* path, const CelestialBody bodies[], int body_count, double start_time,
+                    double span, double segment_length, int degree);
+
+// Maps an ephemeris file (NULL if it is missing or not valid)
+Ephemeris* ephemeris_open(const char* path);
+
+// True if the ephemeris holds the first body_count bodies, with the same
+// masses and the same positions and velocities at its start time
+bool ephemeris_matches(const Ephemeris* ephemeris, const CelestialBody bodies[], int body_count);
+
+// Last time the ephemeris covers
+double ephemeris_end_time(const Ephemeris* ephemeris);
+
+// Position and velocity of a body at time t (clamped to the covered span)
+void ephemeris_state(const Ephemeris* ephemeris, int body, double t,
+                     double* x, double* y, double* vx, double* vy);
+
+// Unmaps the file and frees the handle
+void ephemeris_close(Ephemeris* ephemeris);
+
+#endif
@@ -12,106 +12,323 @@
 #include <math.h>
 #include <stdbool.h>
 #include <time.h>
+#include <ctype.h>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
 
 #include "planet.h"
+#include "simulation.h"
+#include "recorder.h"
+#include "telemetry.h"
+#include "timestep.h"
+#include "trajectory.h"
+#include "engine.h"
+#include "ephemeris.h"
+#include "thread_pool.h"
+#include "batch.h"
+#include "pm.h"
+#include "approach.h"
+#include "elements.h"
+#include "removal.h"
+#include "query.h"
 
 // Simulation window dimensions - matching sdl_render.c
 #define WIDTH 2400
 #define HEIGHT 2400
 #define COLOR_WHITE 0xffffffff
 #define COLOR_BLACK 0x00000000
+#define MAX_BODY_RADIUS 25         // Largest drawn body radius in pixels (the Sun)
+#define EPHEMERIS_SEGMENT_LENGTH 0.5  // Time per Chebyshev segment of a built ephemeris
+#define EPHEMERIS_DEGREE 12           // Below 1e-11 AU from the integrated orbits
+#define SPAWN_BATCH 8192              // Most spawned bodies joining per step (a few ms of work)
+#define PICK_SLACK_PIXELS 8           // How far outside a body's drawn radius a click still picks it
+#define TRAIL_MAX_SHIFTS 256          // Pans of a trail buffer before it is projected afresh (bounds float drift)
 
-// Gravitational constant for simulation
-#define G 1.0                // Adjusted gravitational constant for this simulation
-#define EPSILON 1e-9         // Small value to prevent division by zero
+// Command line options
+typedef struct {
+    bool headless;              // No window; frames are only rendered offscreen
+    const char* record_dir;     // Directory for recorded frames (NULL = off)
+    RecordFormat record_format; // Encoding of recorded frames
+    int record_width;           // Size of recorded frames in pixels
+    int record_height;
+    int record_every;           // Record one frame every N simulation steps
+    int record_workers;         // Number of encoder threads
+    long max_steps;             // Stop after this many steps (0 = no limit)
+    bool adaptive_dt;           // Start with the adaptive time-step controller on
+    int substeps;               // Physics steps per rendered frame
+    int target_fps;             // Frame rate cap without vsync (0 = uncapped)
+    bool vsync;                 // Let the display pace the frames
+    bool paused;                // Start paused
+    long skip_steps;            // Fast-forward this many steps before showing anything
+    ForceEngineKind engine;     // Force engine (auto picks per step)
+    const char* ephemeris_path; // Planet ephemeris file (NULL = integrate the planets)
+    double ephemeris_span;      // Simulated time a newly built ephemeris covers
+    const char* ensemble_path;  // Ensemble member list (NULL = normal run)
+    const char* ensemble_output;  // Aggregated ensemble results (CSV)
+    int ensemble_workers;       // Threads running ensemble members (0 = one per CPU)
+    int clone_count;            // Asteroid clone systems to batch (0 = normal run)
+    double clone_radius;        // Starting orbit radius of the clones
+    double clone_dt;            // Fixed time step of the clone systems
+    const char* clones_output;  // Final clone states (CSV)
+    int mesh_size;              // Particle-mesh nodes per side for --engine treepm
+    PmAssignment mesh_assignment;  // Mass assignment of the particle mesh
+    int treepm_report;          // Bodies in the tree vs TreePM report (0 = off)
+    const char* approach_path;  // Close-approach event log (NULL = not monitored)
+    double approach_distance;   // Passes closer than this to a planet are logged (AU)
+    const char* elements_path;  // Orbital-element histograms (CSV, NULL = not written)
+    int elements_interval;      // Steps between element snapshots
+    const char* spawn_path;     // Scripted asteroid clouds (NULL = none)
+    int spawn_count;            // Asteroids per shift-clicked cloud
+    double spawn_radius;        // Radius of a shift-clicked cloud (AU)
+    int remove_interval;        // Steps between removals of escaped and captured bodies (0 = never)
+    const char* removals_path;  // Removed bodies (CSV, NULL = not written)
+    const char* force_trace_path;  // Force trace of the picked body (written once G is pressed)
+} RunOptions;
+
+// The picked body as its info overlay shows it, gathered once per frame
+typedef struct {
+    const CelestialBody* body;
+    double distance;                // From the Sun (AU)
+    bool orbits;                    // Not the Sun itself, so the elements below mean something
+    double a, e;                    // Osculating elements about the Sun
+    double period;                  // Orbital period (0 = open orbit)
+    double period_ratio;            // Over the reference body's period
+    const char* reference;          // Name of the reference body (NULL = none)
+    const CelestialBody* massive;   // Bodies with their own line in the force breakdown
+    int massive_count;
+    double massive_fx[NUM_PLANETS], massive_fy[NUM_PLANETS];
+    double light_fx, light_fy;      // From all the other bodies together
+    int light_count;
+    bool light_applied;             // The last step's engine applied that pull (particles skip it)
+    bool traced;                    // Its forces are written every step
+} BodyInfo;
+
+// Values shown in the heads-up display
+typedef struct {
+    double dt;                          // Current time step
+    double theta;                       // Current Barnes-Hut opening angle
+    bool adaptive_dt;                   // dt is chosen by the controller
+    const TimestepController* timestep; // Source of the dt history sparkline
+    const TelemetryReport* telemetry;   // Latest accuracy report (NULL = hidden)
+    double fps;                         // Measured frame rate
+    int substeps;                       // Physics steps per frame
+    bool paused;
+    long skip_remaining;                // Steps left in a fast-forward jump
+    ForceEngineKind engine;             // Force engine of the last step
+    bool have_step_energy;              // Tree steps have measured the energy
+    double step_energy;
+    double step_energy_drift;           // (E - E0) / |E0| of the step energy
+    const ElementHistograms* elements;  // Orbital-element histograms (NULL = hidden)
+    const BodyInfo* selected;           // Picked body's overlay (NULL = none picked)
+} HudInfo;
+
+// A cloud of asteroids added during a run (one line of a --spawn script)
+typedef struct {
+    long step;                      // Added before this step is taken
+    double x, y;                    // Centre (AU)
+    double radius;                  // The bodies are spread evenly over this disk
+    int count;
+} SpawnEvent;
+
+// A cloud still being added: the rest of its bodies come from its own
+// random sequence a batch at a time
+typedef struct {
+    double x, y, radius;
+    int remaining;
+    Uint32 state;
+} PendingCloud;
 
-// Barnes-Hut opening angle threshold
-#define THETA 0.5
+// Physics state advanced by step_simulation
+typedef struct {
+    CelestialBody* bodies;
+    int body_count;
+    int body_capacity;              // Room in bodies (grows by doubling; moving it invalidates tree)
+    PendingCloud* clouds;           // Clouds still joining, oldest first
+    int cloud_count, cloud_capacity;
+    long clouds_spawned;            // Seeds the next cloud
+    long asteroids_named;           // Asteroids named so far (Ast0, Ast1, ...)
+    SpawnEvent* spawns;             // Scripted clouds in step order (not owned)
+    int spawn_count, next_spawn;
+    int next_id;                    // Id of the next body added
+    CelestialBody* spare;           // Target of removals' compaction, then swapped with bodies
+    int spare_capacity;
+    RemovalWorkspace removal;
+    int remove_interval;            // Steps between removals (0 = never)
+    long removed[REMOVAL_REASONS];  // Bodies removed so far, by reason
+    FILE* removal_log;              // Removed bodies (may be NULL)
+    int selected;                   // Picked body (-1 = none; moved along by removals)
+    int traced;                     // Body whose forces are traced every step (-1 = none)
+    FILE* force_trace;              // That trace (opened on first use)
+    QuadTreeNode* tree;             // Tree of the last step (kept for rendering)
+    NodeArena nodes;                // Nodes of tree, reused every step
+    ForceWorkspace workspace;       // Direct-sum scratch arrays
+    bool tree_valid;                // tree was built by the last step (direct steps skip it)
+    ForceEngine engine;             // Picks direct summation or the tree per step
+    int massive_count;              // Leading bodies carrying nearly all the mass (the planets)
+    double light_mass_ratio;        // Mass of the other bodies over theirs
+    Ephemeris* ephemeris;           // Planet motion from a cache (NULL = integrated; not owned)
+    ParticleMesh* mesh;             // Long-range half of the treepm engine (NULL = pure tree)
+    ThreadPool* force_pool;         // Workers for the tree forces (NULL = this thread; not owned)
+    ApproachMonitor* approaches;    // Close passes by planets (NULL = not monitored)
+    ElementStats* elements;         // Belt element histograms (NULL = not taken)
+    int element_reference;          // Body whose period the others are compared with (Jupiter, -1 = none)
+    double theta;                   // Barnes-Hut opening angle
+    double dt;                      // Time step
+    bool adaptive_dt;               // dt is chosen by the controller
+    TimestepController timestep;
+    Telemetry* telemetry;           // Background accuracy monitor
+    TelemetryReport telemetry_report;
+    int telemetry_interval;         // Steps between accuracy snapshots
+    double step_energy;             // Energy at the start of the last tree step (potential from its walk)
+    double step_energy0;            // First step_energy, the reference for the drift
+    bool have_step_energy;
+    TrajectoryStore* trails;
+    FILE* log_file;                 // Body states every 100 steps (may be NULL)
+    FILE* dt_log_file;              // dt of every step taken with the controller on (may be NULL)
+    double current_time;
+    long step_count;
+    bool quiet;                     // No progress messages (ensemble members; their runner reports)
+} SimulationState;
 
-// Simulation region for the quad tree
-#define SIMULATION_REGION 50.0
+// View into the simulation: the world point drawn at the middle of the
+// output, the zoom, and optionally a body the view stays centered on
+typedef struct {
+    double center_x, center_y;  // World position at the screen center (AU)
+    double pixels_per_AU;       // Zoom
+    int follow;                 // Index of the followed body, -1 = free camera
+} Camera;
 
-// Number of planets and asteroids
-#define NUM_PLANETS 9
-#define NUM_ASTEROIDS 200
-#define MAX_BODIES (NUM_PLANETS + NUM_ASTEROIDS)
+// Screen-space copy of one planet's trail
+typedef struct {
+    SDL_FPoint* points;     // Projected vertices, plus one slot for the live end
+    int count;              // Projected vertices
+    int capacity;
+    long first_vertex;      // Track vertex held in points[0]
+} TrailBuffer;
 
-// Structure to represent a celestial body (from quadtree2.c)
+// Projected planet trails for one render target (window or recorder). New
+// vertices are projected as they arrive; everything is projected again
+// only when the zoom or the output size changes. A pan (or a followed body
+// moving) shifts the projected points by the same offset instead.
 typedef struct {
-    double x, y;        // Position coordinates
-    double vx, vy;      // Velocity components
-    double mass;        // Mass of the body
-    double radius;      // Radius of the body (for collision detection)
-    // Additional fields for our simulation
-    char name[20];      // Name of the body
-    Uint32 color;       // Color for rendering
-    double trajectory_x[MAX_TRAJECTORY_POINTS];
-    double trajectory_y[MAX_TRAJECTORY_POINTS];
-    int trajectory_count;
-} CelestialBody;
-
-// Quad-Tree node structure (from quadtree2.c)
-typedef struct QuadTreeNode {
-    double x, y, width, height;  // Boundaries of the node
-    CelestialBody* body;         // Pointer to a body (if leaf)
-    struct QuadTreeNode *nw, *ne, *sw, *se;  // Child nodes
-    double total_mass;           // Sum of masses in this region
-    double center_x, center_y;   // Center of mass of this node
-} QuadTreeNode;
+    const TrajectoryStore* store;
+    TrailBuffer buffers[NUM_PLANETS];
+    double pixels_per_AU;   // Zoom the buffers were built with
+    float origin_x, origin_y;  // Screen position of the world origin they were built with
+    int shifts;             // Pans applied since the buffers were last projected
+    int width, height;
+} TrailCache;
 
 // Function declarations
+int parse_arguments(int argc, char* argv[], RunOptions* options);
 void initialize_simulation(CelestialBody bodies[], int *body_count);
+static double next_uniform(Uint32* state);
+void initialize_system(CelestialBody bodies[], int *body_count, double inner_radius, double outer_radius,
+                       Uint32 seed);
+Ephemeris* load_ephemeris(const RunOptions* options, const CelestialBody bodies[], int massive_count);
+int run_ensemble(const RunOptions* options);
+int run_clones(const RunOptions* options);
 TTF_Font* load_font(const char* font_path, int font_size);
 void draw_circle_border(SDL_Renderer* renderer, int cx, int cy, int radius, 
                         Uint8 r, Uint8 g, Uint8 b, Uint8 a, int border_thickness);
 void render_bodies(SDL_Renderer* renderer, CelestialBody bodies[], int body_count, 
-                  double pixels_per_AU, TTF_Font* font, double dt);
+                  TrailCache* trails, const Camera* camera, TTF_Font* font,
+                  const HudInfo* hud, QuadTreeNode* tree, bool show_tree);
+void render_trails(SDL_Renderer* renderer, TrailCache* cache, const Camera* camera, int width, int height);
+void camera_zoom_at(Camera* camera, double factor, int screen_x, int screen_y, int width, int height,
+                    double min_zoom, double max_zoom);
+void camera_pan(Camera* camera, double dx_pixels, double dy_pixels);
+void camera_screen_to_world(const Camera* camera, double screen_x, double screen_y, int width, int height,
+                            double* world_x, double* world_y);
+int load_spawn_script(const char* path, SpawnEvent** spawns);
+void trail_cache_init(TrailCache* cache, const TrajectoryStore* store);
+void trail_cache_free(TrailCache* cache);
+void render_quadtree_overlay(SDL_Renderer* renderer, QuadTreeNode* root, const Camera* camera,
+                             int width, int height);
 void DrawButton(SDL_Renderer* renderer, int x, int y, int w, int h, 
                 TTF_Font* font, const char* text, SDL_Color text_color);
+void draw_text(SDL_Renderer* renderer, TTF_Font* font, const char* text, int x, int y, SDL_Color color);
+void render_dt_history(SDL_Renderer* renderer, const TimestepController* timestep, int x, int y, int w, int h);
+void render_element_histogram(SDL_Renderer* renderer, TTF_Font* font, const ElementHistogram* histogram,
+                              ElementQuantity quantity, int x, int y, int w, int h);
+void render_body_info(SDL_Renderer* renderer, TTF_Font* font, const BodyInfo* info, int x, int y);
 void log_simulation_data(FILE* log_file, CelestialBody bodies[], int body_count, double time);
-
-// Quad tree functions from quadtree2.c
-CelestialBody* create_body(double x, double y, double vx, double vy, double mass, double radius);
-QuadTreeNode* create_quadtree(double x, double y, double width, double height);
-bool is_in_bounds(QuadTreeNode* node, CelestialBody* body);
-void subdivide(QuadTreeNode* node);
-QuadTreeNode* get_quadrant(QuadTreeNode* node, CelestialBody* body);
-void insert_body(QuadTreeNode* node, CelestialBody* body);
-void calculate_center_of_mass(QuadTreeNode* node);
-void free_quadtree(QuadTreeNode* node);
-void calculate_force_from_quadtree(CelestialBody* body, QuadTreeNode* node, double theta, double* fx, double* fy);
-void update_body(CelestialBody* body, double fx, double fy, double dt);
-
-// Global data for celestial bodies
-CelestialBody bodies[MAX_BODIES];
-int body_count = 0;
+void build_simulation_tree(SimulationState* sim);
+QuadTreeNode* simulation_tree(SimulationState* sim);
+void simulation_reserve(SimulationState* sim, int count);
+void spawn_asteroid_cloud(SimulationState* sim, double x, double y, double radius, int count);
+void simulation_add_pending(SimulationState* sim);
+void simulation_remove_bodies(SimulationState* sim);
+int pick_body(SimulationState* sim, const Camera* camera, int screen_x, int screen_y, int width, int height);
+void collect_body_info(const SimulationState* sim, int index, BodyInfo* info);
+void simulation_trace_body(SimulationState* sim, int index, const char* path);
+double step_energy_drift(const SimulationState* sim);
+HudInfo make_hud(const SimulationState* sim, double fps, int substeps, bool paused, long skip_remaining);
+void step_simulation(SimulationState* sim);
+long fast_forward_simulation(SimulationState* sim, long steps, double time_budget);
 
 // Solar system data
 char* planet_names[] = {"Sun", "Mercury", "Venus", "Earth", "Mars", "Jupiter", "Saturn", "Uranus", "Neptune"};
 double semi_major_axes[] = {0.0, 0.387, 0.723, 1.0, 1.524, 5.203, 9.539, 19.191, 30.069};
 double planet_masses[] = {1.0, 1.659e-7, 2.447e-6, 3.003e-6, 3.227e-7, 9.545e-4, 2.856e-4, 4.365e-5, 5.127e-5};
 Uint32 planet_colors[] = {0xFFFF00, 0x808080, 0xFFA500, 0x0000FF, 0xFF0000, 0xA52A2A, 0xFFFF00, 0xADD8E6, 0xADD8E6};
+double planet_radii[] = {4.65e-3, 1.63e-5, 4.05e-5, 4.26e-5, 2.27e-5, 4.78e-4, 4.03e-4, 1.71e-4, 1.65e-4};  // AU
+
+int main(int argc, char* argv[]) {
+    // Command line options
+    RunOptions options;
+    if (parse_arguments(argc, argv, &options) != 0) {
+        return 1;
+    }
+    
+    // Ensembles run headless on worker threads and need no SDL setup
+    if (options.ensemble_path) {
+        return run_ensemble(&options) == 0 ? 0 : 1;
+    }
+    if (options.clone_count > 0) {
+        return run_clones(&options) == 0 ? 0 : 1;
+    }
+    if (options.treepm_report > 0) {
+        // TreePM pays off once the walk is accurate enough to be expensive,
+        // so the report runs at the default theta (0.5) and at half of it (0.25)
+        particle_mesh_report(options.treepm_report, THETA, options.mesh_size, PM_SPLIT_CELLS);
+        particle_mesh_report(options.treepm_report, 0.5 * THETA, options.mesh_size, PM_SPLIT_CELLS);
+        return 0;
+    }
 
-int main() {
     // Simulation parameters
-    double pixels_per_AU = 120.0;  // Scale factor for display
-    double zoom_step = 20.0;       // How much to zoom in/out
-    double min_zoom = 40.0;        // Minimum zoom level
-    double max_zoom = 400.0;       // Maximum zoom level
+    Camera camera = { 0.0, 0.0, 120.0, -1 };  // Centered on the Sun, 120 pixels per AU
+    double zoom_factor = 1.2;      // Zoom change per button click
+    double wheel_zoom_factor = 1.1;  // Zoom change per mouse wheel notch
+    double min_zoom = 10.0;        // Minimum zoom level (whole region visible)
+    double max_zoom = 20000.0;     // Maximum zoom level
+    double pan_step = 100.0;       // Arrow key pan in pixels
+    bool dragging = false;         // Right mouse button held (pans the view)
 
-    double dt = 0.01;              // Time step
+    double initial_dt = 0.01;      // Time step
     double dt_step = 0.005;        // How much to change time step
     double min_dt = 0.0001;        // Minimum time step
     double max_dt = 0.05;          // Maximum time step
+    
+    double theta_step = 0.05;
+    double min_theta = 0.1;
+    double max_theta = 1.5;
 
-    int frame_count = 0;
-    int trajectory_interval = 10;
-    double current_time = 0.0;
+    double trajectory_tolerance = 0.002;  // Largest trail error in AU
+    int trajectory_max_points = 4096;     // Trail vertices kept per body
+    bool show_tree = false;        // Quadtree cost overlay (toggled with T)
+    bool show_elements = false;    // Orbital-element histograms (toggled with H)
+    bool paused = options.paused;  // No physics steps are taken (Space)
+    bool single_step = false;      // Take one step while paused (period key)
+    Uint32 paused_refresh_ms = 250;  // Redraw interval while paused and idle
+    int substeps = options.substeps;   // Steps per frame (= and - keys)
+    int max_substeps = 65536;
+    long skip_remaining = options.skip_steps;  // Steps left in a fast-forward jump
+    long jump_steps = 100000;      // Steps added to the jump by the J key
+    double fast_forward_budget = 0.05;  // Seconds of fast-forward work per frame
     
-    // Initialize SDL and TTF
-    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+    // Initialize SDL and TTF (headless runs only need events for Ctrl-C)
+    if (SDL_Init(options.headless ? SDL_INIT_EVENTS : SDL_INIT_VIDEO) < 0) {
         fprintf(stderr, "SDL could not initialize! SDL_Error: %s\n", SDL_GetError());
         return 1;
     }
@@ -122,150 +339,1606 @@ int main() {
         return 1;
     }
     
-    // Create window
-    SDL_Window* window = SDL_CreateWindow("Solar System with Barnes-Hut",
-                                         SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-                                         WIDTH, HEIGHT, 0);
-    if (!window) {
-        fprintf(stderr, "Window creation failed: %s\n", SDL_GetError());
-        TTF_Quit();
-        SDL_Quit();
-        return 1;
-    }
-    
-    // Create renderer
-    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-    if (!renderer) {
-        fprintf(stderr, "Renderer creation failed: %s\n", SDL_GetError());
-        SDL_DestroyWindow(window);
-        TTF_Quit();
-        SDL_Quit();
-        return 1;
+    SDL_Window* window = NULL;
+    SDL_Renderer* renderer = NULL;
+    if (!options.headless) {
+        // Create window
+        window = SDL_CreateWindow("Solar System with Barnes-Hut",
+                                  SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+                                  WIDTH, HEIGHT, 0);
+        if (!window) {
+            fprintf(stderr, "Window creation failed: %s\n", SDL_GetError());
+            TTF_Quit();
+            SDL_Quit();
+            return 1;
+        }
+        
+        // Create renderer
+        Uint32 renderer_flags = SDL_RENDERER_ACCELERATED;
+        if (options.vsync) {
+            renderer_flags |= SDL_RENDERER_PRESENTVSYNC;
+        }
+        renderer = SDL_CreateRenderer(window, -1, renderer_flags);
+        if (!renderer) {
+            fprintf(stderr, "Renderer creation failed: %s\n", SDL_GetError());
+            SDL_DestroyWindow(window);
+            TTF_Quit();
+            SDL_Quit();
+            return 1;
+        }
     }
     
     // Load font for UI elements
     TTF_Font* font = load_font("./fonts/Arial.ttf", 30);
     if (!font) {
-        SDL_DestroyRenderer(renderer);
-        SDL_DestroyWindow(window);
+        if (renderer) SDL_DestroyRenderer(renderer);
+        if (window) SDL_DestroyWindow(window);
         TTF_Quit();
         SDL_Quit();
         return 1;
     }
     
-    // Initialize simulation bodies
-    initialize_simulation(bodies, &body_count);
+    // Offscreen frame recorder
+    FrameRecorder* recorder = NULL;
+    if (options.record_dir) {
+        recorder = recorder_create(options.record_dir, options.record_width, options.record_height,
+                                   options.record_format, options.record_workers);
+        if (!recorder) {
+            TTF_CloseFont(font);
+            if (renderer) SDL_DestroyRenderer(renderer);
+            if (window) SDL_DestroyWindow(window);
+            TTF_Quit();
+            SDL_Quit();
+            return 1;
+        }
+    }
+    
+    // Initialize simulation bodies (the array grows as clouds are spawned)
+    SimulationState sim;
+    memset(&sim, 0, sizeof(sim));
+    simulation_reserve(&sim, MAX_BODIES);
+    initialize_simulation(sim.bodies, &sim.body_count);
+    int initial_count = sim.body_count;
+    sim.asteroids_named = initial_count > NUM_PLANETS ? initial_count - NUM_PLANETS : 0;
+    sim.next_id = initial_count;
+    sim.selected = -1;
+    sim.traced = -1;
+    sim.theta = THETA;
+    sim.dt = initial_dt;
+    sim.adaptive_dt = options.adaptive_dt;
+    sim.telemetry_interval = 30;
+    sim.massive_count = initial_count < NUM_PLANETS ? initial_count : NUM_PLANETS;
+    sim.light_mass_ratio = light_mass_ratio(sim.bodies, sim.body_count, sim.massive_count);
+    
+    // Tree forces are split across one worker per CPU
+    ThreadPool* force_pool = NULL;
+    if (SDL_GetCPUCount() > 1) {
+        force_pool = thread_pool_create(SDL_GetCPUCount());
+        sim.force_pool = force_pool;
+    }
+    
+    // Time both force engines on this machine to find where the tree pays off
+    force_engine_calibrate(&sim.engine, options.engine, sim.theta, force_pool);
+    printf("Force engine: %s (direct below %d bodies; pair %.1f ns, tree %.1f + %.1f ns/level per body)\n",
+           force_engine_name(options.engine), sim.engine.crossover, sim.engine.pair_cost * 1e9,
+           sim.engine.build_cost * 1e9, sim.engine.walk_cost * 1e9);
+    if (options.engine == FORCE_ENGINE_TREEPM) {
+        // The mesh solves on the force pool's workers rather than a pool of its own
+        sim.mesh = particle_mesh_create(options.mesh_size, options.mesh_assignment, PM_SPLIT_CELLS, 1, force_pool);
+    }
+    
+    // Planet ephemeris (reused, or built once if missing or unsuitable)
+    Ephemeris* ephemeris = NULL;
+    if (options.ephemeris_path) {
+        ephemeris = load_ephemeris(&options, sim.bodies, sim.massive_count);
+        sim.ephemeris = ephemeris;
+    }
+    
+    // Trail history shared by all bodies
+    sim.trails = trajectory_store_create(sim.body_count, trajectory_tolerance, trajectory_max_points);
+    TrailCache window_trails, recorder_trails;
+    trail_cache_init(&window_trails, sim.trails);
+    trail_cache_init(&recorder_trails, sim.trails);
+    
+    // Energy / force-error monitor running on its own thread
+    sim.telemetry = telemetry_create(32);
+    
+    // Adaptive time step, kept within the manual dt range; the energy
+    // tolerance is a relative drift per unit of simulated time
+    timestep_init(&sim.timestep, min_dt, max_dt, 1e-5);
     
     // Open log file to track simulation data
-    FILE* log_file = fopen("simulation_log.csv", "w");
-    if (log_file) {
-        fprintf(log_file, "Time,Name,PosX,PosY,VelX,VelY,Mass\n");
+    sim.log_file = fopen("simulation_log.csv", "w");
+    if (sim.log_file) {
+        fprintf(sim.log_file, "Time,Name,PosX,PosY,VelX,VelY,Mass\n");
+    }
+    sim.dt_log_file = fopen("timestep_log.csv", "w");
+    if (sim.dt_log_file) {
+        fprintf(sim.dt_log_file, "Time,Dt,LimitingBody,Scale\n");
+    }
+    
+    // Close approaches to the planets, checked after every step
+    if (options.approach_path) {
+        sim.approaches = approach_monitor_create(options.approach_path, options.approach_distance);
+    }
+    
+    // Orbital-element histograms of the belt, for the window (H) and the
+    // optional CSV; periods are compared with Jupiter's
+    sim.element_reference = -1;
+    for (int i = 0; i < sim.massive_count; i++) {
+        if (strcmp(sim.bodies[i].name, "Jupiter") == 0) {
+            sim.element_reference = i;
+        }
+    }
+    if (options.elements_path || renderer) {
+        sim.elements = element_stats_create(options.elements_path, options.elements_interval);
+    }
+    
+    // Bodies that escape or hit the Sun or a planet leave the arrays
+    sim.remove_interval = options.remove_interval;
+    if (options.removals_path) {
+        sim.removal_log = fopen(options.removals_path, "w");
+        if (sim.removal_log) {
+            fprintf(sim.removal_log, "Time,Id,Name,Reason,Into,PosX,PosY,VelX,VelY,Mass\n");
+        } else {
+            fprintf(stderr, "Cannot write %s\n", options.removals_path);
+        }
+    }
+    
+    // Asteroid clouds added at given steps
+    SpawnEvent* spawns = NULL;
+    if (options.spawn_path) {
+        sim.spawn_count = load_spawn_script(options.spawn_path, &spawns);
+        if (sim.spawn_count < 0) {
+            sim.spawn_count = 0;
+        }
+        sim.spawns = spawns;
     }
     
-    // Main simulation loop
+    // A tree exists from the start so a paused first frame can be drawn
+    build_simulation_tree(&sim);
+    
+    // Main loop: each frame handles input, advances the physics by a fixed
+    // number of steps and renders once, so the simulation rate does not
+    // depend on how fast frames can be drawn
     int running = 1;
     SDL_Event event;
+    double fps = 0.0;
+    double counter_frequency = (double)SDL_GetPerformanceFrequency();
     
     while (running) {
+        Uint64 frame_start = SDL_GetPerformanceCounter();
+        
+        // While paused there is nothing to simulate, so sleep until input
+        // arrives (with a slow refresh so telemetry stays current)
+        if (paused && skip_remaining == 0) {
+            SDL_WaitEventTimeout(NULL, paused_refresh_ms);
+        }
+        
         // Process events
         while (SDL_PollEvent(&event)) {
             if (event.type == SDL_QUIT) {
                 running = 0;
+            } else if (event.type == SDL_KEYDOWN) {
+                if (event.key.keysym.sym == SDLK_t) {
+                    show_tree = !show_tree;
+                } else if (event.key.keysym.sym == SDLK_h) {
+                    show_elements = !show_elements;
+                } else if (event.key.keysym.sym == SDLK_RIGHTBRACKET) {
+                    sim.theta += theta_step;
+                    if (sim.theta > max_theta) sim.theta = max_theta;
+                } else if (event.key.keysym.sym == SDLK_LEFTBRACKET) {
+                    sim.theta -= theta_step;
+                    if (sim.theta < min_theta) sim.theta = min_theta;
+                } else if (event.key.keysym.sym == SDLK_g) {
+                    // Trace the forces on the picked body every step (again: stop)
+                    simulation_trace_body(&sim, sim.traced >= 0 ? -1 : sim.selected, options.force_trace_path);
+                } else if (event.key.keysym.sym == SDLK_SPACE) {
+                    paused = !paused;
+                } else if (event.key.keysym.sym == SDLK_PERIOD) {
+                    paused = true;
+                    single_step = true;
+                } else if (event.key.keysym.sym == SDLK_EQUALS || event.key.keysym.sym == SDLK_PLUS) {
+                    substeps *= 2;
+                    if (substeps > max_substeps) substeps = max_substeps;
+                } else if (event.key.keysym.sym == SDLK_MINUS) {
+                    substeps /= 2;
+                    if (substeps < 1) substeps = 1;
+                } else if (event.key.keysym.sym == SDLK_j) {
+                    skip_remaining += jump_steps;
+                } else if (event.key.keysym.sym == SDLK_ESCAPE) {
+                    skip_remaining = 0;  // Abort a jump
+                } else if (event.key.keysym.sym == SDLK_a) {
+                    sim.adaptive_dt = !sim.adaptive_dt;
+                } else if (event.key.keysym.sym == SDLK_f) {
+                    // Follow the next planet (Sun, Mercury, ..., Neptune, then free)
+                    camera.follow++;
+                    if (camera.follow >= NUM_PLANETS || camera.follow >= sim.body_count) {
+                        camera.follow = -1;
+                    }
+                } else if (event.key.keysym.sym == SDLK_c) {
+                    // Reset the view onto the Sun
+                    camera.center_x = 0.0;
+                    camera.center_y = 0.0;
+                    camera.follow = -1;
+                } else if (event.key.keysym.sym == SDLK_LEFT) {
+                    camera_pan(&camera, -pan_step, 0.0);
+                } else if (event.key.keysym.sym == SDLK_RIGHT) {
+                    camera_pan(&camera, pan_step, 0.0);
+                } else if (event.key.keysym.sym == SDLK_UP) {
+                    camera_pan(&camera, 0.0, -pan_step);
+                } else if (event.key.keysym.sym == SDLK_DOWN) {
+                    camera_pan(&camera, 0.0, pan_step);
+                }
+            } else if (event.type == SDL_MOUSEWHEEL) {
+                // Zoom about the point under the mouse
+                int mouse_x, mouse_y;
+                SDL_GetMouseState(&mouse_x, &mouse_y);
+                camera_zoom_at(&camera, pow(wheel_zoom_factor, event.wheel.y), mouse_x, mouse_y,
+                               WIDTH, HEIGHT, min_zoom, max_zoom);
+            } else if (event.type == SDL_MOUSEBUTTONUP) {
+                if (event.button.button == SDL_BUTTON_RIGHT) {
+                    dragging = false;
+                }
+            } else if (event.type == SDL_MOUSEMOTION) {
+                if (dragging) {
+                    camera_pan(&camera, -event.motion.xrel, -event.motion.yrel);
+                }
             } else if (event.type == SDL_MOUSEBUTTONDOWN) {
                 int x = event.button.x;
                 int y = event.button.y;
                 
+                if (event.button.button == SDL_BUTTON_RIGHT) {
+                    dragging = true;
+                    continue;
+                }
+                
+                // Shift-click drops a cloud of asteroids under the cursor
+                if (event.button.button == SDL_BUTTON_LEFT && (SDL_GetModState() & KMOD_SHIFT)) {
+                    double world_x, world_y;
+                    camera_screen_to_world(&camera, x, y, WIDTH, HEIGHT, &world_x, &world_y);
+                    spawn_asteroid_cloud(&sim, world_x, world_y, options.spawn_radius, options.spawn_count);
+                    continue;
+                }
+                
+                // Anywhere but the button column a click picks the body
+                // under the cursor, or clears the pick
+                if (event.button.button == SDL_BUTTON_LEFT && (x < WIDTH - 100 || x > WIDTH - 50)) {
+                    sim.selected = pick_body(&sim, &camera, x, y, WIDTH, HEIGHT);
+                    continue;
+                }
+                
                 // Zoom buttons (top-right corner) - exact coordinates from sdl_render.c
                 if (x >= WIDTH - 100 && x <= WIDTH - 50) {
                     if (y >= 20 && y <= 60) {  // Zoom In
-                        pixels_per_AU += zoom_step;
-                        if (pixels_per_AU > max_zoom) pixels_per_AU = max_zoom;
+                        camera_zoom_at(&camera, zoom_factor, WIDTH / 2, HEIGHT / 2,
+                                       WIDTH, HEIGHT, min_zoom, max_zoom);
                     } else if (y >= 80 && y <= 120) {  // Zoom Out
-                        pixels_per_AU -= zoom_step;
-                        if (pixels_per_AU < min_zoom) pixels_per_AU = min_zoom;
+                        camera_zoom_at(&camera, 1.0 / zoom_factor, WIDTH / 2, HEIGHT / 2,
+                                       WIDTH, HEIGHT, min_zoom, max_zoom);
                     }
                 }
                 
                 // Time step buttons - exact coordinates from sdl_render.c
+                // (setting dt by hand switches the controller off)
                 if (x >= WIDTH - 100 && x <= WIDTH - 50) {
                     if (y >= 200 && y <= 240) {  // Increase time step
-                        dt += dt_step;
-                        if (dt > max_dt) dt = max_dt;
+                        sim.adaptive_dt = false;
+                        sim.dt += dt_step;
+                        if (sim.dt > max_dt) sim.dt = max_dt;
                     } else if (y >= 260 && y <= 300) {  // Decrease time step
-                        dt -= dt_step;
-                        if (dt < min_dt) dt = min_dt;
+                        sim.adaptive_dt = false;
+                        sim.dt -= dt_step;
+                        if (sim.dt < min_dt) sim.dt = min_dt;
                     }
                 }
             }
         }
         
-        // Create a quadtree for the current frame
-        QuadTreeNode* root = create_quadtree(-SIMULATION_REGION, -SIMULATION_REGION, 
-                                           2 * SIMULATION_REGION, 2 * SIMULATION_REGION);
+        // Spawned clouds keep joining a batch per frame even while paused
+        simulation_add_pending(&sim);
         
-        // Insert all bodies into the quadtree
-        for (int i = 0; i < body_count; i++) {
-            insert_body(root, &bodies[i]);
+        // Advance the physics: a fast-forward jump runs in tight batches
+        // without trails, logs or rendering, limited per frame so the
+        // window stays responsive (headless runs take it in one go)
+        if (skip_remaining > 0) {
+            long batch = skip_remaining;
+            if (options.max_steps > 0 && batch > options.max_steps - sim.step_count) {
+                batch = options.max_steps - sim.step_count;
+            }
+            long done = fast_forward_simulation(&sim, batch, renderer ? fast_forward_budget : 0.0);
+            skip_remaining -= done;
+            if (options.max_steps > 0 && sim.step_count >= options.max_steps) {
+                running = 0;
+            }
         }
-        
-        // Calculate center of mass for the quadtree
-        calculate_center_of_mass(root);
-        
-        // Calculate forces and update all bodies
-        for (int i = 0; i < body_count; i++) {
-            double fx = 0.0, fy = 0.0;
-            calculate_force_from_quadtree(&bodies[i], root, THETA, &fx, &fy);
-            update_body(&bodies[i], fx, fy, dt);
+        int steps_this_frame = paused ? (single_step ? 1 : 0) : substeps;
+        if (skip_remaining > 0) {
+            steps_this_frame = 0;
         }
-        
-        // Update trajectories
-        if (frame_count % trajectory_interval == 0) {
-            for (int i = 0; i < body_count; i++) {
-                if (bodies[i].trajectory_count < MAX_TRAJECTORY_POINTS) {
-                    bodies[i].trajectory_x[bodies[i].trajectory_count] = bodies[i].x;
-                    bodies[i].trajectory_y[bodies[i].trajectory_count] = bodies[i].y;
-                    bodies[i].trajectory_count++;
-                } else {
-                    // Shift array to discard oldest point
-                    for (int j = 0; j < MAX_TRAJECTORY_POINTS - 1; j++) {
-                        bodies[i].trajectory_x[j] = bodies[i].trajectory_x[j + 1];
-                        bodies[i].trajectory_y[j] = bodies[i].trajectory_y[j + 1];
+        single_step = false;
+        for (int step = 0; step < steps_this_frame && running; step++) {
+            step_simulation(&sim);
+            
+            // Keep the followed body in the middle of the view
+            if (camera.follow >= 0) {
+                camera.center_x = sim.bodies[camera.follow].x;
+                camera.center_y = sim.bodies[camera.follow].y;
+            }
+            
+            // Render into an offscreen frame buffer; encoding happens on the
+            // recorder's worker threads, and the frame is dropped rather than
+            // waited for if every buffer is still being encoded
+            if (recorder && sim.step_count % options.record_every == 0) {
+                SDL_Renderer* frame_renderer = recorder_begin_frame(recorder);
+                if (frame_renderer) {
+                    HudInfo hud = make_hud(&sim, fps, substeps, paused, skip_remaining);
+                    if (show_elements && sim.elements) {
+                        hud.elements = &sim.elements->histograms;
+                    }
+                    BodyInfo selected_info;
+                    if (sim.selected >= 0) {
+                        collect_body_info(&sim, sim.selected, &selected_info);
+                        hud.selected = &selected_info;
                     }
-                    bodies[i].trajectory_x[MAX_TRAJECTORY_POINTS - 1] = bodies[i].x;
-                    bodies[i].trajectory_y[MAX_TRAJECTORY_POINTS - 1] = bodies[i].y;
+                    render_bodies(frame_renderer, sim.bodies, sim.body_count, &recorder_trails, &camera, font, &hud,
+                                  simulation_tree(&sim), show_tree);
+                    recorder_end_frame(recorder);
                 }
             }
-        }
-        
-        // Log data periodically
-        if (frame_count % 100 == 0 && log_file) {
-            log_simulation_data(log_file, bodies, body_count, current_time);
+            
+            if (options.max_steps > 0 && sim.step_count >= options.max_steps) {
+                running = 0;
+            }
         }
         
         // Render the scene
-        render_bodies(renderer, bodies, body_count, pixels_per_AU, font, dt);
-        
-        // Free the quadtree for this frame
-        free_quadtree(root);
-        
-        // Update simulation time and frame count
-        current_time += dt;
-        frame_count++;
+        if (renderer) {
+            if (camera.follow >= 0) {
+                camera.center_x = sim.bodies[camera.follow].x;
+                camera.center_y = sim.bodies[camera.follow].y;
+            }
+            telemetry_latest(sim.telemetry, &sim.telemetry_report);
+            HudInfo hud = make_hud(&sim, fps, substeps, paused, skip_remaining);
+            if (show_elements && sim.elements) {
+                hud.elements = &sim.elements->histograms;
+            }
+            BodyInfo selected_info;
+            if (sim.selected >= 0) {
+                collect_body_info(&sim, sim.selected, &selected_info);
+                hud.selected = &selected_info;
+            }
+            render_bodies(renderer, sim.bodies, sim.body_count, &window_trails, &camera, font, &hud,
+                          simulation_tree(&sim), show_tree);
+            
+            // Frame pacing: with vsync SDL_RenderPresent already waits for
+            // the display; otherwise sleep off the rest of the frame budget
+            if (!options.vsync && options.target_fps > 0 && !paused && skip_remaining == 0) {
+                double elapsed = (SDL_GetPerformanceCounter() - frame_start) / counter_frequency;
+                double remaining = 1.0 / options.target_fps - elapsed;
+                if (remaining > 0.001) {
+                    SDL_Delay((Uint32)(remaining * 1000.0));
+                }
+            }
+            
+            // Smoothed frame rate for the HUD
+            double frame_time = (SDL_GetPerformanceCounter() - frame_start) / counter_frequency;
+            if (frame_time > 0.0) {
+                fps = fps > 0.0 ? 0.9 * fps + 0.1 / frame_time : 1.0 / frame_time;
+            }
+        }
     }
     
     // Clean up
-    if (log_file) fclose(log_file);
+    if (recorder) {
+        // Flushes frames still being encoded
+        recorder_destroy(recorder);
+    }
+    telemetry_destroy(sim.telemetry);
+    ephemeris_close(ephemeris);
+    if (sim.approaches) {
+        double closest;
+        const char *planet, *body;
+        long passes = approach_monitor_events(sim.approaches, &closest, &planet, &body);
+        if (passes > 0) {
+            printf("Close approaches: %ld logged to %s, closest %s to %s at %.6f AU\n", passes,
+                   options.approach_path, body, planet, closest);
+        } else {
+            printf("Close approaches: none within %.4f AU\n", options.approach_distance);
+        }
+        approach_monitor_destroy(sim.approaches);
+    }
+    if (sim.elements && options.elements_path) {
+        const ElementHistograms* histograms = &sim.elements->histograms;
+        printf("Orbital elements: %ld snapshots logged to %s, last at t=%.2f (%d bodies, %d unbound)\n",
+               histograms->snapshots, options.elements_path, histograms->time, histograms->bodies,
+               histograms->unbound);
+    }
+    element_stats_destroy(sim.elements);
+    if (sim.next_id > initial_count) {
+        printf("Spawned: %d bodies added\n", sim.next_id - initial_count);
+    }
+    long removed = sim.removed[REMOVAL_ESCAPED] + sim.removed[REMOVAL_ABSORBED] + sim.removed[REMOVAL_COLLIDED];
+    if (removed > 0) {
+        printf("Removed: %ld bodies (%ld escaped, %ld fell into the Sun, %ld hit a planet), %d left\n", removed,
+               sim.removed[REMOVAL_ESCAPED], sim.removed[REMOVAL_ABSORBED], sim.removed[REMOVAL_COLLIDED],
+               sim.body_count);
+    }
+    if (sim.removal_log) fclose(sim.removal_log);
+    if (sim.force_trace) fclose(sim.force_trace);
+    removal_workspace_free(&sim.removal);
+    free(spawns);
+    free(sim.clouds);
+    free(sim.spare);
+    free(sim.bodies);
+    if (sim.have_step_energy) {
+        printf("Energy (tree steps): %.9e, drift %+.3e\n", sim.step_energy, step_energy_drift(&sim));
+    }
+    if (options.headless) {
+        printf("Trajectories: %ld vertices stored from %ld samples (%.1f KB in use)\n",
+               sim.trails->vertices, sim.trails->samples, trajectory_memory_used(sim.trails) / 1024.0);
+    }
+    trail_cache_free(&window_trails);
+    trail_cache_free(&recorder_trails);
+    trajectory_store_destroy(sim.trails);
+    particle_mesh_destroy(sim.mesh);
+    if (force_pool) thread_pool_destroy(force_pool);
+    node_arena_free(&sim.nodes);
+    force_workspace_free(&sim.workspace);
+    if (sim.log_file) fclose(sim.log_file);
+    if (sim.dt_log_file) fclose(sim.dt_log_file);
     TTF_CloseFont(font);
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
+    if (renderer) SDL_DestroyRenderer(renderer);
+    if (window) SDL_DestroyWindow(window);
     TTF_Quit();
     SDL_Quit();
     
     return 0;
 }
 
+// Relative change of the step energy since the first tree step
+double step_energy_drift(const SimulationState* sim) {
+    if (!sim->have_step_energy || sim->step_energy0 == 0.0) {
+        return 0.0;
+    }
+    return (sim->step_energy - sim->step_energy0) / fabs(sim->step_energy0);
+}
+
+// Adds the kinetic energy to the potential of this step's walk; the
+// velocities still belong to the positions the walk saw
+static void record_step_energy(SimulationState* sim, double potential) {
+    double kinetic = 0.0;
+    for (int i = 0; i < sim->body_count; i++) {
+        const CelestialBody* body = &sim->bodies[i];
+        kinetic += 0.5 * body->mass * (body->vx * body->vx + body->vy * body->vy);
+    }
+    sim->step_energy = kinetic + potential;
+    if (!sim->have_step_energy) {
+        sim->step_energy0 = sim->step_energy;
+        sim->have_step_energy = true;
+    }
+}
+
+// Collects the values shown in the HUD
+HudInfo make_hud(const SimulationState* sim, double fps, int substeps, bool paused, long skip_remaining) {
+    HudInfo hud = { sim->dt, sim->theta, sim->adaptive_dt, &sim->timestep,
+                    sim->telemetry_report.valid ? &sim->telemetry_report : NULL,
+                    fps, substeps, paused, skip_remaining, sim->engine.last,
+                    sim->have_step_energy, sim->step_energy, step_energy_drift(sim), NULL, NULL };
+    return hud;
+}
+
+// Replaces the simulation's tree with one built from the current positions
+void build_simulation_tree(SimulationState* sim) {
+    // Create a quadtree for the current step, reusing the last one's nodes
+    node_arena_reset(&sim->nodes);
+    sim->tree = create_quadtree_in(&sim->nodes, -SIMULATION_REGION, -SIMULATION_REGION,
+                                   2 * SIMULATION_REGION, 2 * SIMULATION_REGION);
+    
+    // Insert all bodies into the quadtree
+    for (int i = 0; i < sim->body_count; i++) {
+        insert_body(sim->tree, &sim->bodies[i]);
+    }
+    
+    // Calculate center of mass for the quadtree
+    calculate_center_of_mass(sim->tree);
+    sim->tree_valid = true;
+}
+
+// Returns a tree of the current positions for rendering, building one if
+// the last step did not need it
+QuadTreeNode* simulation_tree(SimulationState* sim) {
+    if (!sim->tree_valid) {
+        build_simulation_tree(sim);
+    }
+    return sim->tree;
+}
+
+// Makes room for count bodies. The array doubles, so bodies added a few at
+// a time are copied only a couple of times on average; moving it leaves
+// the tree pointing at the old array, so the tree is rebuilt before use.
+void simulation_reserve(SimulationState* sim, int count) {
+    if (count <= sim->body_capacity) {
+        return;
+    }
+    int capacity = sim->body_capacity > 0 ? sim->body_capacity : MAX_BODIES;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    CelestialBody* grown = (CelestialBody*)realloc(sim->bodies, capacity * sizeof(CelestialBody));
+    if (grown == NULL) {
+        fprintf(stderr, "Memory allocation failed for bodies\n");
+        exit(EXIT_FAILURE);
+    }
+    sim->bodies = grown;
+    sim->body_capacity = capacity;
+    sim->tree_valid = false;
+}
+
+// Queues count asteroids spread evenly over a disk of the given radius
+// around (x, y), each on a near-circular orbit about the Sun like the
+// belt's. Nothing is generated yet: the bodies join a batch at a time
+// from the next step on, so a huge cloud costs no single frame much.
+void spawn_asteroid_cloud(SimulationState* sim, double x, double y, double radius, int count) {
+    if (count <= 0) {
+        return;
+    }
+    if (sim->cloud_count == sim->cloud_capacity) {
+        sim->cloud_capacity = sim->cloud_capacity > 0 ? 2 * sim->cloud_capacity : 8;
+        sim->clouds = (PendingCloud*)realloc(sim->clouds, sim->cloud_capacity * sizeof(PendingCloud));
+        if (sim->clouds == NULL) {
+            fprintf(stderr, "Memory allocation failed for spawned clouds\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    PendingCloud* cloud = &sim->clouds[sim->cloud_count++];
+    cloud->x = x;
+    cloud->y = y;
+    cloud->radius = radius;
+    cloud->remaining = count;
+    
+    // Seeded by spawn order, so a script gives the same clouds every run
+    cloud->state = (Uint32)(sim->clouds_spawned++ + 1) * 2654435761u;
+    if (cloud->state == 0) {
+        cloud->state = 1;  // Xorshift never leaves zero
+    }
+}
+
+// Writes the next body of a cloud into body
+static void generate_cloud_body(SimulationState* sim, PendingCloud* cloud, CelestialBody* body) {
+    const CelestialBody* sun = &sim->bodies[0];
+    memset(body, 0, sizeof(*body));
+    snprintf(body->name, sizeof(body->name), "Ast%ld", sim->asteroids_named++);
+    body->id = sim->next_id++;
+    
+    double r = cloud->radius * sqrt(next_uniform(&cloud->state));
+    double angle = 2.0 * M_PI * next_uniform(&cloud->state);
+    body->x = cloud->x + r * cos(angle);
+    body->y = cloud->y + r * sin(angle);
+    body->mass = 1e-10 + 1e-9 * next_uniform(&cloud->state);
+    
+    // Circular speed about the Sun at this point, varied by 5% either way
+    double dx = body->x - sun->x;
+    double dy = body->y - sun->y;
+    double distance = sqrt(dx * dx + dy * dy);
+    if (distance < EPSILON) {
+        distance = EPSILON;
+    }
+    double speed = sqrt(G * sun->mass / distance) * (0.95 + 0.1 * next_uniform(&cloud->state));
+    body->vx = sun->vx - speed * dy / distance;
+    body->vy = sun->vy + speed * dx / distance;
+    
+    body->radius = 3.0;
+    int gray = 150 + (int)(80 * next_uniform(&cloud->state));
+    body->color = (gray << 16) | (gray << 8) | gray;
+}
+
+// Queues the clouds the spawn script has due by this step, then adds up
+// to SPAWN_BATCH queued bodies in one batch: generated straight into the
+// end of the (grown) body array, with new empty trails. The next tree
+// build takes them in with everyone else. The energy totals change, so
+// the drifts start from a new reference.
+void simulation_add_pending(SimulationState* sim) {
+    while (sim->next_spawn < sim->spawn_count && sim->spawns[sim->next_spawn].step <= sim->step_count) {
+        const SpawnEvent* spawn = &sim->spawns[sim->next_spawn++];
+        spawn_asteroid_cloud(sim, spawn->x, spawn->y, spawn->radius, spawn->count);
+    }
+    if (sim->cloud_count == 0) {
+        return;
+    }
+    
+    int batch = 0;
+    for (int c = 0; c < sim->cloud_count && batch < SPAWN_BATCH; c++) {
+        batch += sim->clouds[c].remaining < SPAWN_BATCH - batch ? sim->clouds[c].remaining : SPAWN_BATCH - batch;
+    }
+    int first = sim->body_count;
+    simulation_reserve(sim, first + batch);
+    double added_mass = 0.0;
+    int added = 0;
+    while (added < batch) {
+        PendingCloud* cloud = &sim->clouds[0];
+        CelestialBody* body = &sim->bodies[first + added++];
+        generate_cloud_body(sim, cloud, body);
+        added_mass += body->mass;
+        if (--cloud->remaining == 0) {
+            sim->cloud_count--;
+            memmove(sim->clouds, sim->clouds + 1, sim->cloud_count * sizeof(PendingCloud));
+        }
+    }
+    sim->body_count += added;
+    trajectory_store_add_tracks(sim->trails, added);
+    sim->tree_valid = false;
+    
+    // Only the light side of the mass ratio changes
+    double massive_mass = 0.0;
+    for (int i = 0; i < sim->massive_count; i++) {
+        massive_mass += sim->bodies[i].mass;
+    }
+    if (massive_mass > 0.0) {
+        sim->light_mass_ratio += added_mass / massive_mass;
+    }
+    
+    sim->have_step_energy = false;
+    if (sim->telemetry) {
+        telemetry_rebase(sim->telemetry);
+    }
+}
+
+// Every remove_interval steps, drops the light bodies that have left the
+// simulation region or come inside the Sun or a planet (tested at that
+// step's positions). Those that hit something merge into it, keeping
+// mass and momentum. The survivors are compacted into the spare array,
+// which then becomes the body array, and everything indexed by body
+// (trails, approach pairs) moves along; ids and names stay with the
+// bodies, so logs keep following the same ones.
+void simulation_remove_bodies(SimulationState* sim) {
+    if (sim->remove_interval <= 0 || sim->step_count % sim->remove_interval != 0) {
+        return;
+    }
+    if (sim->spare_capacity < sim->body_capacity) {
+        free(sim->spare);
+        sim->spare = (CelestialBody*)malloc(sim->body_capacity * sizeof(CelestialBody));
+        if (sim->spare == NULL) {
+            fprintf(stderr, "Memory allocation failed for bodies\n");
+            exit(EXIT_FAILURE);
+        }
+        sim->spare_capacity = sim->body_capacity;
+    }
+    RemovalRules rules = { SIMULATION_REGION, planet_radii,
+                           sim->massive_count < NUM_PLANETS ? sim->massive_count : NUM_PLANETS };
+    int old_count = sim->body_count;
+    int kept = remove_bodies(&sim->removal, &rules, sim->bodies, old_count, sim->spare, sim->force_pool);
+    if (kept == old_count) {
+        return;
+    }
+    
+    for (int r = 0; r < sim->removal.removal_count; r++) {
+        const Removal* removal = &sim->removal.removals[r];
+        const CelestialBody* body = &sim->bodies[removal->index];
+        if (removal->target >= 0) {
+            CelestialBody* target = &sim->spare[removal->target];
+            double mass = target->mass + body->mass;
+            target->vx = (target->mass * target->vx + body->mass * body->vx) / mass;
+            target->vy = (target->mass * target->vy + body->mass * body->vy) / mass;
+            target->mass = mass;
+        }
+        sim->removed[removal->reason]++;
+        if (sim->removal_log) {
+            fprintf(sim->removal_log, "%.6f,%d,%s,%s,%s,%.6f,%.6f,%.6f,%.6f,%.6e\n", sim->current_time, body->id,
+                    body->name, removal_reason_name(removal->reason),
+                    removal->target >= 0 ? sim->bodies[removal->target].name : "", body->x, body->y, body->vx,
+                    body->vy, body->mass);
+        }
+    }
+    
+    CelestialBody* bodies = sim->bodies;
+    int capacity = sim->body_capacity;
+    sim->bodies = sim->spare;
+    sim->body_capacity = sim->spare_capacity;
+    sim->spare = bodies;
+    sim->spare_capacity = capacity;
+    sim->body_count = kept;
+    trajectory_store_compact(sim->trails, sim->removal.new_index);
+    if (sim->approaches) {
+        approach_monitor_remap(sim->approaches, sim->removal.new_index, old_count);
+    }
+    if (sim->selected >= 0) {
+        sim->selected = sim->removal.new_index[sim->selected];
+    }
+    if (sim->traced >= 0) {
+        sim->traced = sim->removal.new_index[sim->traced];
+    }
+    sim->tree_valid = false;
+    sim->light_mass_ratio = light_mass_ratio(sim->bodies, sim->body_count, sim->massive_count);
+    
+    // The energy totals change, so the drifts start from a new reference
+    sim->have_step_energy = false;
+    if (sim->telemetry) {
+        telemetry_rebase(sim->telemetry);
+    }
+}
+
+// Body drawn under a screen point: the nearest one on the tree (a
+// nearest-neighbour query, so about log N work however many bodies there
+// are), if the point is within its drawn radius plus a few pixels; -1 if
+// no body is
+int pick_body(SimulationState* sim, const Camera* camera, int screen_x, int screen_y, int width, int height) {
+    double world_x, world_y;
+    camera_screen_to_world(camera, screen_x, screen_y, width, height, &world_x, &world_y);
+    CelestialBody* nearest;
+    double distance;
+    if (quadtree_nearest(simulation_tree(sim), world_x, world_y, NULL, &nearest, &distance, 1) == 0) {
+        return -1;
+    }
+    if (distance * camera->pixels_per_AU > nearest->radius + PICK_SLACK_PIXELS) {
+        return -1;
+    }
+    return (int)(nearest - sim->bodies);
+}
+
+// Gathers what the info overlay shows about body index: its state, its
+// elements about the Sun and the pull of each planet and of everything
+// else at its current position
+void collect_body_info(const SimulationState* sim, int index, BodyInfo* info) {
+    const CelestialBody* body = &sim->bodies[index];
+    const CelestialBody* sun = &sim->bodies[0];
+    memset(info, 0, sizeof(*info));
+    info->body = body;
+    double dx = body->x - sun->x;
+    double dy = body->y - sun->y;
+    info->distance = sqrt(dx * dx + dy * dy);
+    
+    info->orbits = index > 0;
+    if (info->orbits) {
+        double reference_period = 0.0;
+        int reference = sim->element_reference;
+        if (reference >= 0 && reference != index) {
+            reference_period = orbital_period(&sim->bodies[reference], sun);
+            info->reference = sim->bodies[reference].name;
+        }
+        orbital_elements_compute(body, 1, sun, reference_period, &info->a, &info->e, &info->period_ratio, NULL);
+        info->period = orbital_period(body, sun);
+    }
+    
+    info->massive = sim->bodies;
+    info->massive_count = sim->massive_count < NUM_PLANETS ? sim->massive_count : NUM_PLANETS;
+    info->light_count = sim->body_count - info->massive_count - (index >= info->massive_count ? 1 : 0);
+    force_breakdown(sim->bodies, sim->body_count, info->massive_count, index, info->massive_fx,
+                    info->massive_fy, &info->light_fx, &info->light_fy);
+    info->light_applied = sim->engine.last != FORCE_ENGINE_PARTICLES;
+    info->traced = sim->traced == index;
+}
+
+// Starts tracing the forces on body index every step (-1 stops), opening
+// the trace at path on first use; every line holds the body's state and
+// the pull of each planet and of all other bodies together, with
+// LightApplied 0 on steps whose engine left the latter out (particles):
+//     Time,Id,Name,PosX,PosY,VelX,VelY,SunFX,SunFY,...,LightFX,LightFY,LightApplied
+void simulation_trace_body(SimulationState* sim, int index, const char* path) {
+    if (index >= 0 && sim->force_trace == NULL) {
+        sim->force_trace = fopen(path, "w");
+        if (sim->force_trace == NULL) {
+            fprintf(stderr, "Cannot write %s\n", path);
+            return;
+        }
+        fprintf(sim->force_trace, "Time,Id,Name,PosX,PosY,VelX,VelY");
+        int massive_count = sim->massive_count < NUM_PLANETS ? sim->massive_count : NUM_PLANETS;
+        for (int m = 0; m < massive_count; m++) {
+            fprintf(sim->force_trace, ",%sFX,%sFY", sim->bodies[m].name, sim->bodies[m].name);
+        }
+        fprintf(sim->force_trace, ",LightFX,LightFY,LightApplied\n");
+    }
+    sim->traced = index;
+    if (index >= 0) {
+        printf("Tracing the forces on %s into %s\n", sim->bodies[index].name, path);
+    }
+}
+
+// Appends the traced body's state and force breakdown to the trace
+static void trace_forces(SimulationState* sim) {
+    if (sim->force_trace == NULL || sim->traced < 0) {
+        return;
+    }
+    int massive_count = sim->massive_count < NUM_PLANETS ? sim->massive_count : NUM_PLANETS;
+    double fx[NUM_PLANETS], fy[NUM_PLANETS], light_fx, light_fy;
+    force_breakdown(sim->bodies, sim->body_count, massive_count, sim->traced, fx, fy, &light_fx, &light_fy);
+    const CelestialBody* body = &sim->bodies[sim->traced];
+    fprintf(sim->force_trace, "%.6f,%d,%s,%.9f,%.9f,%.9f,%.9f", sim->current_time, body->id, body->name,
+            body->x, body->y, body->vx, body->vy);
+    for (int m = 0; m < massive_count; m++) {
+        fprintf(sim->force_trace, ",%.9e,%.9e", fx[m], fy[m]);
+    }
+    fprintf(sim->force_trace, ",%.9e,%.9e,%d\n", light_fx, light_fy,
+            sim->engine.last != FORCE_ENGINE_PARTICLES);
+}
+
+// Computes the forces, picks dt and moves the bodies: the part of a step
+// that both normal steps and fast-forward need
+static void advance_bodies(SimulationState* sim) {
+    CelestialBody* bodies = sim->bodies;
+    int body_count = sim->body_count;
+    
+    // Calculate all forces before moving any body, so every force
+    // comes from the same positions. Small systems are summed directly;
+    // the mixed engine walks the tree only for the light bodies. Test
+    // particles get their forces while they are moved, after dt is known,
+    // so only the massive bodies are summed here.
+    // With an ephemeris the planets are given, so the rest can only be
+    // test particles
+    if (sim->ephemeris && sim->current_time + sim->dt > ephemeris_end_time(sim->ephemeris)) {
+        if (!sim->quiet) {
+            printf("Ephemeris ends at t=%.2f, integrating the planets from here\n",
+                   ephemeris_end_time(sim->ephemeris));
+        }
+        sim->ephemeris = NULL;  // Closed by its owner
+    }
+    ForceEngineKind engine = FORCE_ENGINE_PARTICLES;
+    if (sim->ephemeris) {
+        sim->engine.last = engine;
+    } else {
+        engine = force_engine_choose(&sim->engine, body_count, sim->massive_count, sim->light_mass_ratio);
+    }
+    int forced_count = body_count;  // Bodies whose forces are known before dt is chosen
+    if (engine == FORCE_ENGINE_PARTICLES) {
+        forced_count = sim->massive_count;
+        compute_direct_forces(&sim->workspace, bodies, forced_count);
+        sim->tree_valid = false;
+    } else if (engine == FORCE_ENGINE_DIRECT) {
+        compute_direct_forces(&sim->workspace, bodies, body_count);
+        sim->tree_valid = false;
+    } else if (engine == FORCE_ENGINE_TREEPM && sim->mesh) {
+        // Nearby bodies from the tree, everything else from the mesh
+        build_simulation_tree(sim);
+        particle_mesh_solve(sim->mesh, bodies, body_count);
+        particle_mesh_short_range_forces(sim->mesh, sim->tree, sim->theta, bodies, body_count);
+        particle_mesh_add_forces(sim->mesh, bodies, body_count);
+    } else {
+        // The mixed engine then replaces the massive bodies' tree forces
+        // with exact sums. The walk measures the potential energy on the
+        // way, for the drift in the HUD.
+        int exact_count = engine == FORCE_ENGINE_MIXED ? sim->massive_count : 0;
+        double potential;
+        build_simulation_tree(sim);
+        compute_tree_forces(&sim->workspace, sim->tree, bodies, body_count, sim->theta, sim->force_pool,
+                            &potential);
+        compute_direct_forces_on(&sim->workspace, bodies, body_count, exact_count);
+        record_step_energy(sim, potential);
+    }
+    
+    // Choose the time step from the forces and the energy drift
+    if (sim->adaptive_dt) {
+        if (sim->telemetry) {
+            telemetry_latest(sim->telemetry, &sim->telemetry_report);
+            timestep_energy_feedback(&sim->timestep, &sim->telemetry_report);
+        }
+        sim->dt = timestep_choose(&sim->timestep, bodies, forced_count, sim->dt);
+    }
+    timestep_record(&sim->timestep, sim->dt);
+    
+    // Test particles are moved first, while the massive bodies are still
+    // where their pull was evaluated. Their forces come too late for this
+    // dt, so they limit the next one.
+    if (engine == FORCE_ENGINE_PARTICLES) {
+        int limiting;
+        double ratio_sq = advance_test_particles(bodies, body_count, sim->massive_count, sim->dt, &limiting);
+        if (sim->adaptive_dt) {
+            timestep_note_particles(&sim->timestep, ratio_sq, limiting);
+        }
+    }
+    
+    // Update all bodies (the massive ones only, if the rest were particles)
+    if (sim->ephemeris) {
+        double t = sim->current_time + sim->dt;
+        for (int i = 0; i < forced_count; i++) {
+            ephemeris_state(sim->ephemeris, i, t, &bodies[i].x, &bodies[i].y, &bodies[i].vx, &bodies[i].vy);
+        }
+        return;
+    }
+    for (int i = 0; i < forced_count; i++) {
+        update_body(&bodies[i], bodies[i].fx, bodies[i].fy, sim->dt);
+    }
+}
+
+// Advances the simulation by one time step
+void step_simulation(SimulationState* sim) {
+    simulation_remove_bodies(sim);
+    simulation_add_pending(sim);
+    CelestialBody* bodies = sim->bodies;
+    int body_count = sim->body_count;
+    
+    advance_bodies(sim);
+    if (sim->approaches) {
+        approach_monitor_step(sim->approaches, bodies, body_count, sim->massive_count,
+                              sim->tree_valid ? sim->tree : NULL,
+                              sim->current_time + sim->dt, sim->dt, sim->force_pool);
+    }
+    
+    // Update trajectories (only samples that change the path's shape are kept)
+    for (int i = 0; i < body_count; i++) {
+        trajectory_add_sample(sim->trails, i, bodies[i].x, bodies[i].y);
+    }
+    
+    // Log data periodically
+    if (sim->step_count % 100 == 0 && sim->log_file) {
+        log_simulation_data(sim->log_file, bodies, body_count, sim->current_time);
+    }
+    // A fixed dt has nothing to explain, so only the controller's steps are logged
+    if (sim->dt_log_file && sim->adaptive_dt) {
+        fprintf(sim->dt_log_file, "%.6f,%.6e,%d,%.4f\n", sim->current_time, sim->dt,
+                sim->timestep.limiting_body, sim->timestep.scale);
+    }
+    
+    // Hand a snapshot to the telemetry thread when it is idle
+    if (sim->step_count % sim->telemetry_interval == 0) {
+        telemetry_submit(sim->telemetry, bodies, body_count, sim->current_time + sim->dt, sim->theta);
+    }
+    
+    // Element histograms of the light bodies
+    if (sim->elements && sim->step_count % sim->elements->interval == 0) {
+        element_stats_update(sim->elements, bodies, body_count, sim->massive_count, sim->element_reference,
+                             sim->current_time + sim->dt, sim->force_pool);
+    }
+    
+    // Update simulation time and step count
+    sim->current_time += sim->dt;
+    sim->step_count++;
+    trace_forces(sim);
+}
+
+// Runs up to steps steps without trail samples, logging or telemetry,
+// stopping early once time_budget seconds have passed (0 = no limit).
+// Returns the number of steps taken.
+long fast_forward_simulation(SimulationState* sim, long steps, double time_budget) {
+    Uint64 start = SDL_GetPerformanceCounter();
+    Uint64 budget = (Uint64)(time_budget * SDL_GetPerformanceFrequency());
+    
+    long taken = 0;
+    while (taken < steps) {
+        // Check the clock only every few steps
+        if (budget > 0 && taken > 0 && taken % 64 == 0 &&
+            SDL_GetPerformanceCounter() - start > budget) {
+            break;
+        }
+        simulation_remove_bodies(sim);
+        simulation_add_pending(sim);
+        advance_bodies(sim);
+        if (sim->approaches) {
+            approach_monitor_step(sim->approaches, sim->bodies, sim->body_count, sim->massive_count,
+                                  sim->tree_valid ? sim->tree : NULL,
+                                  sim->current_time + sim->dt, sim->dt, sim->force_pool);
+        }
+        sim->current_time += sim->dt;
+        sim->step_count++;
+        taken++;
+    }
+    
+    // A trail would cut straight across the skipped stretch, so the
+    // trails start again from here
+    for (int i = 0; i < sim->body_count; i++) {
+        trajectory_clear(sim->trails, i);
+    }
+    telemetry_submit(sim->telemetry, sim->bodies, sim->body_count, sim->current_time, sim->theta);
+    if (sim->elements) {
+        element_stats_update(sim->elements, sim->bodies, sim->body_count, sim->massive_count,
+                             sim->element_reference, sim->current_time, sim->force_pool);
+    }
+    return taken;
+}
+
+// One simulation of an ensemble: its setup, the inputs shared by all
+// members (read only) and its results
+typedef struct {
+    // Setup
+    double inner_radius;        // Asteroid belt
+    double outer_radius;
+    double dt;
+    double theta;
+    Uint32 seed;
+    // Shared
+    long steps;
+    const ForceEngine* engine;  // Calibrated once for all members with this theta
+    int mesh_size;              // Particle mesh of the treepm engine
+    PmAssignment mesh_assignment;
+    Ephemeris* ephemeris;       // NULL = integrate the planets
+    // Results
+    ForceEngineKind engine_used;
+    double energy_drift;        // Relative change of the total energy
+    int escaped;                // Asteroids outside the simulation region
+    double mean_radius;         // Mean distance of the asteroids from the Sun
+    double seconds;             // Wall time of the member
+} EnsembleMember;
+
+// Reads ensemble members, one "inner,outer,dt,theta,seed" line each
+// (blank lines, # comments and a header line are skipped). Returns the
+// member count, or -1 if the file cannot be read.
+static int load_ensemble(const char* path, EnsembleMember** members) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Cannot open ensemble file %s\n", path);
+        return -1;
+    }
+    
+    int count = 0, capacity = 64;
+    *members = malloc(capacity * sizeof(EnsembleMember));
+    if (*members == NULL) {
+        fprintf(stderr, "Memory allocation failed for ensemble members\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    char line[256];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+        double inner, outer, dt, theta;
+        unsigned long seed;
+        if (sscanf(line, " %lf , %lf , %lf , %lf , %lu", &inner, &outer, &dt, &theta, &seed) != 5) {
+            const char* p = line + strspn(line, " \t\r\n");
+            if (*p != '\0' && *p != '#' && !(line_number == 1 && isalpha((unsigned char)*p))) {
+                fprintf(stderr, "%s:%d: expected inner,outer,dt,theta,seed\n", path, line_number);
+            }
+            continue;
+        }
+        if (inner <= 0.0 || outer < inner || dt <= 0.0 || theta <= 0.0) {
+            fprintf(stderr, "%s:%d: invalid member\n", path, line_number);
+            continue;
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            EnsembleMember* grown = realloc(*members, capacity * sizeof(EnsembleMember));
+            if (grown == NULL) {
+                fprintf(stderr, "Memory allocation failed for ensemble members\n");
+                exit(EXIT_FAILURE);
+            }
+            *members = grown;
+        }
+        EnsembleMember* member = &(*members)[count++];
+        memset(member, 0, sizeof(*member));
+        member->inner_radius = inner;
+        member->outer_radius = outer;
+        member->dt = dt;
+        member->theta = theta;
+        member->seed = (Uint32)seed;
+    }
+    fclose(file);
+    return count;
+}
+
+// Total kinetic plus potential energy, summed over all pairs
+static double system_energy(const CelestialBody bodies[], int body_count) {
+    double energy = 0.0;
+    for (int i = 0; i < body_count; i++) {
+        energy += 0.5 * bodies[i].mass * (bodies[i].vx * bodies[i].vx + bodies[i].vy * bodies[i].vy);
+        for (int j = i + 1; j < body_count; j++) {
+            double dx = bodies[j].x - bodies[i].x;
+            double dy = bodies[j].y - bodies[i].y;
+            double distance = sqrt(dx * dx + dy * dy);
+            if (distance < EPSILON) continue;
+            energy -= G * bodies[i].mass * bodies[j].mass / distance;
+        }
+    }
+    return energy;
+}
+
+// Thread pool task: runs one member from setup to results. Everything
+// the steps write (bodies, tree nodes, direct-sum arrays, dt controller)
+// belongs to the member, so members never wait on each other.
+static void run_ensemble_member(void* arg) {
+    EnsembleMember* member = arg;
+    Uint64 start = SDL_GetPerformanceCounter();
+    
+    CelestialBody* member_bodies = malloc(MAX_BODIES * sizeof(CelestialBody));
+    if (member_bodies == NULL) {
+        fprintf(stderr, "Memory allocation failed for ensemble bodies\n");
+        exit(EXIT_FAILURE);
+    }
+    int member_body_count = 0;
+    initialize_system(member_bodies, &member_body_count, member->inner_radius, member->outer_radius,
+                      member->seed);
+    
+    SimulationState sim;
+    memset(&sim, 0, sizeof(sim));
+    sim.bodies = member_bodies;
+    sim.body_count = member_body_count;
+    sim.engine = *member->engine;
+    sim.massive_count = member_body_count < NUM_PLANETS ? member_body_count : NUM_PLANETS;
+    sim.light_mass_ratio = light_mass_ratio(member_bodies, member_body_count, sim.massive_count);
+    sim.ephemeris = member->ephemeris;
+    sim.quiet = true;
+    sim.theta = member->theta;
+    sim.dt = member->dt;
+    timestep_init(&sim.timestep, member->dt, member->dt, 1e-5);
+    if (member->engine->mode == FORCE_ENGINE_TREEPM) {
+        // The members already keep every core busy
+        sim.mesh = particle_mesh_create(member->mesh_size, member->mesh_assignment, PM_SPLIT_CELLS, 1, NULL);
+    }
+    
+    double initial_energy = system_energy(member_bodies, member_body_count);
+    for (long step = 0; step < member->steps; step++) {
+        advance_bodies(&sim);
+        sim.current_time += sim.dt;
+        sim.step_count++;
+    }
+    double final_energy = system_energy(member_bodies, member_body_count);
+    
+    member->engine_used = sim.engine.last;
+    member->energy_drift = initial_energy != 0.0 ? (final_energy - initial_energy) / fabs(initial_energy) : 0.0;
+    double radius_sum = 0.0;
+    int asteroid_count = 0;
+    for (int i = sim.massive_count; i < member_body_count; i++) {
+        double dx = member_bodies[i].x - member_bodies[0].x;
+        double dy = member_bodies[i].y - member_bodies[0].y;
+        if (fabs(member_bodies[i].x) > SIMULATION_REGION || fabs(member_bodies[i].y) > SIMULATION_REGION) {
+            member->escaped++;
+        } else {
+            radius_sum += sqrt(dx * dx + dy * dy);
+            asteroid_count++;
+        }
+    }
+    member->mean_radius = asteroid_count > 0 ? radius_sum / asteroid_count : 0.0;
+    
+    particle_mesh_destroy(sim.mesh);
+    node_arena_free(&sim.nodes);
+    force_workspace_free(&sim.workspace);
+    free(member_bodies);
+    member->seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+}
+
+// Runs every member of the ensemble file headless on a thread pool and
+// writes one results line per member. The force engine is calibrated once
+// per distinct theta and the ephemeris loaded once for all of them.
+// Returns 0 on success.
+int run_ensemble(const RunOptions* options) {
+    EnsembleMember* members = NULL;
+    int member_count = load_ensemble(options->ensemble_path, &members);
+    if (member_count <= 0) {
+        if (member_count == 0) {
+            fprintf(stderr, "No members in %s\n", options->ensemble_path);
+        }
+        free(members);
+        return -1;
+    }
+    
+    // The tree's cost depends on theta, so members share a calibration
+    // only with the members using the same theta
+    ForceEngine* engines = malloc(member_count * sizeof(ForceEngine));
+    double* engine_thetas = malloc(member_count * sizeof(double));
+    if (engines == NULL || engine_thetas == NULL) {
+        fprintf(stderr, "Memory allocation failed for ensemble engines\n");
+        exit(EXIT_FAILURE);
+    }
+    int engine_count = 0;
+    for (int i = 0; i < member_count; i++) {
+        int e = 0;
+        while (e < engine_count && engine_thetas[e] != members[i].theta) {
+            e++;
+        }
+        if (e == engine_count) {
+            force_engine_calibrate(&engines[e], options->engine, members[i].theta, NULL);
+            engine_thetas[e] = members[i].theta;
+            engine_count++;
+        }
+        members[i].engine = &engines[e];
+    }
+    
+    // Every member has the same planets, so one ephemeris serves them all
+    Ephemeris* ephemeris = NULL;
+    if (options->ephemeris_path) {
+        CelestialBody* system = malloc(MAX_BODIES * sizeof(CelestialBody));
+        if (system == NULL) {
+            fprintf(stderr, "Memory allocation failed for ensemble bodies\n");
+            exit(EXIT_FAILURE);
+        }
+        int system_count = 0;
+        initialize_system(system, &system_count, members[0].inner_radius, members[0].outer_radius, 1);
+        ephemeris = load_ephemeris(options, system, system_count < NUM_PLANETS ? system_count : NUM_PLANETS);
+        free(system);
+    }
+    
+    // Members are quiet; say once if any of them outruns the ephemeris
+    if (ephemeris) {
+        for (int i = 0; i < member_count; i++) {
+            if (options->max_steps * members[i].dt > ephemeris_end_time(ephemeris)) {
+                printf("Ephemeris ends at t=%.2f, members running longer integrate the planets from there\n",
+                       ephemeris_end_time(ephemeris));
+                break;
+            }
+        }
+    }
+    
+    int workers = options->ensemble_workers > 0 ? options->ensemble_workers : SDL_GetCPUCount();
+    printf("Ensemble: %d members x %ld steps on %d threads (engine %s, calibrated for %d theta%s)\n",
+           member_count, options->max_steps, workers, force_engine_name(options->engine), engine_count,
+           engine_count == 1 ? "" : "s");
+    
+    Uint64 start = SDL_GetPerformanceCounter();
+    ThreadPool* pool = thread_pool_create(workers);
+    for (int i = 0; i < member_count; i++) {
+        members[i].steps = options->max_steps;
+        members[i].mesh_size = options->mesh_size;
+        members[i].mesh_assignment = options->mesh_assignment;
+        members[i].ephemeris = ephemeris;
+        thread_pool_submit(pool, run_ensemble_member, &members[i]);
+    }
+    thread_pool_destroy(pool);  // Waits for every member
+    double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    ephemeris_close(ephemeris);
+    free(engines);
+    free(engine_thetas);
+    
+    FILE* output = fopen(options->ensemble_output, "w");
+    if (output == NULL) {
+        fprintf(stderr, "Cannot write %s\n", options->ensemble_output);
+        free(members);
+        return -1;
+    }
+    fprintf(output, "Member,Inner,Outer,Dt,Theta,Seed,Steps,Engine,EnergyDrift,Escaped,MeanRadius,Seconds\n");
+    double min_drift = INFINITY, max_drift = -INFINITY, drift_sum = 0.0;
+    for (int i = 0; i < member_count; i++) {
+        const EnsembleMember* member = &members[i];
+        fprintf(output, "%d,%.6f,%.6f,%.6e,%.4f,%u,%ld,%s,%.6e,%d,%.6f,%.4f\n", i, member->inner_radius,
+                member->outer_radius, member->dt, member->theta, (unsigned)member->seed, member->steps,
+                force_engine_name(member->engine_used), member->energy_drift, member->escaped,
+                member->mean_radius, member->seconds);
+        if (member->energy_drift < min_drift) min_drift = member->energy_drift;
+        if (member->energy_drift > max_drift) max_drift = member->energy_drift;
+        drift_sum += member->energy_drift;
+    }
+    fclose(output);
+    
+    printf("Ensemble done in %.2f s (%.0f member-steps/s), results in %s\n", seconds,
+           member_count * (double)options->max_steps / seconds, options->ensemble_output);
+    printf("Energy drift: min %.3e, mean %.3e, max %.3e\n", min_drift, drift_sum / member_count, max_drift);
+    free(members);
+    return 0;
+}
+
+// Planets kept in every clone system: the Sun, Jupiter and Saturn
+static const int clone_planets[] = {0, 5, 6};
+#define CLONE_PLANET_COUNT 3
+
+// Runs --clones systems of the Sun, Jupiter, Saturn and one asteroid on a
+// circular orbit of --clone-radius, its speed scaled from 0.95 to 1.05
+// across the clones, all in one SIMD batch for --steps fixed steps of
+// --clone-dt. Writes the final state of every clone. Returns 0 on success.
+int run_clones(const RunOptions* options) {
+    int clone_count = options->clone_count;
+    int system_body_count = CLONE_PLANET_COUNT + 1;
+    SystemBatch* batch = system_batch_create(system_body_count, clone_count);
+    
+    for (int c = 0; c < clone_count; c++) {
+        CelestialBody body;
+        memset(&body, 0, sizeof(body));
+        for (int p = 0; p < CLONE_PLANET_COUNT; p++) {
+            int planet = clone_planets[p];
+            body.mass = planet_masses[planet];
+            body.x = semi_major_axes[planet];
+            body.y = 0.0;
+            body.vx = 0.0;
+            body.vy = planet == 0 ? 0.0 : sqrt(G * planet_masses[0] / semi_major_axes[planet]);
+            system_batch_set_body(batch, c, p, &body);
+        }
+        
+        // The clone starts opposite the planets so the first steps are quiet
+        double scale = clone_count > 1 ? 0.95 + 0.1 * c / (clone_count - 1) : 1.0;
+        body.mass = 1e-10;
+        body.x = -options->clone_radius;
+        body.y = 0.0;
+        body.vx = 0.0;
+        body.vy = -scale * sqrt(G * planet_masses[0] / options->clone_radius);
+        system_batch_set_body(batch, c, CLONE_PLANET_COUNT, &body);
+    }
+    
+    printf("Clones: %d systems of %d bodies x %ld steps (dt %.4g, %d per vector group)\n", clone_count,
+           system_body_count, options->max_steps, options->clone_dt, BATCH_LANES);
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (long step = 0; step < options->max_steps; step++) {
+        system_batch_step(batch, options->clone_dt);
+    }
+    double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    
+    FILE* output = fopen(options->clones_output, "w");
+    if (output == NULL) {
+        fprintf(stderr, "Cannot write %s\n", options->clones_output);
+        system_batch_free(batch);
+        return -1;
+    }
+    fprintf(output, "Clone,SpeedScale,PosX,PosY,VelX,VelY,Distance,Bound\n");
+    int bound_count = 0;
+    for (int c = 0; c < clone_count; c++) {
+        CelestialBody sun, clone;
+        system_batch_get_body(batch, c, 0, &sun);
+        system_batch_get_body(batch, c, CLONE_PLANET_COUNT, &clone);
+        double dx = clone.x - sun.x, dy = clone.y - sun.y;
+        double dvx = clone.vx - sun.vx, dvy = clone.vy - sun.vy;
+        double distance = sqrt(dx * dx + dy * dy);
+        // Negative orbital energy about the Sun
+        bool bound = 0.5 * (dvx * dvx + dvy * dvy) < G * sun.mass / distance;
+        bound_count += bound ? 1 : 0;
+        fprintf(output, "%d,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%d\n", c,
+                clone_count > 1 ? 0.95 + 0.1 * c / (clone_count - 1) : 1.0,
+                clone.x, clone.y, clone.vx, clone.vy, distance, bound ? 1 : 0);
+    }
+    fclose(output);
+    system_batch_free(batch);
+    
+    printf("Clones done in %.2f s (%.0f system-steps/s), %d of %d still bound, results in %s\n", seconds,
+           clone_count * (double)options->max_steps / seconds, bound_count, clone_count,
+           options->clones_output);
+    return 0;
+}
+
+// Prints command line usage
+static void print_usage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --headless               Run without a window (use with --record/--steps)\n"
+            "  --steps N                Stop after N simulation steps\n"
+            "  --record DIR             Record offscreen frames into existing directory DIR\n"
+            "  --record-format png|yuv  Frame encoding (default png)\n"
+            "  --record-size WxH        Recorded frame size (default %dx%d)\n"
+            "  --record-every N         Record every Nth step (default 1)\n"
+            "  --record-workers N       Encoder threads (default 4)\n"
+            "  --adaptive-dt            Start with the adaptive time step on (A key)\n"
+            "  --substeps N             Physics steps per rendered frame (default 1)\n"
+            "  --fps N                  Frame rate cap, 0 = uncapped (default 60)\n"
+            "  --vsync                  Pace frames by the display instead of --fps\n"
+            "  --paused                 Start paused (Space resumes, . steps once)\n"
+            "  --skip N                 Fast-forward N steps first (no trails/logs/frames)\n"
+            "  --engine NAME            Force engine: auto (default), direct, tree, mixed, particles,\n"
+            "                           treepm\n"
+            "  --mesh-size N            Particle-mesh nodes per side for treepm (default 256)\n"
+            "  --mesh-assign cic|tsc    Particle-mesh mass assignment (default tsc)\n"
+            "  --treepm-report N        Compare the tree and TreePM on N bodies and exit\n"
+            "  --ephemeris FILE         Planets follow the ephemeris in FILE (built if missing)\n"
+            "  --ephemeris-span T       Time a newly built ephemeris covers (default 1000)\n"
+            "  --ensemble FILE          Run every member in FILE (inner,outer,dt,theta,seed per\n"
+            "                           line) for --steps steps on a thread pool, no window\n"
+            "  --ensemble-out FILE      Ensemble results (default ensemble_results.csv)\n"
+            "  --ensemble-workers N     Ensemble threads (default one per CPU)\n"
+            "  --clones N               Run N Sun-Jupiter-Saturn-asteroid systems in one SIMD\n"
+            "                           batch for --steps steps, no window\n"
+            "  --clone-radius R         Starting orbit of the asteroid clones (default 2.5)\n"
+            "  --clone-dt DT            Time step of the clone systems (default 0.001)\n"
+            "  --clones-out FILE        Final clone states (default clones.csv)\n"
+            "  --approaches FILE        Log passes of asteroids near the planets to FILE (CSV)\n"
+            "  --approach-distance D    Closest distance logged, in AU (default 0.05)\n"
+            "  --elements FILE          Log histograms of the asteroids' a, e and period\n"
+            "                           ratio with Jupiter to FILE (CSV; H shows them)\n"
+            "  --elements-every K       Steps between element snapshots (default 100)\n"
+            "  --spawn FILE             Add asteroid clouds during the run, one\n"
+            "                           step,x,y,radius,count line each\n"
+            "  --spawn-count N          Asteroids per shift-clicked cloud (default 1000)\n"
+            "  --spawn-radius R         Radius of a shift-clicked cloud in AU (default 0.1)\n"
+            "  --remove-every K         Steps between removals of asteroids that escaped or hit\n"
+            "                           the Sun or a planet, 0 = keep them (default 16)\n"
+            "  --removals FILE          Log the removed asteroids to FILE (CSV)\n"
+            "  --force-trace FILE       Where G traces the forces on the picked body\n"
+            "                           (default force_trace.csv)\n",
+            program, WIDTH, HEIGHT);
+}
+
+// Parses command line options; returns 0 on success
+int parse_arguments(int argc, char* argv[], RunOptions* options) {
+    options->headless = false;
+    options->record_dir = NULL;
+    options->record_format = RECORD_FORMAT_PNG;
+    options->record_width = WIDTH;
+    options->record_height = HEIGHT;
+    options->record_every = 1;
+    options->record_workers = 4;
+    options->max_steps = 0;
+    options->adaptive_dt = false;
+    options->substeps = 1;
+    options->target_fps = 60;
+    options->vsync = false;
+    options->paused = false;
+    options->skip_steps = 0;
+    options->engine = FORCE_ENGINE_AUTO;
+    options->ephemeris_path = NULL;
+    options->ephemeris_span = 1000.0;
+    options->ensemble_path = NULL;
+    options->ensemble_output = "ensemble_results.csv";
+    options->ensemble_workers = 0;
+    options->clone_count = 0;
+    options->clone_radius = 2.5;
+    options->clone_dt = 0.001;
+    options->clones_output = "clones.csv";
+    options->mesh_size = 256;
+    options->mesh_assignment = PM_ASSIGN_TSC;
+    options->treepm_report = 0;
+    options->approach_path = NULL;
+    options->approach_distance = 0.05;
+    options->elements_path = NULL;
+    options->elements_interval = 100;
+    options->spawn_path = NULL;
+    options->spawn_count = 1000;
+    options->spawn_radius = 0.1;
+    options->remove_interval = 16;
+    options->removals_path = NULL;
+    options->force_trace_path = "force_trace.csv";
+    
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        
+        if (strcmp(arg, "--headless") == 0) {
+            options->headless = true;
+            continue;
+        }
+        if (strcmp(arg, "--adaptive-dt") == 0) {
+            options->adaptive_dt = true;
+            continue;
+        }
+        if (strcmp(arg, "--vsync") == 0) {
+            options->vsync = true;
+            continue;
+        }
+        if (strcmp(arg, "--paused") == 0) {
+            options->paused = true;
+            continue;
+        }
+        
+        // Every other option takes a value
+        if (value == NULL) {
+            print_usage(argv[0]);
+            return -1;
+        }
+        i++;
+        
+        if (strcmp(arg, "--steps") == 0) {
+            options->max_steps = atol(value);
+        } else if (strcmp(arg, "--record") == 0) {
+            options->record_dir = value;
+        } else if (strcmp(arg, "--record-format") == 0) {
+            if (recorder_parse_format(value, &options->record_format) != 0) {
+                fprintf(stderr, "Unknown record format: %s\n", value);
+                return -1;
+            }
+        } else if (strcmp(arg, "--record-size") == 0) {
+            if (sscanf(value, "%dx%d", &options->record_width, &options->record_height) != 2) {
+                fprintf(stderr, "Invalid record size: %s\n", value);
+                return -1;
+            }
+        } else if (strcmp(arg, "--record-every") == 0) {
+            options->record_every = atoi(value);
+        } else if (strcmp(arg, "--record-workers") == 0) {
+            options->record_workers = atoi(value);
+        } else if (strcmp(arg, "--substeps") == 0) {
+            options->substeps = atoi(value);
+        } else if (strcmp(arg, "--fps") == 0) {
+            options->target_fps = atoi(value);
+        } else if (strcmp(arg, "--skip") == 0) {
+            options->skip_steps = atol(value);
+        } else if (strcmp(arg, "--ephemeris") == 0) {
+            options->ephemeris_path = value;
+        } else if (strcmp(arg, "--ephemeris-span") == 0) {
+            options->ephemeris_span = atof(value);
+        } else if (strcmp(arg, "--ensemble") == 0) {
+            options->ensemble_path = value;
+        } else if (strcmp(arg, "--ensemble-out") == 0) {
+            options->ensemble_output = value;
+        } else if (strcmp(arg, "--ensemble-workers") == 0) {
+            options->ensemble_workers = atoi(value);
+        } else if (strcmp(arg, "--clones") == 0) {
+            options->clone_count = atoi(value);
+        } else if (strcmp(arg, "--clone-radius") == 0) {
+            options->clone_radius = atof(value);
+        } else if (strcmp(arg, "--clone-dt") == 0) {
+            options->clone_dt = atof(value);
+        } else if (strcmp(arg, "--clones-out") == 0) {
+            options->clones_output = value;
+        } else if (strcmp(arg, "--mesh-size") == 0) {
+            options->mesh_size = atoi(value);
+        } else if (strcmp(arg, "--mesh-assign") == 0) {
+            if (particle_mesh_parse_assignment(value, &options->mesh_assignment) != 0) {
+                fprintf(stderr, "Unknown mass assignment: %s\n", value);
+                return -1;
+            }
+        } else if (strcmp(arg, "--treepm-report") == 0) {
+            options->treepm_report = atoi(value);
+        } else if (strcmp(arg, "--approaches") == 0) {
+            options->approach_path = value;
+        } else if (strcmp(arg, "--approach-distance") == 0) {
+            options->approach_distance = atof(value);
+        } else if (strcmp(arg, "--elements") == 0) {
+            options->elements_path = value;
+        } else if (strcmp(arg, "--elements-every") == 0) {
+            options->elements_interval = atoi(value);
+        } else if (strcmp(arg, "--spawn") == 0) {
+            options->spawn_path = value;
+        } else if (strcmp(arg, "--spawn-count") == 0) {
+            options->spawn_count = atoi(value);
+        } else if (strcmp(arg, "--spawn-radius") == 0) {
+            options->spawn_radius = atof(value);
+        } else if (strcmp(arg, "--remove-every") == 0) {
+            options->remove_interval = atoi(value);
+        } else if (strcmp(arg, "--removals") == 0) {
+            options->removals_path = value;
+        } else if (strcmp(arg, "--force-trace") == 0) {
+            options->force_trace_path = value;
+        } else if (strcmp(arg, "--engine") == 0) {
+            if (force_engine_parse(value, &options->engine) != 0) {
+                fprintf(stderr, "Unknown force engine: %s\n", value);
+                return -1;
+            }
+        } else {
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+    
+    if (options->record_every < 1) {
+        options->record_every = 1;
+    }
+    if (options->substeps < 1) {
+        options->substeps = 1;
+    }
+    if (options->target_fps < 0) {
+        options->target_fps = 0;
+    }
+    if (options->skip_steps < 0) {
+        options->skip_steps = 0;
+    }
+    if (options->ephemeris_span <= 0.0) {
+        options->ephemeris_span = 1000.0;
+    }
+    if (options->clone_count > 0 && (options->max_steps <= 0 || options->clone_radius <= 0.0 ||
+                                     options->clone_dt <= 0.0)) {
+        fprintf(stderr, "--clones needs --steps and a positive --clone-radius and --clone-dt\n");
+        return -1;
+    }
+    if (options->approach_distance <= 0.0) {
+        fprintf(stderr, "--approach-distance must be positive\n");
+        return -1;
+    }
+    if (options->elements_interval <= 0) {
+        fprintf(stderr, "--elements-every must be positive\n");
+        return -1;
+    }
+    if (options->spawn_count <= 0 || options->spawn_radius < 0.0) {
+        fprintf(stderr, "--spawn-count must be positive and --spawn-radius not negative\n");
+        return -1;
+    }
+    if (options->remove_interval < 0) {
+        fprintf(stderr, "--remove-every must not be negative\n");
+        return -1;
+    }
+    if (options->ensemble_path && options->max_steps <= 0) {
+        fprintf(stderr, "--ensemble needs --steps\n");
+        return -1;
+    }
+    if (options->headless && options->paused) {
+        fprintf(stderr, "--paused needs a window\n");
+        return -1;
+    }
+    if (options->headless && options->record_dir == NULL && options->max_steps == 0) {
+        fprintf(stderr, "--headless needs --record or --steps\n");
+        return -1;
+    }
+    return 0;
+}
+
 // Initialize planets and asteroids
 void initialize_simulation(CelestialBody bodies[], int *body_count) {
+    // Asteroid belt between Mars and Jupiter
+    initialize_system(bodies, body_count, 2.2, 3.2, (Uint32)time(NULL));
+}
+
+// Uniform random number in [0, 1) from a private xorshift32 state, so
+// systems can be set up on several threads at once
+static double next_uniform(Uint32* state) {
+    Uint32 x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x / 4294967296.0;
+}
+
+// Sets up the planets and an asteroid belt between inner_radius and
+// outer_radius; the same seed gives the same belt
+void initialize_system(CelestialBody bodies[], int *body_count, double inner_radius, double outer_radius,
+                       Uint32 seed) {
     // Initialize planets
     for (int i = 0; i < NUM_PLANETS; i++) {
         strcpy(bodies[i].name, planet_names[i]);
@@ -277,58 +1950,137 @@ void initialize_simulation(CelestialBody bodies[], int *body_count) {
         bodies[i].vy = (i == 0) ? 0.0 : sqrt(G * bodies[0].mass / semi_major_axes[i]);
         bodies[i].radius = (i == 0) ? 25.0 : 15.0;  // Sun is larger
         bodies[i].color = planet_colors[i];
-        bodies[i].trajectory_count = 0;
+        bodies[i].id = i;
         (*body_count)++;
     }
-    
+
     // Initialize asteroids
-    srand(time(NULL));  // Seed random number generator
-    
-    // Use asteroid belt region between Mars and Jupiter
-    double inner_radius = 2.2;  // Just outside Mars
-    double outer_radius = 3.2;  // Before Jupiter
-    
+    Uint32 state = seed != 0 ? seed : 1;  // Xorshift never leaves zero
+
     for (int i = 0; i < NUM_ASTEROIDS && *body_count < MAX_BODIES; i++) {
         int idx = *body_count;
-        
+
         // Generate name
         sprintf(bodies[idx].name, "Ast%d", i);
-        
+
         // Random radius within asteroid belt
-        double radius = inner_radius + (outer_radius - inner_radius) * ((double)rand() / RAND_MAX);
-        
+        double radius = inner_radius + (outer_radius - inner_radius) * next_uniform(&state);
+
         // Random angle
-        double angle = 2.0 * M_PI * ((double)rand() / RAND_MAX);
-        
+        double angle = 2.0 * M_PI * next_uniform(&state);
+
         // Position in circular coordinates
         bodies[idx].x = radius * cos(angle);
         bodies[idx].y = radius * sin(angle);
-        
+
         // Small random mass (much smaller than planets)
-        bodies[idx].mass = 1e-10 + 1e-9 * ((double)rand() / RAND_MAX);
-        
+        bodies[idx].mass = 1e-10 + 1e-9 * next_uniform(&state);
+
         // Orbital velocity for circular orbit around the Sun (with small random variation)
         double v_orbital = sqrt(G * bodies[0].mass / radius);
-        double variation = 0.95 + 0.1 * ((double)rand() / RAND_MAX);  // 0.95 to 1.05
-        
+        double variation = 0.95 + 0.1 * next_uniform(&state);  // 0.95 to 1.05
+
         // Velocity perpendicular to radius
         bodies[idx].vx = -v_orbital * variation * sin(angle);
         bodies[idx].vy = v_orbital * variation * cos(angle);
-        
+
         // Small radius for rendering
         bodies[idx].radius = 3.0;
-        
+
         // Gray color for asteroids with slight variation
-        int gray = 150 + (rand() % 80);
+        int gray = 150 + (int)(80 * next_uniform(&state));
         bodies[idx].color = (gray << 16) | (gray << 8) | gray;
-        
-        // Empty trajectory
-        bodies[idx].trajectory_count = 0;
-        
+        bodies[idx].id = idx;
+
         (*body_count)++;
     }
 }
 
+// Opens the planet ephemeris named in the options if it fits these planets
+// and the requested span, otherwise integrates the planets once and
+// writes it. Returns NULL (planets are integrated) if neither works.
+Ephemeris* load_ephemeris(const RunOptions* options, const CelestialBody bodies[], int massive_count) {
+    Ephemeris* ephemeris = ephemeris_open(options->ephemeris_path);
+    if (ephemeris && (!ephemeris_matches(ephemeris, bodies, massive_count) ||
+                      ephemeris_end_time(ephemeris) < options->ephemeris_span)) {
+        ephemeris_close(ephemeris);
+        ephemeris = NULL;
+    }
+    if (ephemeris == NULL) {
+        printf("Building ephemeris %s for t=0..%.0f\n", options->ephemeris_path, options->ephemeris_span);
+        if (ephemeris_build(options->ephemeris_path, bodies, massive_count, 0.0, options->ephemeris_span,
+                            EPHEMERIS_SEGMENT_LENGTH, EPHEMERIS_DEGREE) == 0) {
+            ephemeris = ephemeris_open(options->ephemeris_path);
+        }
+    }
+    if (ephemeris == NULL) {
+        fprintf(stderr, "No ephemeris, integrating the planets\n");
+    }
+    return ephemeris;
+}
+
+// Reads a spawn script, one "step,x,y,radius,count" cloud per line (blank
+// lines, # comments and a header line are skipped), kept in step order.
+// Returns the cloud count, or -1 if the file cannot be read.
+int load_spawn_script(const char* path, SpawnEvent** spawns) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Cannot open spawn script %s\n", path);
+        return -1;
+    }
+    
+    int count = 0, capacity = 16;
+    *spawns = malloc(capacity * sizeof(SpawnEvent));
+    if (*spawns == NULL) {
+        fprintf(stderr, "Memory allocation failed for spawn script\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    char line[256];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+        long step;
+        double x, y, radius;
+        int bodies_in_cloud;
+        if (sscanf(line, " %ld , %lf , %lf , %lf , %d", &step, &x, &y, &radius, &bodies_in_cloud) != 5) {
+            const char* p = line + strspn(line, " \t\r\n");
+            if (*p != '\0' && *p != '#' && !(line_number == 1 && isalpha((unsigned char)*p))) {
+                fprintf(stderr, "%s:%d: expected step,x,y,radius,count\n", path, line_number);
+            }
+            continue;
+        }
+        if (step < 0 || radius < 0.0 || bodies_in_cloud <= 0) {
+            fprintf(stderr, "%s:%d: invalid cloud\n", path, line_number);
+            continue;
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            SpawnEvent* grown = realloc(*spawns, capacity * sizeof(SpawnEvent));
+            if (grown == NULL) {
+                fprintf(stderr, "Memory allocation failed for spawn script\n");
+                exit(EXIT_FAILURE);
+            }
+            *spawns = grown;
+        }
+        
+        // Insert in step order, after clouds of the same step
+        int slot = count++;
+        while (slot > 0 && (*spawns)[slot - 1].step > step) {
+            (*spawns)[slot] = (*spawns)[slot - 1];
+            slot--;
+        }
+        SpawnEvent* spawn = &(*spawns)[slot];
+        spawn->step = step;
+        spawn->x = x;
+        spawn->y = y;
+        spawn->radius = radius;
+        spawn->count = bodies_in_cloud;
+    }
+    fclose(file);
+    return count;
+}
+
 // Load a font for UI rendering
 TTF_Font* load_font(const char* font_path, int font_size) {
     TTF_Font* font = TTF_OpenFont(font_path, font_size);
@@ -377,62 +2129,358 @@ void DrawButton(SDL_Renderer* renderer, int x, int y, int w, int h,
     }
 }
 
-// Render celestial bodies with their trajectories
+// Draw a line of text with its top-left corner at (x, y)
+void draw_text(SDL_Renderer* renderer, TTF_Font* font, const char* text, int x, int y, SDL_Color color) {
+    SDL_Surface* surface = TTF_RenderText_Solid(font, text, color);
+    if (surface) {
+        SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
+        if (texture) {
+            SDL_Rect rect = {x, y, surface->w, surface->h};
+            SDL_RenderCopy(renderer, texture, NULL, &rect);
+            SDL_DestroyTexture(texture);
+        }
+        SDL_FreeSurface(surface);
+    }
+}
+
+// Draw the recent dt values as a sparkline inside the given box; the
+// vertical axis is logarithmic between the controller's min_dt and max_dt
+void render_dt_history(SDL_Renderer* renderer, const TimestepController* timestep, int x, int y, int w, int h) {
+    static SDL_Point points[DT_HISTORY_LENGTH];
+    int count = timestep->history_count;
+    if (count < 2) {
+        return;
+    }
+
+    SDL_Rect frame = {x, y, w, h};
+    SDL_SetRenderDrawColor(renderer, 80, 80, 80, 255);
+    SDL_RenderDrawRect(renderer, &frame);
+
+    double log_min = log(timestep->min_dt);
+    double log_range = log(timestep->max_dt) - log_min;
+    int oldest = (timestep->history_head - count + DT_HISTORY_LENGTH) % DT_HISTORY_LENGTH;
+    for (int i = 0; i < count; i++) {
+        double dt = timestep->history[(oldest + i) % DT_HISTORY_LENGTH];
+        double level = log_range > 0.0 ? (log(dt) - log_min) / log_range : 0.0;
+        if (level < 0.0) level = 0.0;
+        if (level > 1.0) level = 1.0;
+        points[i].x = x + (int)((double)i * (w - 1) / (DT_HISTORY_LENGTH - 1));
+        points[i].y = y + h - 1 - (int)(level * (h - 1));
+    }
+
+    SDL_SetRenderDrawColor(renderer, 0, 200, 255, 255);
+    SDL_RenderDrawLines(renderer, points, count);
+}
+
+// Draw the histogram of one element quantity as bars inside the given box,
+// scaled to the fullest bin, with its label and range above; the period
+// ratio also gets markers at Jupiter's 3:1, 5:2, 7:3 and 2:1 resonances
+void render_element_histogram(SDL_Renderer* renderer, TTF_Font* font, const ElementHistogram* histogram,
+                              ElementQuantity quantity, int x, int y, int w, int h) {
+    static const char* labels[ELEMENT_QUANTITIES] = {"a (AU)", "e", "P / P Jupiter"};
+    SDL_Color text_color = {255, 255, 255, 255};
+    char line[64];
+    snprintf(line, sizeof(line), "%s  %g - %g", labels[quantity], histogram->low, histogram->high);
+    draw_text(renderer, font, line, x, y - 40, text_color);
+
+    SDL_Rect frame = {x, y, w, h};
+    SDL_SetRenderDrawColor(renderer, 80, 80, 80, 255);
+    SDL_RenderDrawRect(renderer, &frame);
+
+    long fullest = 0;
+    for (int b = 0; b < ELEMENT_BINS; b++) {
+        if (histogram->counts[b] > fullest) fullest = histogram->counts[b];
+    }
+    if (fullest == 0) {
+        return;
+    }
+
+    double range = histogram->high - histogram->low;
+    if (quantity == ELEMENT_PERIOD_RATIO) {
+        static const double resonances[] = {1.0 / 3.0, 2.0 / 5.0, 3.0 / 7.0, 1.0 / 2.0};
+        SDL_SetRenderDrawColor(renderer, 120, 60, 60, 255);
+        for (int r = 0; r < 4; r++) {
+            int rx = x + (int)((resonances[r] - histogram->low) / range * w);
+            SDL_RenderDrawLine(renderer, rx, y, rx, y + h - 1);
+        }
+    }
+
+    SDL_SetRenderDrawColor(renderer, 0, 200, 255, 255);
+    for (int b = 0; b < ELEMENT_BINS; b++) {
+        int left = x + b * w / ELEMENT_BINS;
+        int right = x + (b + 1) * w / ELEMENT_BINS;
+        int bar = (int)((double)histogram->counts[b] / fullest * (h - 2));
+        if (bar > 0) {
+            SDL_Rect rect = {left, y + h - 1 - bar, right - left > 1 ? right - left - 1 : 1, bar};
+            SDL_RenderFillRect(renderer, &rect);
+        }
+    }
+}
+
+// Draw the picked body's overlay: state, orbit about the Sun and the
+// force from each planet and from the other bodies, with each one's share
+// of the total pull; a pull the engine did not apply is left out of the
+// total and marked as such
+void render_body_info(SDL_Renderer* renderer, TTF_Font* font, const BodyInfo* info, int x, int y) {
+    SDL_Color text_color = {255, 255, 255, 255};
+    SDL_Color dim_color = {170, 170, 170, 255};
+    const CelestialBody* body = info->body;
+    char line[128];
+    int row = 35;
+    
+    snprintf(line, sizeof(line), "%s  (id %d, mass %.3e)  G: force trace %s", body->name, body->id, body->mass,
+             info->traced ? "ON" : "off");
+    draw_text(renderer, font, line, x, y, text_color);
+    y += row;
+    snprintf(line, sizeof(line), "r: (%.5f, %.5f) AU  %.5f from the Sun", body->x, body->y, info->distance);
+    draw_text(renderer, font, line, x, y, text_color);
+    y += row;
+    snprintf(line, sizeof(line), "v: (%.5f, %.5f)  |v| %.5f", body->vx, body->vy,
+             sqrt(body->vx * body->vx + body->vy * body->vy));
+    draw_text(renderer, font, line, x, y, text_color);
+    y += row;
+    if (!info->orbits) {
+        snprintf(line, sizeof(line), "Central body");
+    } else if (info->a <= 0.0) {
+        snprintf(line, sizeof(line), "Open orbit: e %.4f", info->e);
+    } else if (info->reference) {
+        snprintf(line, sizeof(line), "a %.5f AU  e %.5f  P %.4f  P / P %s %.5f", info->a, info->e, info->period,
+                 info->reference, info->period_ratio);
+    } else {
+        snprintf(line, sizeof(line), "a %.5f AU  e %.5f  P %.4f", info->a, info->e, info->period);
+    }
+    draw_text(renderer, font, line, x, y, text_color);
+    y += row;
+    
+    double total_fx = info->light_applied ? info->light_fx : 0.0;
+    double total_fy = info->light_applied ? info->light_fy : 0.0;
+    for (int m = 0; m < info->massive_count; m++) {
+        total_fx += info->massive_fx[m];
+        total_fy += info->massive_fy[m];
+    }
+    double total = sqrt(total_fx * total_fx + total_fy * total_fy);
+    snprintf(line, sizeof(line), "Force: %.4e  (%.4e, %.4e)", total, total_fx, total_fy);
+    draw_text(renderer, font, line, x, y, text_color);
+    y += row;
+    for (int m = 0; m <= info->massive_count; m++) {
+        bool light = m == info->massive_count;
+        if (!light && &info->massive[m] == body) {
+            continue;
+        }
+        double fx = light ? info->light_fx : info->massive_fx[m];
+        double fy = light ? info->light_fy : info->massive_fy[m];
+        double magnitude = sqrt(fx * fx + fy * fy);
+        if (light && !info->light_applied) {
+            snprintf(line, sizeof(line), "  %d others: %.4e  (not applied by the particles engine)",
+                     info->light_count, magnitude);
+        } else if (light) {
+            snprintf(line, sizeof(line), "  %d others: %.4e  (%.2f%%)", info->light_count, magnitude,
+                     total > 0.0 ? 100.0 * magnitude / total : 0.0);
+        } else {
+            snprintf(line, sizeof(line), "  %s: %.4e  (%.2f%%)", info->massive[m].name, magnitude,
+                     total > 0.0 ? 100.0 * magnitude / total : 0.0);
+        }
+        draw_text(renderer, font, line, x, y, dim_color);
+        y += row;
+    }
+}
+
+// Zooms by factor while keeping the world point under (screen_x, screen_y)
+// in place; a followed body stays centered instead
+void camera_zoom_at(Camera* camera, double factor, int screen_x, int screen_y, int width, int height,
+                    double min_zoom, double max_zoom) {
+    double zoom = camera->pixels_per_AU * factor;
+    if (zoom < min_zoom) zoom = min_zoom;
+    if (zoom > max_zoom) zoom = max_zoom;
+    
+    if (camera->follow < 0) {
+        double offset_x = screen_x - width / 2.0;
+        double offset_y = screen_y - height / 2.0;
+        camera->center_x += offset_x / camera->pixels_per_AU - offset_x / zoom;
+        camera->center_y -= offset_y / camera->pixels_per_AU - offset_y / zoom;
+    }
+    camera->pixels_per_AU = zoom;
+}
+
+// World point drawn at a screen position (the inverse of project_points)
+void camera_screen_to_world(const Camera* camera, double screen_x, double screen_y, int width, int height,
+                            double* world_x, double* world_y) {
+    *world_x = camera->center_x + (screen_x - width / 2.0) / camera->pixels_per_AU;
+    *world_y = camera->center_y - (screen_y - height / 2.0) / camera->pixels_per_AU;  // World y grows upwards
+}
+
+// Moves the view by a screen-space offset (stops following)
+void camera_pan(Camera* camera, double dx_pixels, double dy_pixels) {
+    camera->follow = -1;
+    camera->center_x += dx_pixels / camera->pixels_per_AU;
+    camera->center_y -= dy_pixels / camera->pixels_per_AU;  // World y grows upwards
+}
+
+// Scratch buffers for drawing bodies, reused across frames
+static CelestialBody** visible_bodies = NULL;
+static double* visible_x = NULL;        // World positions of the visible bodies (SoA)
+static double* visible_y = NULL;
+static SDL_FPoint* visible_screen = NULL;
+static int visible_capacity = 0;
+static SDL_Vertex* asteroid_vertices = NULL;
+static int* asteroid_indices = NULL;
+static int asteroid_capacity = 0;       // Asteroids the geometry buffers can hold
+
+// Asteroids are drawn as small octagons (a center plus eight rim vertices)
+#define ASTEROID_SIDES 8
+
+// Projects world positions to screen space in one pass; the loop has no
+// branches so the compiler can vectorize it
+static void project_points(const Camera* camera, int width, int height,
+                           const double* xs, const double* ys, int count, SDL_FPoint* out) {
+    double scale = camera->pixels_per_AU;
+    double origin_x = width / 2.0 - camera->center_x * scale;
+    double origin_y = height / 2.0 + camera->center_y * scale;
+    for (int i = 0; i < count; i++) {
+        out[i].x = (float)(origin_x + xs[i] * scale);
+        out[i].y = (float)(origin_y - ys[i] * scale);
+    }
+}
+
+// Grows the body scratch buffers to hold count bodies
+static void reserve_visible(int count) {
+    if (count <= visible_capacity) {
+        return;
+    }
+    visible_bodies = (CelestialBody**)realloc(visible_bodies, count * sizeof(CelestialBody*));
+    visible_x = (double*)realloc(visible_x, count * sizeof(double));
+    visible_y = (double*)realloc(visible_y, count * sizeof(double));
+    visible_screen = (SDL_FPoint*)realloc(visible_screen, count * sizeof(SDL_FPoint));
+    if (!visible_bodies || !visible_x || !visible_y || !visible_screen) {
+        fprintf(stderr, "Memory allocation failed for visible bodies\n");
+        exit(EXIT_FAILURE);
+    }
+    visible_capacity = count;
+}
+
+// Grows the asteroid geometry buffers; the index pattern is the same for
+// every asteroid, so it is only written for the new slots
+static void reserve_asteroid_geometry(int count) {
+    if (count <= asteroid_capacity) {
+        return;
+    }
+    asteroid_vertices = (SDL_Vertex*)realloc(asteroid_vertices,
+                                             count * (ASTEROID_SIDES + 1) * sizeof(SDL_Vertex));
+    asteroid_indices = (int*)realloc(asteroid_indices, count * ASTEROID_SIDES * 3 * sizeof(int));
+    if (!asteroid_vertices || !asteroid_indices) {
+        fprintf(stderr, "Memory allocation failed for asteroid geometry\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int a = asteroid_capacity; a < count; a++) {
+        int base = a * (ASTEROID_SIDES + 1);
+        int* index = &asteroid_indices[a * ASTEROID_SIDES * 3];
+        for (int k = 0; k < ASTEROID_SIDES; k++) {
+            index[3 * k] = base;
+            index[3 * k + 1] = base + 1 + k;
+            index[3 * k + 2] = base + 1 + (k + 1) % ASTEROID_SIDES;
+        }
+    }
+    asteroid_capacity = count;
+}
+
+// Render celestial bodies with their trajectories, optionally over the
+// quadtree cost overlay
 void render_bodies(SDL_Renderer* renderer, CelestialBody bodies[], int body_count, 
-                  double pixels_per_AU, TTF_Font* font, double dt) {
+                  TrailCache* trails, const Camera* camera, TTF_Font* font,
+                  const HudInfo* hud, QuadTreeNode* tree, bool show_tree) {
+    // Output size (the window, or an offscreen frame of any resolution)
+    int width, height;
+    SDL_GetRendererOutputSize(renderer, &width, &height);
+    
     // Clear the screen
     SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
     SDL_RenderClear(renderer);
     
+    // Quadtree cells underneath everything else
+    if (show_tree) {
+        render_quadtree_overlay(renderer, tree, camera, width, height);
+    }
+    
     // Draw trajectories for planets only (not asteroids to reduce clutter)
-    for (int i = 0; i < NUM_PLANETS; i++) {
-        if (bodies[i].trajectory_count > 1) {
-            // Set white color for trajectories
-            SDL_SetRenderDrawColor(renderer, 255, 255, 255, 100);  // Partially transparent
-            
-            for (int j = 1; j < bodies[i].trajectory_count; j++) {
-                int x1 = WIDTH / 2 + (int)(bodies[i].trajectory_x[j - 1] * pixels_per_AU);
-                int y1 = HEIGHT / 2 - (int)(bodies[i].trajectory_y[j - 1] * pixels_per_AU);
-                int x2 = WIDTH / 2 + (int)(bodies[i].trajectory_x[j] * pixels_per_AU);
-                int y2 = HEIGHT / 2 - (int)(bodies[i].trajectory_y[j] * pixels_per_AU);
-                
-                SDL_RenderDrawLine(renderer, x1, y1, x2, y2);
-            }
+    render_trails(renderer, trails, camera, width, height);
+    
+    // Find the bodies inside the viewport (grown by the largest body radius)
+    // with a range query, so off-screen bodies cost nothing
+    reserve_visible(body_count);
+    double half_w = (width / 2 + MAX_BODY_RADIUS) / camera->pixels_per_AU;
+    double half_h = (height / 2 + MAX_BODY_RADIUS) / camera->pixels_per_AU;
+    int visible_count = quadtree_within_rect(tree, camera->center_x - half_w, camera->center_y - half_h,
+                                             camera->center_x + half_w, camera->center_y + half_h, NULL,
+                                             visible_bodies, visible_capacity);
+    
+    // Gather their positions and project them all at once
+    for (int v = 0; v < visible_count; v++) {
+        visible_x[v] = visible_bodies[v]->x;
+        visible_y[v] = visible_bodies[v]->y;
+    }
+    project_points(camera, width, height, visible_x, visible_y, visible_count, visible_screen);
+    
+    // Planets are drawn one by one; asteroids are collected into one
+    // geometry batch with per-vertex colors
+    static float rim_x[ASTEROID_SIDES], rim_y[ASTEROID_SIDES];
+    static bool rim_ready = false;
+    if (!rim_ready) {
+        for (int k = 0; k < ASTEROID_SIDES; k++) {
+            rim_x[k] = (float)cos(2.0 * M_PI * k / ASTEROID_SIDES);
+            rim_y[k] = (float)sin(2.0 * M_PI * k / ASTEROID_SIDES);
         }
+        rim_ready = true;
     }
+    reserve_asteroid_geometry(visible_count);
+    int asteroid_count = 0;
     
     // Draw celestial bodies
-    for (int i = 0; i < body_count; i++) {
-        int screen_x = WIDTH / 2 + (int)(bodies[i].x * pixels_per_AU);
-        int screen_y = HEIGHT / 2 - (int)(bodies[i].y * pixels_per_AU);
-        int radius = (int)bodies[i].radius;
+    for (int v = 0; v < visible_count; v++) {
+        CelestialBody* body = visible_bodies[v];
+        float screen_x = visible_screen[v].x;
+        float screen_y = visible_screen[v].y;
+        float radius = (float)body->radius;
         
         // Skip if outside visible area (with margin)
-        if (screen_x < -radius || screen_x >= WIDTH + radius || 
-            screen_y < -radius || screen_y >= HEIGHT + radius) {
+        if (screen_x < -radius || screen_x >= width + radius || 
+            screen_y < -radius || screen_y >= height + radius) {
             continue;
         }
         
         // Extract color components
-        Uint8 r = (bodies[i].color >> 16) & 0xFF;
-        Uint8 g = (bodies[i].color >> 8) & 0xFF;
-        Uint8 b = bodies[i].color & 0xFF;
+        Uint8 r = (body->color >> 16) & 0xFF;
+        Uint8 g = (body->color >> 8) & 0xFF;
+        Uint8 b = body->color & 0xFF;
         
-        if (i < NUM_PLANETS) {
+        if (body - bodies < NUM_PLANETS) {
             // Draw planets with border
-            draw_circle_border(renderer, screen_x, screen_y, radius, r, g, b, 255, 2);
+            draw_circle_border(renderer, (int)lroundf(screen_x), (int)lroundf(screen_y), (int)radius,
+                               r, g, b, 255, 2);
         } else {
-            // Draw asteroids as simple points for performance
-            SDL_SetRenderDrawColor(renderer, r, g, b, 255);
-            for (int dy = -radius; dy <= radius; dy++) {
-                for (int dx = -radius; dx <= radius; dx++) {
-                    if (dx*dx + dy*dy <= radius*radius) {
-                        SDL_RenderDrawPoint(renderer, screen_x + dx, screen_y + dy);
-                    }
-                }
+            SDL_Vertex* vertex = &asteroid_vertices[asteroid_count * (ASTEROID_SIDES + 1)];
+            SDL_Color color = { r, g, b, 255 };
+            vertex[0].position = visible_screen[v];
+            vertex[0].color = color;
+            for (int k = 0; k < ASTEROID_SIDES; k++) {
+                vertex[k + 1].position.x = screen_x + rim_x[k] * radius;
+                vertex[k + 1].position.y = screen_y + rim_y[k] * radius;
+                vertex[k + 1].color = color;
             }
+            asteroid_count++;
         }
     }
+    if (asteroid_count > 0) {
+        SDL_RenderGeometry(renderer, NULL, asteroid_vertices, asteroid_count * (ASTEROID_SIDES + 1),
+                           asteroid_indices, asteroid_count * ASTEROID_SIDES * 3);
+    }
+    
+    // Ring around the picked body
+    if (hud->selected) {
+        SDL_FPoint picked;
+        project_points(camera, width, height, &hud->selected->body->x, &hud->selected->body->y, 1, &picked);
+        draw_circle_border(renderer, (int)lroundf(picked.x), (int)lroundf(picked.y),
+                           (int)hud->selected->body->radius + PICK_SLACK_PIXELS, 255, 255, 255, 255, 2);
+    }
     
     // Draw UI buttons and labels
     SDL_Color text_color = {255, 255, 255, 255};
@@ -444,7 +2492,7 @@ void render_bodies(SDL_Renderer* renderer, CelestialBody bodies[], int body_coun
         if (zoom_texture) {
             int text_w, text_h;
             SDL_QueryTexture(zoom_texture, NULL, NULL, &text_w, &text_h);
-            int x = WIDTH - 100 - text_w - 10; // 10 pixels padding from buttons
+            int x = width - 100 - text_w - 10; // 10 pixels padding from buttons
             int y = 60 - text_h / 2;           // Center vertically between y=20 and y=80
             if (y < 0) y = 0;                  // Prevent going off-screen
             SDL_Rect text_rect = {x, y, text_w, text_h};
@@ -460,7 +2508,7 @@ void render_bodies(SDL_Renderer* renderer, CelestialBody bodies[], int body_coun
         if (speed_texture) {
             int text_w, text_h;
             SDL_QueryTexture(speed_texture, NULL, NULL, &text_w, &text_h);
-            int x = WIDTH - 100 - text_w - 10; // 10 pixels padding from buttons
+            int x = width - 100 - text_w - 10; // 10 pixels padding from buttons
             int y = 240 - text_h / 2;          // Center vertically between y=200 and y=260
             if (y < 0) y = 0;                  // Prevent going off-screen
             SDL_Rect text_rect = {x, y, text_w, text_h};
@@ -472,14 +2520,14 @@ void render_bodies(SDL_Renderer* renderer, CelestialBody bodies[], int body_coun
     
     // Display current speed value
     char speed_value[32];
-    snprintf(speed_value, sizeof(speed_value), "dt: %.4f", dt);
+    snprintf(speed_value, sizeof(speed_value), hud->adaptive_dt ? "dt: %.4f (auto)" : "dt: %.4f", hud->dt);
     SDL_Surface* dt_surface = TTF_RenderText_Solid(font, speed_value, text_color);
     if (dt_surface) {
         SDL_Texture* dt_texture = SDL_CreateTextureFromSurface(renderer, dt_surface);
         if (dt_texture) {
             int text_w, text_h;
             SDL_QueryTexture(dt_texture, NULL, NULL, &text_w, &text_h);
-            int x = WIDTH - 100 - text_w - 10; // 10 pixels padding from buttons
+            int x = width - 100 - text_w - 10; // 10 pixels padding from buttons
             int y = 290;                       // Below the speed buttons
             SDL_Rect text_rect = {x, y, text_w, text_h};
             SDL_RenderCopy(renderer, dt_texture, NULL, &text_rect);
@@ -488,21 +2536,309 @@ void render_bodies(SDL_Renderer* renderer, CelestialBody bodies[], int body_coun
         SDL_FreeSurface(dt_surface);
     }
     
+    // Accuracy panel (top-left)
+    char line[128];
+    snprintf(line, sizeof(line), "theta: %.2f  ([ / ])  engine: %s", hud->theta, force_engine_name(hud->engine));
+    draw_text(renderer, font, line, 10, 10, text_color);
+    if (hud->telemetry) {
+        const TelemetryReport* t = hud->telemetry;
+        snprintf(line, sizeof(line), "E: %.6e  drift: %+.2e", t->energy, t->energy_drift);
+        draw_text(renderer, font, line, 10, 45, text_color);
+        snprintf(line, sizeof(line), "L: %.6e  drift: %+.2e", t->angular_momentum, t->angular_momentum_drift);
+        draw_text(renderer, font, line, 10, 80, text_color);
+        snprintf(line, sizeof(line), "Force err (%d bodies): rms %.2e  max %.2e",
+                 t->force_samples, t->force_error_rms, t->force_error_max);
+        draw_text(renderer, font, line, 10, 115, text_color);
+    }
+    if (hud->have_step_energy) {
+        snprintf(line, sizeof(line), "E (step): %.6e  drift: %+.2e", hud->step_energy, hud->step_energy_drift);
+        draw_text(renderer, font, line, 10, 150, text_color);
+    }
+    if (camera->follow >= 0 && camera->follow < body_count) {
+        snprintf(line, sizeof(line), "Following: %s  (F: next, C: reset)", bodies[camera->follow].name);
+        draw_text(renderer, font, line, 10, 185, text_color);
+    }
+    
+    // Picked body (top-left, below the accuracy panel)
+    if (hud->selected) {
+        render_body_info(renderer, font, hud->selected, 10, 230);
+    }
+    
+    // Frame status (bottom-left, above the dt history)
+    if (hud->skip_remaining > 0) {
+        snprintf(line, sizeof(line), "FAST-FORWARD: %ld steps left (Esc to stop)", hud->skip_remaining);
+    } else {
+        snprintf(line, sizeof(line), "%.0f fps  %d steps/frame (- / =)  %d bodies%s", hud->fps, hud->substeps,
+                 body_count, hud->paused ? "  PAUSED (space, . to step)" : "");
+    }
+    draw_text(renderer, font, line, 10, height - 170, text_color);
+    
+    // Time-step history (bottom-left)
+    if (hud->timestep) {
+        render_dt_history(renderer, hud->timestep, 10, height - 130, 400, 120);
+    }
+    
+    // Orbital-element histograms (bottom-right)
+    if (hud->elements) {
+        for (int q = 0; q < ELEMENT_QUANTITIES; q++) {
+            render_element_histogram(renderer, font, &hud->elements->latest[q], (ElementQuantity)q,
+                                     width - 3 * 420 + q * 420, height - 130, 400, 120);
+        }
+    }
+    
     // Draw buttons - using exact placement from sdl_render.c
-    DrawButton(renderer, WIDTH - 100, 20, 50, 40, font, "+", text_color);  // Zoom In
-    DrawButton(renderer, WIDTH - 100, 80, 50, 40, font, "-", text_color);  // Zoom Out
-    DrawButton(renderer, WIDTH - 100, 200, 50, 40, font, "+", text_color); // Increase dt
-    DrawButton(renderer, WIDTH - 100, 260, 50, 40, font, "-", text_color); // Decrease dt
+    DrawButton(renderer, width - 100, 20, 50, 40, font, "+", text_color);  // Zoom In
+    DrawButton(renderer, width - 100, 80, 50, 40, font, "-", text_color);  // Zoom Out
+    DrawButton(renderer, width - 100, 200, 50, 40, font, "+", text_color); // Increase dt
+    DrawButton(renderer, width - 100, 260, 50, 40, font, "-", text_color); // Decrease dt
     
     // Present the rendered frame
     SDL_RenderPresent(renderer);
 }
 
+// ***********************
+// Trajectory rendering
+// ***********************
+
+// Sets up an empty cache for the trails of the given store
+void trail_cache_init(TrailCache* cache, const TrajectoryStore* store) {
+    memset(cache, 0, sizeof(TrailCache));
+    cache->store = store;
+}
+
+// Frees the projected points
+void trail_cache_free(TrailCache* cache) {
+    for (int i = 0; i < NUM_PLANETS; i++) {
+        free(cache->buffers[i].points);
+        cache->buffers[i].points = NULL;
+    }
+}
+
+// Brings a buffer up to date with its track: vertices dropped from the
+// track are dropped from the front, new ones are projected onto the end
+static void sync_trail_buffer(TrailBuffer* buffer, const TrajectoryStore* store, int track_index,
+                              float scale, float origin_x, float origin_y) {
+    const Trajectory* track = &store->tracks[track_index];
+    
+    long dropped = track->first_vertex - buffer->first_vertex;
+    if (dropped >= buffer->count) {
+        buffer->count = 0;
+        buffer->first_vertex = track->first_vertex;
+    } else if (dropped > 0) {
+        buffer->count -= (int)dropped;
+        memmove(buffer->points, buffer->points + dropped, buffer->count * sizeof(SDL_FPoint));
+        buffer->first_vertex = track->first_vertex;
+    }
+    
+    long next = buffer->first_vertex + buffer->count;
+    if (next >= track->end_vertex) {
+        return;
+    }
+    
+    int needed = (int)(track->end_vertex - buffer->first_vertex) + 1;  // +1 for the live end
+    if (needed > buffer->capacity) {
+        int capacity = buffer->capacity > 0 ? buffer->capacity : 256;
+        while (capacity < needed) capacity *= 2;
+        SDL_FPoint* points = (SDL_FPoint*)realloc(buffer->points, capacity * sizeof(SDL_FPoint));
+        if (points == NULL) {
+            fprintf(stderr, "Memory allocation failed for trail buffer\n");
+            exit(EXIT_FAILURE);
+        }
+        buffer->points = points;
+        buffer->capacity = capacity;
+    }
+    
+    // Project chunk by chunk from the first missing vertex
+    int offset;
+    const TrajectoryChunk* chunk = trajectory_find_vertex(store, track_index, next, &offset);
+    SDL_FPoint* out = buffer->points + buffer->count;
+    while (chunk != NULL) {
+        int n = chunk->count - offset;
+        const float* xs = chunk->x + offset;
+        const float* ys = chunk->y + offset;
+        for (int j = 0; j < n; j++) {
+            out[j].x = origin_x + xs[j] * scale;
+            out[j].y = origin_y - ys[j] * scale;
+        }
+        out += n;
+        buffer->count += n;
+        offset = 0;
+        chunk = trajectory_chunk(store, chunk->next);
+    }
+}
+
+// Draws the planet trails, one polyline call per planet
+void render_trails(SDL_Renderer* renderer, TrailCache* cache, const Camera* camera, int width, int height) {
+    const TrajectoryStore* store = cache->store;
+    
+    float scale = (float)camera->pixels_per_AU;
+    float origin_x = (float)(width / 2.0 - camera->center_x * camera->pixels_per_AU);
+    float origin_y = (float)(height / 2.0 + camera->center_y * camera->pixels_per_AU);
+    
+    // A new zoom or output size invalidates every buffer; a moved centre
+    // only shifts the projected points, in one pass over each buffer
+    if (cache->pixels_per_AU != camera->pixels_per_AU || cache->width != width || cache->height != height ||
+        cache->shifts >= TRAIL_MAX_SHIFTS) {
+        for (int i = 0; i < NUM_PLANETS; i++) {
+            cache->buffers[i].count = 0;
+        }
+        cache->pixels_per_AU = camera->pixels_per_AU;
+        cache->width = width;
+        cache->height = height;
+        cache->shifts = 0;
+    } else if (cache->origin_x != origin_x || cache->origin_y != origin_y) {
+        float shift_x = origin_x - cache->origin_x;
+        float shift_y = origin_y - cache->origin_y;
+        for (int i = 0; i < NUM_PLANETS; i++) {
+            TrailBuffer* buffer = &cache->buffers[i];
+            for (int j = 0; j < buffer->count; j++) {
+                buffer->points[j].x += shift_x;
+                buffer->points[j].y += shift_y;
+            }
+        }
+        cache->shifts++;
+    }
+    cache->origin_x = origin_x;
+    cache->origin_y = origin_y;
+    
+    // Set white color for trajectories
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 100);  // Partially transparent
+    
+    for (int i = 0; i < NUM_PLANETS && i < store->track_count; i++) {
+        const Trajectory* track = &store->tracks[i];
+        if (!track->started) {
+            continue;
+        }
+        
+        TrailBuffer* buffer = &cache->buffers[i];
+        sync_trail_buffer(buffer, store, i, scale, origin_x, origin_y);
+        if (buffer->count == 0) {
+            continue;
+        }
+        
+        // The latest sample is the live end of the line
+        buffer->points[buffer->count].x = origin_x + (float)track->last_x * scale;
+        buffer->points[buffer->count].y = origin_y - (float)track->last_y * scale;
+        SDL_RenderDrawLinesF(renderer, buffer->points, buffer->count + 1);
+    }
+}
+
+// ***********************
+// Quadtree overlay
+// ***********************
+
+// Number of heat buckets; every bucket is drawn with one batched call
+#define OVERLAY_BUCKETS 8
+
+// A cell collected for the overlay
+typedef struct {
+    SDL_Rect rect;
+    int visits;
+} OverlayCell;
+
+// Scratch buffers reused across frames
+static OverlayCell* overlay_cells = NULL;
+static SDL_Rect* overlay_rects = NULL;
+static int overlay_capacity = 0;
+static int overlay_count = 0;
+
+// Collects on-screen cells of the subtree, returning the largest visit count
+static int collect_overlay_cells(QuadTreeNode* node, const Camera* camera, int width, int height) {
+    if (node == NULL) {
+        return 0;
+    }
+    
+    // Cell bounds in screen space (world y grows upwards)
+    double scale = camera->pixels_per_AU;
+    double origin_x = width / 2.0 - camera->center_x * scale;
+    double origin_y = height / 2.0 + camera->center_y * scale;
+    int x0 = (int)floor(origin_x + node->x * scale);
+    int x1 = (int)floor(origin_x + (node->x + node->width) * scale);
+    int y0 = (int)floor(origin_y - (node->y + node->height) * scale);
+    int y1 = (int)floor(origin_y - node->y * scale);
+    
+    // Nothing below an off-screen cell can be visible
+    if (x1 < 0 || x0 >= width || y1 < 0 || y0 >= height) {
+        return 0;
+    }
+    
+    if (overlay_count == overlay_capacity) {
+        overlay_capacity = overlay_capacity ? overlay_capacity * 2 : 1024;
+        overlay_cells = (OverlayCell*)realloc(overlay_cells, overlay_capacity * sizeof(OverlayCell));
+        overlay_rects = (SDL_Rect*)realloc(overlay_rects, overlay_capacity * sizeof(SDL_Rect));
+        if (overlay_cells == NULL || overlay_rects == NULL) {
+            fprintf(stderr, "Memory allocation failed for quadtree overlay\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    OverlayCell* cell = &overlay_cells[overlay_count++];
+    cell->rect.x = x0;
+    cell->rect.y = y0;
+    cell->rect.w = x1 - x0 + 1;
+    cell->rect.h = y1 - y0 + 1;
+    cell->visits = node->visits;
+    
+    // Cells narrower than two pixels would only add noise
+    int max_visits = node->visits;
+    if (node->nw != NULL && x1 - x0 >= 4) {
+        QuadTreeNode* children[4] = { node->nw, node->ne, node->sw, node->se };
+        for (int i = 0; i < 4; i++) {
+            int child_max = collect_overlay_cells(children[i], camera, width, height);
+            if (child_max > max_visits) max_visits = child_max;
+        }
+    }
+    return max_visits;
+}
+
+// Draws quadtree cell boundaries colored by how often the force walk
+// visited each cell this frame (blue = cold, red = hot, log scale)
+void render_quadtree_overlay(SDL_Renderer* renderer, QuadTreeNode* root, const Camera* camera,
+                             int width, int height) {
+    overlay_count = 0;
+    int max_visits = collect_overlay_cells(root, camera, width, height);
+    if (overlay_count == 0) {
+        return;
+    }
+    
+    // Bucket each cell by log(visits) and sort rects by bucket (counting sort)
+    double scale = log(max_visits + 1.0);
+    int bucket_start[OVERLAY_BUCKETS + 1] = {0};
+    for (int i = 0; i < overlay_count; i++) {
+        int bucket = scale > 0 ? (int)(OVERLAY_BUCKETS * log(overlay_cells[i].visits + 1.0) / scale) : 0;
+        if (bucket >= OVERLAY_BUCKETS) bucket = OVERLAY_BUCKETS - 1;
+        overlay_cells[i].visits = bucket;  // Reuse the field for the bucket index
+        bucket_start[bucket + 1]++;
+    }
+    for (int b = 0; b < OVERLAY_BUCKETS; b++) {
+        bucket_start[b + 1] += bucket_start[b];
+    }
+    int fill[OVERLAY_BUCKETS];
+    memcpy(fill, bucket_start, sizeof(fill));
+    for (int i = 0; i < overlay_count; i++) {
+        overlay_rects[fill[overlay_cells[i].visits]++] = overlay_cells[i].rect;
+    }
+    
+    // One draw call per bucket
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    for (int b = 0; b < OVERLAY_BUCKETS; b++) {
+        int count = bucket_start[b + 1] - bucket_start[b];
+        if (count == 0) continue;
+        double heat = (double)b / (OVERLAY_BUCKETS - 1);
+        Uint8 r = (Uint8)(255 * heat);
+        Uint8 g = (Uint8)(255 * (1.0 - fabs(2.0 * heat - 1.0)));
+        Uint8 bl = (Uint8)(255 * (1.0 - heat));
+        SDL_SetRenderDrawColor(renderer, r, g, bl, (Uint8)(60 + 160 * heat));
+        SDL_RenderDrawRects(renderer, &overlay_rects[bucket_start[b]], count);
+    }
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+}
+
 // Log simulation data for analysis
 void log_simulation_data(FILE* log_file, CelestialBody bodies[], int body_count, double time) {
     for (int i = 0; i < body_count; i++) {
-        // Log only planets and a subset of asteroids to keep file size manageable
-        if (i < NUM_PLANETS || (i % 20 == 0)) {
+        // Log only planets and a subset of asteroids to keep file size
+        // manageable (chosen by id, so removals do not change the subset)
+        if (bodies[i].id < NUM_PLANETS || (bodies[i].id % 20 == 0)) {
             fprintf(log_file, "%.3f,%s,%.6f,%.6f,%.6f,%.6f,%.6e\n",
                     time, bodies[i].name, bodies[i].x, bodies[i].y,
                     bodies[i].vx, bodies[i].vy, bodies[i].mass);
@@ -530,17 +2866,68 @@ CelestialBody* create_body(double x, double y, double vx, double vy, double mass
     body->radius = radius;
     sprintf(body->name, "Body");  // Default name
     body->color = 0xFFFFFF;       // Default color (white)
-    body->trajectory_count = 0;
+    body->id = 0;
     
     return body;
 }
 
+// Nodes per arena block
+#define NODE_BLOCK_SIZE 256
+
+// Takes the next node from an arena, adding a block if all are in use
+static QuadTreeNode* arena_allocate_node(NodeArena* arena) {
+    int block = arena->used / NODE_BLOCK_SIZE;
+    if (block == arena->block_count) {
+        QuadTreeNode** blocks = (QuadTreeNode**)realloc(arena->blocks,
+                                                        (arena->block_count + 1) * sizeof(QuadTreeNode*));
+        if (blocks == NULL) {
+            fprintf(stderr, "Memory allocation failed for quad-tree arena\n");
+            exit(EXIT_FAILURE);
+        }
+        arena->blocks = blocks;
+        arena->blocks[block] = (QuadTreeNode*)malloc(NODE_BLOCK_SIZE * sizeof(QuadTreeNode));
+        if (arena->blocks[block] == NULL) {
+            fprintf(stderr, "Memory allocation failed for quad-tree node\n");
+            exit(EXIT_FAILURE);
+        }
+        arena->block_count++;
+    }
+    return &arena->blocks[block][arena->used++ % NODE_BLOCK_SIZE];
+}
+
+// Returns every node of an arena; trees built from it are no longer valid
+void node_arena_reset(NodeArena* arena) {
+    arena->used = 0;
+}
+
+// Frees the blocks of an arena
+void node_arena_free(NodeArena* arena) {
+    for (int i = 0; i < arena->block_count; i++) {
+        free(arena->blocks[i]);
+    }
+    free(arena->blocks);
+    arena->blocks = NULL;
+    arena->block_count = 0;
+    arena->used = 0;
+}
+
 // Creates a new quadtree node covering the given region
 QuadTreeNode* create_quadtree(double x, double y, double width, double height) {
-    QuadTreeNode* node = (QuadTreeNode*)malloc(sizeof(QuadTreeNode));
-    if (node == NULL) {
-        fprintf(stderr, "Memory allocation failed for quad-tree node\n");
-        exit(EXIT_FAILURE);
+    return create_quadtree_in(NULL, x, y, width, height);
+}
+
+// Creates a new quadtree node from an arena (NULL = malloc); its
+// descendants come from the same arena
+QuadTreeNode* create_quadtree_in(NodeArena* arena, double x, double y, double width, double height) {
+    QuadTreeNode* node;
+    if (arena) {
+        node = arena_allocate_node(arena);
+    } else {
+        node = (QuadTreeNode*)malloc(sizeof(QuadTreeNode));
+        if (node == NULL) {
+            fprintf(stderr, "Memory allocation failed for quad-tree node\n");
+            exit(EXIT_FAILURE);
+        }
     }
     
     // Initialize node properties
@@ -556,6 +2943,9 @@ QuadTreeNode* create_quadtree(double x, double y, double width, double height) {
     node->total_mass = 0.0;
     node->center_x = 0.0;
     node->center_y = 0.0;
+    node->body_count = 0;
+    node->visits = 0;
+    node->arena = arena;
     
     return node;
 }
@@ -573,11 +2963,12 @@ void subdivide(QuadTreeNode* node) {
     double half_width = node->width / 2.0;
     double half_height = node->height / 2.0;
     
-    // Create the four child nodes
-    node->nw = create_quadtree(node->x, node->y, half_width, half_height);
-    node->ne = create_quadtree(node->x + half_width, node->y, half_width, half_height);
-    node->sw = create_quadtree(node->x, node->y + half_height, half_width, half_height);
-    node->se = create_quadtree(node->x + half_width, node->y + half_height, half_width, half_height);
+    // Create the four child nodes (from the parent's arena, if any)
+    NodeArena* arena = node->arena;
+    node->nw = create_quadtree_in(arena, node->x, node->y, half_width, half_height);
+    node->ne = create_quadtree_in(arena, node->x + half_width, node->y, half_width, half_height);
+    node->sw = create_quadtree_in(arena, node->x, node->y + half_height, half_width, half_height);
+    node->se = create_quadtree_in(arena, node->x + half_width, node->y + half_height, half_width, half_height);
 }
 
 // Determines which quadrant a body belongs to
@@ -645,12 +3036,14 @@ void calculate_center_of_mass(QuadTreeNode* node) {
         node->total_mass = node->body->mass;
         node->center_x = node->body->x;
         node->center_y = node->body->y;
+        node->body_count = 1;
         return;
     }
     
     // Empty leaf node
     if (node->body == NULL && node->nw == NULL) {
         node->total_mass = 0.0;
+        node->body_count = 0;
         node->center_x = node->x + node->width / 2.0;
         node->center_y = node->y + node->height / 2.0;
         return;
@@ -666,6 +3059,8 @@ void calculate_center_of_mass(QuadTreeNode* node) {
     node->total_mass = 0.0;
     node->center_x = 0.0;
     node->center_y = 0.0;
+    node->body_count = node->nw->body_count + node->ne->body_count +
+                       node->sw->body_count + node->se->body_count;
     
     // Add contributions from each non-empty child
     if (node->nw->total_mass > 0) {
@@ -703,9 +3098,10 @@ void calculate_center_of_mass(QuadTreeNode* node) {
     }
 }
 
-// Recursively frees the quadtree
+// Recursively frees the quadtree (arena trees are released by resetting
+// their arena instead)
 void free_quadtree(QuadTreeNode* node) {
-    if (node == NULL) {
+    if (node == NULL || node->arena) {
         return;
     }
     
@@ -721,29 +3117,43 @@ void free_quadtree(QuadTreeNode* node) {
 
 // Calculates force on a body using the quadtree (Barnes-Hut approach)
 void calculate_force_from_quadtree(CelestialBody* body, QuadTreeNode* node, double theta, double* fx, double* fy) {
+    calculate_force_and_potential_from_quadtree(body, node, theta, fx, fy, NULL);
+}
+
+// calculate_force_from_quadtree that also adds the potential (per unit
+// mass) at the body to *potential, unless it is NULL. Each force term is
+// derived from its potential term, so the potential costs a subtraction.
+void calculate_force_and_potential_from_quadtree(CelestialBody* body, QuadTreeNode* node, double theta,
+                                                 double* fx, double* fy, double* potential) {
     if (node == NULL || node->total_mass == 0) {
         return;  // Empty node
     }
+    COUNT_VISIT(node);
     
     // If this is a leaf with a body
     if (node->body != NULL && node->body != body) {
         // Calculate distance between bodies
         double dx = node->body->x - body->x;
         double dy = node->body->y - body->y;
-        double distance_squared = dx*dx + dy*dy;
-        double distance = sqrt(distance_squared);
+        double distance = sqrt(dx*dx + dy*dy);
         
         // Prevent division by zero or extremely small values
         if (distance < EPSILON) {
             return;
         }
         
-        // Calculate gravitational force (F = G * m1 * m2 / r^2)
-        double force_magnitude = G * body->mass * node->body->mass / distance_squared;
+        // Calculate gravitational force (F = G * m1 * m2 / r^2) from the
+        // potential term G * m2 / r, so both take one division
+        double inverse_distance = 1.0 / distance;
+        double pull = G * node->body->mass * inverse_distance;
+        double force_magnitude = body->mass * pull * inverse_distance;
         
         // Resolve force into x and y components
-        *fx += force_magnitude * dx / distance;
-        *fy += force_magnitude * dy / distance;
+        *fx += force_magnitude * dx * inverse_distance;
+        *fy += force_magnitude * dy * inverse_distance;
+        if (potential) {
+            *potential -= pull;
+        }
         return;
     }
     
@@ -766,17 +3176,76 @@ void calculate_force_from_quadtree(CelestialBody* body, QuadTreeNode* node, doub
             }
             
             // Calculate gravitational force
-            double force_magnitude = G * body->mass * node->total_mass / (distance * distance);
+            double inverse_distance = 1.0 / distance;
+            double pull = G * node->total_mass * inverse_distance;
+            double force_magnitude = body->mass * pull * inverse_distance;
             
             // Resolve force into x and y components
+            *fx += force_magnitude * dx * inverse_distance;
+            *fy += force_magnitude * dy * inverse_distance;
+            if (potential) {
+                *potential -= pull;
+            }
+        } else {
+            // Otherwise, recursively calculate forces from each child
+            calculate_force_and_potential_from_quadtree(body, node->nw, theta, fx, fy, potential);
+            calculate_force_and_potential_from_quadtree(body, node->ne, theta, fx, fy, potential);
+            calculate_force_and_potential_from_quadtree(body, node->sw, theta, fx, fy, potential);
+            calculate_force_and_potential_from_quadtree(body, node->se, theta, fx, fy, potential);
+        }
+    }
+}
+
+// Short-range half of the TreePM force: calculate_force_from_quadtree with
+// every term scaled by the share the mesh leaves to the tree, skipping
+// nodes that lie wholly beyond the cutoff
+void calculate_short_range_force_from_quadtree(CelestialBody* body, QuadTreeNode* node, double theta,
+                                               double split_radius, double* fx, double* fy) {
+    if (node == NULL || node->total_mass == 0) {
+        return;  // Empty node
+    }
+    
+    // Nearest point of the node to the body
+    double cutoff = PM_CUTOFF_SPLITS * split_radius;
+    double gap_x = fmax(node->x - body->x, fmax(0.0, body->x - (node->x + node->width)));
+    double gap_y = fmax(node->y - body->y, fmax(0.0, body->y - (node->y + node->height)));
+    if (gap_x * gap_x + gap_y * gap_y > cutoff * cutoff) {
+        return;
+    }
+    COUNT_VISIT(node);
+    
+    if (node->body != NULL && node->body != body) {
+        double dx = node->body->x - body->x;
+        double dy = node->body->y - body->y;
+        double distance = sqrt(dx*dx + dy*dy);
+        if (distance < EPSILON) {
+            return;
+        }
+        double force_magnitude = G * body->mass * node->body->mass / (distance * distance) *
+                                 particle_mesh_short_range(distance / split_radius);
+        *fx += force_magnitude * dx / distance;
+        *fy += force_magnitude * dy / distance;
+        return;
+    }
+    
+    if (node->nw != NULL) {
+        double dx = node->center_x - body->x;
+        double dy = node->center_y - body->y;
+        double distance = sqrt(dx*dx + dy*dy);
+        double s = fmax(node->width, node->height);
+        if (s / distance < theta) {
+            if (distance < EPSILON) {
+                return;
+            }
+            double force_magnitude = G * body->mass * node->total_mass / (distance * distance) *
+                                     particle_mesh_short_range(distance / split_radius);
             *fx += force_magnitude * dx / distance;
             *fy += force_magnitude * dy / distance;
         } else {
-            // Otherwise, recursively calculate forces from each child
-            calculate_force_from_quadtree(body, node->nw, theta, fx, fy);
-            calculate_force_from_quadtree(body, node->ne, theta, fx, fy);
-            calculate_force_from_quadtree(body, node->sw, theta, fx, fy);
-            calculate_force_from_quadtree(body, node->se, theta, fx, fy);
+            calculate_short_range_force_from_quadtree(body, node->nw, theta, split_radius, fx, fy);
+            calculate_short_range_force_from_quadtree(body, node->ne, theta, split_radius, fx, fy);
+            calculate_short_range_force_from_quadtree(body, node->sw, theta, split_radius, fx, fy);
+            calculate_short_range_force_from_quadtree(body, node->se, theta, split_radius, fx, fy);
         }
     }
 }
@@ -0,0 +1,686 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+
+#include "simulation.h"
+#include "thread_pool.h"
+#include "engine.h"
+#include "pm.h"
+
+// Empty mesh nodes kept on each side of the bodies, so the assignment
+// stencil and the four-point gradient never leave the mesh
+#define PM_MARGIN 4
+
+// Bodies whose force errors are measured in the report
+#define PM_REPORT_SAMPLES 256
+
+// Radius of the report's uniform disk
+#define PM_REPORT_RADIUS 20.0
+
+// Entries of the short-range table between zero and the cutoff
+#define PM_TABLE_SIZE 1024
+
+// The short-range share is needed for every interaction of the walk, and
+// erfc and exp cost more than the rest of it; one table serves all meshes
+static double short_range_table[PM_TABLE_SIZE + 2];
+static bool short_range_ready = false;
+static SDL_SpinLock short_range_lock = 0;
+
+struct ParticleMesh;
+
+// One worker's share of a stage: items [begin, end)
+typedef void (*PmStage)(struct ParticleMesh* mesh, int worker, int begin, int end);
+
+typedef struct {
+    struct ParticleMesh* mesh;
+    PmStage stage;
+    int worker;
+    int begin, end;
+} PmJob;
+
+struct ParticleMesh {
+    int size;                   // Mesh nodes per side
+    int padded;                 // FFT size per side (twice the mesh, for isolated boundaries)
+    PmAssignment assignment;
+    double split_cells;         // Split radius in cells
+    double cell;                // Node spacing of the last solve
+    double origin_x, origin_y;  // Position of node (0, 0)
+    double kernel_cell;         // Spacing the kernel was built for (0 = none yet)
+    double* kernel;             // Transformed long-range potential (complex, padded^2)
+    double* grid;               // Transform workspace (complex, padded^2)
+    double* density;            // Mass per node, one mesh per worker (size^2 each)
+    double* potential;          // Long-range potential per node (size^2)
+    double* accel_x;            // Long-range acceleration per node (size^2)
+    double* accel_y;
+    double* twiddle;            // exp(-2 pi i k / padded), k < padded / 2 (complex)
+    int* bit_reverse;           // Input order of the in-place FFT
+    double* columns;            // One padded complex column per worker
+    ThreadPool* pool;           // NULL when solving on the calling thread
+    bool owns_pool;             // Created with the mesh (else the caller's)
+    int threads;
+    PmJob* jobs;
+    // Inputs of the stage being run
+    const CelestialBody* bodies;
+    CelestialBody* targets;
+    int body_count;
+    QuadTreeNode* tree;         // Tree of the short-range walk
+    double theta;
+    double* fft_data;           // Grid transformed by the row stage
+    int fft_sign;               // -1 forward, +1 inverse
+};
+
+static void* pm_alloc(size_t bytes) {
+    void* memory = calloc(1, bytes);
+    if (memory == NULL) {
+        fprintf(stderr, "Memory allocation failed for particle mesh\n");
+        exit(EXIT_FAILURE);
+    }
+    return memory;
+}
+
+static void run_job(void* arg) {
+    PmJob* job = (PmJob*)arg;
+    job->stage(job->mesh, job->worker, job->begin, job->end);
+}
+
+// Splits items [0, count) evenly over the workers and waits for all of them
+static void pm_parallel(ParticleMesh* mesh, PmStage stage, int count) {
+    if (mesh->pool == NULL) {
+        stage(mesh, 0, 0, count);
+        return;
+    }
+    for (int w = 0; w < mesh->threads; w++) {
+        PmJob* job = &mesh->jobs[w];
+        job->mesh = mesh;
+        job->stage = stage;
+        job->worker = w;
+        job->begin = (int)((long)count * w / mesh->threads);
+        job->end = (int)((long)count * (w + 1) / mesh->threads);
+        thread_pool_submit(mesh->pool, run_job, job);
+    }
+    thread_pool_wait(mesh->pool);
+}
+
+// In-place complex FFT of padded points
+static void fft(const ParticleMesh* mesh, double* data, int sign) {
+    int n = mesh->padded;
+    for (int i = 0; i < n; i++) {
+        int j = mesh->bit_reverse[i];
+        if (j > i) {
+            double* a = data + 2 * (size_t)i;
+            double* b = data + 2 * (size_t)j;
+            double re = a[0], im = a[1];
+            a[0] = b[0];
+            a[1] = b[1];
+            b[0] = re;
+            b[1] = im;
+        }
+    }
+    for (int length = 2; length <= n; length *= 2) {
+        int half = length / 2;
+        int step = n / length;
+        for (int start = 0; start < n; start += length) {
+            for (int k = 0; k < half; k++) {
+                // The inverse uses the conjugate twiddles
+                double wr = mesh->twiddle[2 * k * step];
+                double wi = sign < 0 ? mesh->twiddle[2 * k * step + 1] : -mesh->twiddle[2 * k * step + 1];
+                double* a = data + 2 * (size_t)(start + k);
+                double* b = data + 2 * (size_t)(start + k + half);
+                double vr = b[0] * wr - b[1] * wi;
+                double vi = b[0] * wi + b[1] * wr;
+                b[0] = a[0] - vr;
+                b[1] = a[1] - vi;
+                a[0] += vr;
+                a[1] += vi;
+            }
+        }
+    }
+}
+
+// Row stage: transforms rows [begin, end) of fft_data
+static void stage_rows(ParticleMesh* mesh, int worker, int begin, int end) {
+    (void)worker;
+    for (int row = begin; row < end; row++) {
+        fft(mesh, mesh->fft_data + 2 * (size_t)row * mesh->padded, mesh->fft_sign);
+    }
+}
+
+// Column stage of the kernel: forward transforms of columns [begin, end)
+static void stage_kernel_columns(ParticleMesh* mesh, int worker, int begin, int end) {
+    double* column = mesh->columns + 2 * (size_t)worker * mesh->padded;
+    int n = mesh->padded;
+    for (int c = begin; c < end; c++) {
+        for (int r = 0; r < n; r++) {
+            column[2 * r] = mesh->kernel[2 * ((size_t)r * n + c)];
+            column[2 * r + 1] = mesh->kernel[2 * ((size_t)r * n + c) + 1];
+        }
+        fft(mesh, column, -1);
+        for (int r = 0; r < n; r++) {
+            mesh->kernel[2 * ((size_t)r * n + c)] = column[2 * r];
+            mesh->kernel[2 * ((size_t)r * n + c) + 1] = column[2 * r + 1];
+        }
+    }
+}
+
+// Column stage of the solve: forward transform, product with the kernel
+// and inverse transform of columns [begin, end), so each column is read
+// and written once
+static void stage_convolve_columns(ParticleMesh* mesh, int worker, int begin, int end) {
+    double* column = mesh->columns + 2 * (size_t)worker * mesh->padded;
+    int n = mesh->padded;
+    for (int c = begin; c < end; c++) {
+        for (int r = 0; r < n; r++) {
+            column[2 * r] = mesh->grid[2 * ((size_t)r * n + c)];
+            column[2 * r + 1] = mesh->grid[2 * ((size_t)r * n + c) + 1];
+        }
+        fft(mesh, column, -1);
+        for (int r = 0; r < n; r++) {
+            const double* k = &mesh->kernel[2 * ((size_t)r * n + c)];
+            double re = column[2 * r] * k[0] - column[2 * r + 1] * k[1];
+            double im = column[2 * r] * k[1] + column[2 * r + 1] * k[0];
+            column[2 * r] = re;
+            column[2 * r + 1] = im;
+        }
+        fft(mesh, column, 1);
+        // Only the first size rows are needed after the inverse
+        for (int r = 0; r < mesh->size; r++) {
+            mesh->grid[2 * ((size_t)r * n + c)] = column[2 * r];
+            mesh->grid[2 * ((size_t)r * n + c) + 1] = column[2 * r + 1];
+        }
+    }
+}
+
+// Assignment weights of position u (in node units) along one axis: the
+// first node and up to three weights
+static int assignment_weights(PmAssignment assignment, double u, double weights[3]) {
+    if (assignment == PM_ASSIGN_CIC) {
+        int first = (int)floor(u);
+        double t = u - first;
+        weights[0] = 1.0 - t;
+        weights[1] = t;
+        weights[2] = 0.0;
+        return first;
+    }
+    int nearest = (int)floor(u + 0.5);
+    double d = u - nearest;
+    weights[0] = 0.5 * (0.5 - d) * (0.5 - d);
+    weights[1] = 0.75 - d * d;
+    weights[2] = 0.5 * (0.5 + d) * (0.5 + d);
+    return nearest - 1;
+}
+
+// Assignment stage: spreads the masses of bodies [begin, end) onto the
+// worker's own density mesh
+static void stage_assign(ParticleMesh* mesh, int worker, int begin, int end) {
+    int size = mesh->size;
+    double* density = mesh->density + (size_t)worker * size * size;
+    memset(density, 0, (size_t)size * size * sizeof(double));
+    for (int i = begin; i < end; i++) {
+        const CelestialBody* body = &mesh->bodies[i];
+        double wx[3], wy[3];
+        int x0 = assignment_weights(mesh->assignment, (body->x - mesh->origin_x) / mesh->cell, wx);
+        int y0 = assignment_weights(mesh->assignment, (body->y - mesh->origin_y) / mesh->cell, wy);
+        for (int b = 0; b < 3; b++) {
+            double* row = density + (size_t)(y0 + b) * size + x0;
+            for (int a = 0; a < 3; a++) {
+                row[a] += body->mass * wy[b] * wx[a];
+            }
+        }
+    }
+}
+
+// Reduction stage: sums the workers' density meshes for padded rows
+// [begin, end) into the transform workspace (zero outside the mesh)
+static void stage_gather(ParticleMesh* mesh, int worker, int begin, int end) {
+    (void)worker;
+    int size = mesh->size, n = mesh->padded;
+    for (int r = begin; r < end; r++) {
+        double* out = mesh->grid + 2 * (size_t)r * n;
+        memset(out, 0, 2 * (size_t)n * sizeof(double));
+        if (r >= size) {
+            continue;
+        }
+        for (int w = 0; w < mesh->threads; w++) {
+            const double* in = mesh->density + ((size_t)w * size + r) * size;
+            for (int c = 0; c < size; c++) {
+                out[2 * c] += in[c];
+            }
+        }
+    }
+}
+
+// Potential stage: normalised real part of the inverse transform for
+// mesh rows [begin, end)
+static void stage_potential(ParticleMesh* mesh, int worker, int begin, int end) {
+    (void)worker;
+    int size = mesh->size, n = mesh->padded;
+    double scale = 1.0 / ((double)n * n);  // Inverse transform normalisation
+    for (int r = begin; r < end; r++) {
+        for (int c = 0; c < size; c++) {
+            mesh->potential[(size_t)r * size + c] = mesh->grid[2 * ((size_t)r * n + c)] * scale;
+        }
+    }
+}
+
+// Gradient stage: accelerations of mesh rows [begin, end) from the
+// potential, by four-point differences (clamped at the empty margin)
+static void stage_gradient(ParticleMesh* mesh, int worker, int begin, int end) {
+    (void)worker;
+    int size = mesh->size;
+    const double* phi = mesh->potential;
+    double inverse = 1.0 / (12.0 * mesh->cell);
+    for (int r = begin; r < end; r++) {
+        int rm2 = r >= 2 ? r - 2 : 0, rm1 = r >= 1 ? r - 1 : 0;
+        int rp1 = r + 1 < size ? r + 1 : size - 1, rp2 = r + 2 < size ? r + 2 : size - 1;
+        for (int c = 0; c < size; c++) {
+            int cm2 = c >= 2 ? c - 2 : 0, cm1 = c >= 1 ? c - 1 : 0;
+            int cp1 = c + 1 < size ? c + 1 : size - 1, cp2 = c + 2 < size ? c + 2 : size - 1;
+            const double* row = phi + (size_t)r * size;
+            double dx = 8.0 * (row[cp1] - row[cm1]) - (row[cp2] - row[cm2]);
+            double dy = 8.0 * (phi[(size_t)rp1 * size + c] - phi[(size_t)rm1 * size + c]) -
+                        (phi[(size_t)rp2 * size + c] - phi[(size_t)rm2 * size + c]);
+            mesh->accel_x[(size_t)r * size + c] = -dx * inverse;
+            mesh->accel_y[(size_t)r * size + c] = -dy * inverse;
+        }
+    }
+}
+
+// Interpolation stage: adds the long-range force to bodies [begin, end)
+static void stage_interpolate(ParticleMesh* mesh, int worker, int begin, int end) {
+    (void)worker;
+    int size = mesh->size;
+    for (int i = begin; i < end; i++) {
+        CelestialBody* body = &mesh->targets[i];
+        double wx[3], wy[3];
+        int x0 = assignment_weights(mesh->assignment, (body->x - mesh->origin_x) / mesh->cell, wx);
+        int y0 = assignment_weights(mesh->assignment, (body->y - mesh->origin_y) / mesh->cell, wy);
+        double ax = 0.0, ay = 0.0;
+        for (int b = 0; b < 3; b++) {
+            size_t row = (size_t)(y0 + b) * size + x0;
+            for (int a = 0; a < 3; a++) {
+                double weight = wy[b] * wx[a];
+                ax += weight * mesh->accel_x[row + a];
+                ay += weight * mesh->accel_y[row + a];
+            }
+        }
+        body->fx += body->mass * ax;
+        body->fy += body->mass * ay;
+    }
+}
+
+// Short-range stage: the tree's share of the force on targets [begin, end)
+static void stage_short_range(ParticleMesh* mesh, int worker, int begin, int end) {
+    (void)worker;
+    double split_radius = particle_mesh_split_radius(mesh);
+    for (int i = begin; i < end; i++) {
+        CelestialBody* body = &mesh->targets[i];
+        body->fx = 0.0;
+        body->fy = 0.0;
+        calculate_short_range_force_from_quadtree(body, mesh->tree, mesh->theta, split_radius, &body->fx,
+                                                  &body->fy);
+    }
+}
+
+// sin(x) / x
+static double sinc(double x) {
+    return fabs(x) < 1e-12 ? 1.0 : sin(x) / x;
+}
+
+// Transforms the long-range potential for the current node spacing and
+// divides out the assignment and interpolation windows
+static void build_kernel(ParticleMesh* mesh) {
+    int n = mesh->padded;
+    double split = mesh->split_cells * mesh->cell;
+    for (int r = 0; r < n; r++) {
+        double dy = (r <= n / 2 ? r : r - n) * mesh->cell;
+        for (int c = 0; c < n; c++) {
+            double dx = (c <= n / 2 ? c : c - n) * mesh->cell;
+            double distance = sqrt(dx * dx + dy * dy);
+            double value = distance > 0.0 ? -G * erf(distance / (2.0 * split)) / distance
+                                           : -G / (split * sqrt(M_PI));
+            mesh->kernel[2 * ((size_t)r * n + c)] = value;
+            mesh->kernel[2 * ((size_t)r * n + c) + 1] = 0.0;
+        }
+    }
+    mesh->fft_data = mesh->kernel;
+    mesh->fft_sign = -1;
+    pm_parallel(mesh, stage_rows, n);
+    pm_parallel(mesh, stage_kernel_columns, n);
+
+    int power = mesh->assignment == PM_ASSIGN_CIC ? 4 : 6;  // Window squared
+    for (int r = 0; r < n; r++) {
+        double wy = sinc(M_PI * (r < n / 2 ? r : r - n) / n);
+        for (int c = 0; c < n; c++) {
+            double wx = sinc(M_PI * (c < n / 2 ? c : c - n) / n);
+            double window = pow(wx * wy, power);
+            mesh->kernel[2 * ((size_t)r * n + c)] /= window;
+            mesh->kernel[2 * ((size_t)r * n + c) + 1] /= window;
+        }
+    }
+    mesh->kernel_cell = mesh->cell;
+}
+
+// Fills the short-range table (once, whichever mesh is created first)
+static void build_short_range_table(void) {
+    SDL_AtomicLock(&short_range_lock);
+    if (!short_range_ready) {
+        for (int i = 0; i <= PM_TABLE_SIZE + 1; i++) {
+            double r = PM_CUTOFF_SPLITS * i / PM_TABLE_SIZE;
+            short_range_table[i] = erfc(0.5 * r) + r / sqrt(M_PI) * exp(-0.25 * r * r);
+        }
+        short_range_ready = true;
+    }
+    SDL_AtomicUnlock(&short_range_lock);
+}
+
+// Share of the pull at r split radii that is left to the tree
+double particle_mesh_short_range(double r) {
+    double position = r * (PM_TABLE_SIZE / PM_CUTOFF_SPLITS);
+    if (position >= PM_TABLE_SIZE) {
+        return 0.0;
+    }
+    int index = (int)position;
+    double t = position - index;
+    return short_range_table[index] + t * (short_range_table[index + 1] - short_range_table[index]);
+}
+
+// Creates a mesh of grid_size x grid_size cells with the split radius
+// split_cells mesh cells wide, solved on pool's workers or, if pool is
+// NULL, on threads workers of its own (0 = one per CPU)
+ParticleMesh* particle_mesh_create(int grid_size, PmAssignment assignment, double split_cells, int threads,
+                                   ThreadPool* pool) {
+    if (grid_size < 32) {
+        grid_size = 32;
+    }
+    int size = 1;
+    while (size < grid_size) {
+        size *= 2;
+    }
+    if (pool) {
+        threads = thread_pool_size(pool);
+    } else if (threads <= 0) {
+        threads = SDL_GetCPUCount();
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    ParticleMesh* mesh = (ParticleMesh*)pm_alloc(sizeof(ParticleMesh));
+    mesh->size = size;
+    mesh->padded = 2 * size;
+    mesh->assignment = assignment;
+    mesh->split_cells = split_cells > 0.0 ? split_cells : PM_SPLIT_CELLS;
+    mesh->threads = threads;
+    int n = mesh->padded;
+    mesh->kernel = (double*)pm_alloc(2 * (size_t)n * n * sizeof(double));
+    mesh->grid = (double*)pm_alloc(2 * (size_t)n * n * sizeof(double));
+    mesh->density = (double*)pm_alloc((size_t)threads * size * size * sizeof(double));
+    mesh->potential = (double*)pm_alloc((size_t)size * size * sizeof(double));
+    mesh->accel_x = (double*)pm_alloc((size_t)size * size * sizeof(double));
+    mesh->accel_y = (double*)pm_alloc((size_t)size * size * sizeof(double));
+    mesh->twiddle = (double*)pm_alloc((size_t)n * sizeof(double));
+    mesh->bit_reverse = (int*)pm_alloc((size_t)n * sizeof(int));
+    mesh->columns = (double*)pm_alloc(2 * (size_t)threads * n * sizeof(double));
+    mesh->jobs = (PmJob*)pm_alloc((size_t)threads * sizeof(PmJob));
+    if (pool) {
+        mesh->pool = threads > 1 ? pool : NULL;
+    } else {
+        mesh->pool = threads > 1 ? thread_pool_create(threads) : NULL;
+        mesh->owns_pool = true;
+    }
+    build_short_range_table();
+
+    for (int k = 0; k < n / 2; k++) {
+        mesh->twiddle[2 * k] = cos(2.0 * M_PI * k / n);
+        mesh->twiddle[2 * k + 1] = -sin(2.0 * M_PI * k / n);
+    }
+    int bits = 0;
+    while ((1 << bits) < n) {
+        bits++;
+    }
+    for (int i = 0; i < n; i++) {
+        int reversed = 0;
+        for (int b = 0; b < bits; b++) {
+            reversed |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        mesh->bit_reverse[i] = reversed;
+    }
+    return mesh;
+}
+
+// Fits the mesh around the bodies, assigns their masses and solves for
+// the long-range accelerations
+void particle_mesh_solve(ParticleMesh* mesh, const CelestialBody bodies[], int body_count) {
+    if (body_count <= 0) {
+        return;
+    }
+
+    // Smallest power-of-two square around the bodies, so the spacing (and
+    // with it the kernel) only changes when the bodies spread or gather
+    // by a factor of two
+    double min_x = bodies[0].x, max_x = bodies[0].x;
+    double min_y = bodies[0].y, max_y = bodies[0].y;
+    for (int i = 1; i < body_count; i++) {
+        min_x = fmin(min_x, bodies[i].x);
+        max_x = fmax(max_x, bodies[i].x);
+        min_y = fmin(min_y, bodies[i].y);
+        max_y = fmax(max_y, bodies[i].y);
+    }
+    double extent = fmax(max_x - min_x, max_y - min_y);
+    double side = exp2(ceil(log2(extent > 1e-6 ? extent : 1e-6)));
+    mesh->cell = side / (mesh->size - 1 - 2 * PM_MARGIN);
+    mesh->origin_x = 0.5 * (min_x + max_x) - 0.5 * (mesh->size - 1) * mesh->cell;
+    mesh->origin_y = 0.5 * (min_y + max_y) - 0.5 * (mesh->size - 1) * mesh->cell;
+    if (mesh->kernel_cell != mesh->cell) {
+        build_kernel(mesh);
+    }
+
+    mesh->bodies = bodies;
+    mesh->body_count = body_count;
+    pm_parallel(mesh, stage_assign, body_count);
+    pm_parallel(mesh, stage_gather, mesh->padded);
+
+    // Rows past the mesh are zero and stay zero after the row transform
+    mesh->fft_data = mesh->grid;
+    mesh->fft_sign = -1;
+    pm_parallel(mesh, stage_rows, mesh->size);
+    pm_parallel(mesh, stage_convolve_columns, mesh->padded);
+    mesh->fft_sign = 1;
+    pm_parallel(mesh, stage_rows, mesh->size);
+
+    pm_parallel(mesh, stage_potential, mesh->size);
+    pm_parallel(mesh, stage_gradient, mesh->size);
+    mesh->bodies = NULL;
+}
+
+// Adds the long-range force of the last solve to fx/fy of every body
+void particle_mesh_add_forces(ParticleMesh* mesh, CelestialBody bodies[], int body_count) {
+    mesh->targets = bodies;
+    pm_parallel(mesh, stage_interpolate, body_count);
+    mesh->targets = NULL;
+}
+
+// Sets fx/fy of every body to the short-range force of the last solve's
+// split from root (centres of mass computed), the walks split across the
+// mesh's workers
+void particle_mesh_short_range_forces(ParticleMesh* mesh, QuadTreeNode* root, double theta,
+                                      CelestialBody bodies[], int body_count) {
+    mesh->targets = bodies;
+    mesh->tree = root;
+    mesh->theta = theta;
+    pm_parallel(mesh, stage_short_range, body_count);
+    mesh->targets = NULL;
+    mesh->tree = NULL;
+}
+
+// Split radius r_s of the last solve in world units
+double particle_mesh_split_radius(const ParticleMesh* mesh) {
+    return mesh->split_cells * mesh->cell;
+}
+
+// Frees the mesh and stops its workers
+void particle_mesh_destroy(ParticleMesh* mesh) {
+    if (mesh == NULL) {
+        return;
+    }
+    if (mesh->owns_pool) {
+        thread_pool_destroy(mesh->pool);
+    }
+    free(mesh->kernel);
+    free(mesh->grid);
+    free(mesh->density);
+    free(mesh->potential);
+    free(mesh->accel_x);
+    free(mesh->accel_y);
+    free(mesh->twiddle);
+    free(mesh->bit_reverse);
+    free(mesh->columns);
+    free(mesh->jobs);
+    free(mesh);
+}
+
+// Short name of an assignment scheme
+const char* particle_mesh_assignment_name(PmAssignment assignment) {
+    return assignment == PM_ASSIGN_CIC ? "cic" : "tsc";
+}
+
+// Parses "cic" or "tsc"; returns 0 on success
+int particle_mesh_parse_assignment(const char* name, PmAssignment* assignment) {
+    if (strcmp(name, "cic") == 0) {
+        *assignment = PM_ASSIGN_CIC;
+    } else if (strcmp(name, "tsc") == 0) {
+        *assignment = PM_ASSIGN_TSC;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// Seconds since start
+static double seconds_since(Uint64 start) {
+    return (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+}
+
+// RMS and largest relative force error of the sampled bodies
+static void force_errors(const CelestialBody bodies[], const int samples[], const double exact[],
+                         int sample_count, double* rms, double* largest) {
+    double sum_sq = 0.0;
+    *largest = 0.0;
+    for (int s = 0; s < sample_count; s++) {
+        const CelestialBody* body = &bodies[samples[s]];
+        double ex = body->fx - exact[2 * s], ey = body->fy - exact[2 * s + 1];
+        double magnitude = sqrt(exact[2 * s] * exact[2 * s] + exact[2 * s + 1] * exact[2 * s + 1]);
+        double error = magnitude > 0.0 ? sqrt(ex * ex + ey * ey) / magnitude : 0.0;
+        sum_sq += error * error;
+        if (error > *largest) {
+            *largest = error;
+        }
+    }
+    *rms = sample_count > 0 ? sqrt(sum_sq / sample_count) : 0.0;
+}
+
+// Builds the tree of the bodies in arena
+static QuadTreeNode* build_report_tree(NodeArena* arena, CelestialBody bodies[], int body_count) {
+    node_arena_reset(arena);
+    QuadTreeNode* root = create_quadtree_in(arena, -SIMULATION_REGION, -SIMULATION_REGION,
+                                            2 * SIMULATION_REGION, 2 * SIMULATION_REGION);
+    for (int i = 0; i < body_count; i++) {
+        insert_body(root, &bodies[i]);
+    }
+    calculate_center_of_mass(root);
+    return root;
+}
+
+// Times the pure tree against TreePM with both assignment schemes on a
+// uniform disk of body_count bodies and prints their force errors against
+// direct summation on a sample
+void particle_mesh_report(int body_count, double theta, int grid_size, double split_cells) {
+    CelestialBody* bodies = (CelestialBody*)pm_alloc((size_t)body_count * sizeof(CelestialBody));
+    Uint32 state = 2463534242u;
+    for (int i = 0; i < body_count; i++) {
+        double u[2];
+        for (int k = 0; k < 2; k++) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            u[k] = state / 4294967296.0;
+        }
+        double radius = PM_REPORT_RADIUS * sqrt(u[0]);  // Uniform over the disk
+        bodies[i].x = radius * cos(2.0 * M_PI * u[1]);
+        bodies[i].y = radius * sin(2.0 * M_PI * u[1]);
+        bodies[i].mass = 1.0 / body_count;
+    }
+
+    // Exact forces on an evenly spaced sample
+    int sample_count = body_count < PM_REPORT_SAMPLES ? body_count : PM_REPORT_SAMPLES;
+    int* samples = (int*)pm_alloc((size_t)sample_count * sizeof(int));
+    double* exact = (double*)pm_alloc(2 * (size_t)sample_count * sizeof(double));
+    for (int s = 0; s < sample_count; s++) {
+        int i = (int)((long)s * body_count / sample_count);
+        samples[s] = i;
+        for (int j = 0; j < body_count; j++) {
+            double dx = bodies[j].x - bodies[i].x, dy = bodies[j].y - bodies[i].y;
+            double distance = sqrt(dx * dx + dy * dy);
+            if (j == i || distance < EPSILON) continue;
+            double magnitude = G * bodies[i].mass * bodies[j].mass / (distance * distance);
+            exact[2 * s] += magnitude * dx / distance;
+            exact[2 * s + 1] += magnitude * dy / distance;
+        }
+    }
+
+    NodeArena arena = {0};
+    double rms, largest;
+
+    // Pure tree, walked by the tree engine on one worker per CPU; the
+    // meshes below solve and walk on the same workers
+    int threads = SDL_GetCPUCount();
+    ThreadPool* pool = threads > 1 ? thread_pool_create(threads) : NULL;
+    ForceWorkspace workspace = {0};
+    Uint64 start = SDL_GetPerformanceCounter();
+    QuadTreeNode* root = build_report_tree(&arena, bodies, body_count);
+    double build = seconds_since(start);
+    start = SDL_GetPerformanceCounter();
+    compute_tree_forces(&workspace, root, bodies, body_count, theta, pool, NULL);
+    double walk = seconds_since(start);
+    force_workspace_free(&workspace);
+    force_errors(bodies, samples, exact, sample_count, &rms, &largest);
+    printf("TreePM report: %d bodies in a uniform disk, theta %.2f, mesh %dx%d, %d threads\n", body_count,
+           theta, grid_size, grid_size, SDL_GetCPUCount());
+    printf("  tree     build %7.1f ms  walk %8.1f ms                  total %8.1f ms  "
+           "error rms %.2e max %.2e\n", build * 1e3, walk * 1e3, (build + walk) * 1e3, rms, largest);
+
+    for (int scheme = 0; scheme < 2; scheme++) {
+        PmAssignment assignment = scheme == 0 ? PM_ASSIGN_CIC : PM_ASSIGN_TSC;
+        ParticleMesh* mesh = particle_mesh_create(grid_size, assignment, split_cells, 1, pool);
+        particle_mesh_solve(mesh, bodies, body_count);  // Builds the kernel outside the timing
+
+        start = SDL_GetPerformanceCounter();
+        root = build_report_tree(&arena, bodies, body_count);
+        build = seconds_since(start);
+        start = SDL_GetPerformanceCounter();
+        particle_mesh_solve(mesh, bodies, body_count);
+        double solve = seconds_since(start);
+        double split = particle_mesh_split_radius(mesh);
+        start = SDL_GetPerformanceCounter();
+        particle_mesh_short_range_forces(mesh, root, theta, bodies, body_count);
+        walk = seconds_since(start);
+        start = SDL_GetPerformanceCounter();
+        particle_mesh_add_forces(mesh, bodies, body_count);
+        solve += seconds_since(start);
+        force_errors(bodies, samples, exact, sample_count, &rms, &largest);
+        printf("  treepm %s build %7.1f ms  walk %8.1f ms  mesh %7.1f ms  total %8.1f ms  "
+               "error rms %.2e max %.2e  (r_s %.3g, cutoff %.3g)\n",
+               particle_mesh_assignment_name(assignment), build * 1e3, walk * 1e3, solve * 1e3,
+               (build + walk + solve) * 1e3, rms, largest, split, PM_CUTOFF_SPLITS * split);
+        particle_mesh_destroy(mesh);
+    }
+
+    thread_pool_destroy(pool);
+    node_arena_free(&arena);
+    free(samples);
+    free(exact);
+    free(bodies);
+}
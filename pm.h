@@ -0,0 +1,77 @@
+#ifndef PM_H
+#define PM_H
+
+#include "simulation.h"
+#include "thread_pool.h"
+
+// Long-range half of the TreePM force. The 1/r potential is split at a
+// scale r_s into
+//     short: erfc(r / 2r_s) / r    (left to the quadtree, cut off at PM_CUTOFF_SPLITS r_s)
+//     long:  erf(r / 2r_s) / r     (smooth, solved on a mesh)
+// Every step the masses are spread onto a square mesh around the bodies
+// (cloud-in-cell or triangular-shaped-cloud), convolved with the
+// long-range potential by FFT on a zero-padded mesh (so distant images do
+// not pull), differentiated, and the accelerations interpolated back with
+// the same weights. The bodies pull as 1/r^2 in the plane, so the mesh
+// convolves with that Green's function instead of solving the 2D Poisson
+// equation (whose 1/r force is a different law). All stages are split
+// across the mesh's workers: the caller's pool, or threads of its own.
+
+// Short-range interactions are dropped beyond this many split radii
+// (erfc(2.25) is below 0.2%)
+#define PM_CUTOFF_SPLITS 4.5
+
+// Split radius in mesh cells; smaller moves more of the force onto the
+// mesh but makes its interpolation error larger
+#define PM_SPLIT_CELLS 1.25
+
+typedef enum {
+    PM_ASSIGN_CIC,  // Cloud in cell: 2x2 cells, linear weights
+    PM_ASSIGN_TSC   // Triangular-shaped cloud: 3x3 cells, quadratic weights (smoother)
+} PmAssignment;
+
+typedef struct ParticleMesh ParticleMesh;
+
+// Creates a mesh of grid_size x grid_size cells (a power of two, at least
+// 32) with the split radius split_cells mesh cells wide (0 = the default),
+// solved on pool's workers (not owned) or, if pool is NULL, on threads
+// workers of its own (0 = one per CPU)
+ParticleMesh* particle_mesh_create(int grid_size, PmAssignment assignment, double split_cells, int threads,
+                                   ThreadPool* pool);
+
+// Fits the mesh around the bodies, assigns their masses and solves for
+// the long-range accelerations
+void particle_mesh_solve(ParticleMesh* mesh, const CelestialBody bodies[], int body_count);
+
+// Sets fx/fy of every body to the short-range force of the last solve's
+// split from root (centres of mass computed), the walks split across the
+// mesh's workers
+void particle_mesh_short_range_forces(ParticleMesh* mesh, QuadTreeNode* root, double theta,
+                                      CelestialBody bodies[], int body_count);
+
+// Adds the long-range force of the last solve to fx/fy of every body
+void particle_mesh_add_forces(ParticleMesh* mesh, CelestialBody bodies[], int body_count);
+
+// Share of the pull at r split radii that is left to the tree:
+// erfc(r / 2) + r / sqrt(pi) * exp(-r^2 / 4), tabulated, and zero beyond
+// the cutoff
+double particle_mesh_short_range(double r);
+
+// Split radius r_s of the last solve in world units
+double particle_mesh_split_radius(const ParticleMesh* mesh);
+
+// Frees the mesh and stops its workers
+void particle_mesh_destroy(ParticleMesh* mesh);
+
+// Short name of an assignment scheme
+const char* particle_mesh_assignment_name(PmAssignment assignment);
+
+// Parses "cic" or "tsc"; returns 0 on success
+int particle_mesh_parse_assignment(const char* name, PmAssignment* assignment);
+
+// Times the pure tree against TreePM with both assignment schemes on a
+// uniform disk of body_count bodies and prints their force errors against
+// direct summation on a sample
+void particle_mesh_report(int body_count, double theta, int grid_size, double split_cells);
+
+#endif
@@ -0,0 +1,239 @@
+#include <stdlib.h>
+#include <math.h>
+#include <stdbool.h>
+
+#include "simulation.h"
+#include "thread_pool.h"
+#include "query.h"
+
+// Most workers one batch is split across
+#define QUERY_MAX_WORKERS 64
+
+// State of one nearest-neighbour search; results are kept sorted
+typedef struct {
+    double x, y;
+    const CelestialBody* exclude;
+    CelestialBody** results;
+    int max_results;
+    int count;
+} NearestSearch;
+
+// Squared distance from a point to a body
+static double body_distance_squared(const CelestialBody* body, double x, double y) {
+    double dx = body->x - x;
+    double dy = body->y - y;
+    return dx * dx + dy * dy;
+}
+
+// Squared distance from a point to a node's cell (zero inside it)
+static double cell_distance_squared(const QuadTreeNode* node, double x, double y) {
+    double dx = fmax(0.0, fmax(node->x - x, x - (node->x + node->width)));
+    double dy = fmax(0.0, fmax(node->y - y, y - (node->y + node->height)));
+    return dx * dx + dy * dy;
+}
+
+// Squared distance beyond which nothing can enter the results any more
+static double nearest_bound(const NearestSearch* search) {
+    if (search->count < search->max_results) {
+        return INFINITY;
+    }
+    return body_distance_squared(search->results[search->count - 1], search->x, search->y);
+}
+
+// Inserts a body into the sorted results if it is near enough
+static void nearest_offer(NearestSearch* search, CelestialBody* body) {
+    double distance_squared = body_distance_squared(body, search->x, search->y);
+    if (distance_squared >= nearest_bound(search)) {
+        return;
+    }
+    int slot = search->count < search->max_results ? search->count++ : search->count - 1;
+    while (slot > 0 && body_distance_squared(search->results[slot - 1], search->x, search->y) > distance_squared) {
+        search->results[slot] = search->results[slot - 1];
+        slot--;
+    }
+    search->results[slot] = body;
+}
+
+// Visits the children nearest-first and skips every cell farther away
+// than the current k-th answer
+static void nearest_visit(NearestSearch* search, QuadTreeNode* node) {
+    if (node == NULL || node->body_count == 0 ||
+        cell_distance_squared(node, search->x, search->y) >= nearest_bound(search)) {
+        return;
+    }
+    if (node->nw == NULL) {
+        if (node->body != NULL && node->body != search->exclude) {
+            nearest_offer(search, node->body);
+        }
+        return;
+    }
+
+    QuadTreeNode* children[4] = {node->nw, node->ne, node->sw, node->se};
+    double distances[4];
+    for (int c = 0; c < 4; c++) {
+        distances[c] = cell_distance_squared(children[c], search->x, search->y);
+    }
+    for (int c = 1; c < 4; c++) {
+        for (int d = c; d > 0 && distances[d] < distances[d - 1]; d--) {
+            double distance = distances[d];
+            distances[d] = distances[d - 1];
+            distances[d - 1] = distance;
+            QuadTreeNode* child = children[d];
+            children[d] = children[d - 1];
+            children[d - 1] = child;
+        }
+    }
+    for (int c = 0; c < 4; c++) {
+        nearest_visit(search, children[c]);
+    }
+}
+
+// The max_results bodies nearest to (x, y), nearest first, other than
+// exclude; returns how many were found. distances may be NULL.
+int quadtree_nearest(QuadTreeNode* root, double x, double y, const CelestialBody* exclude,
+                     CelestialBody* results[], double distances[], int max_results) {
+    if (max_results <= 0) {
+        return 0;
+    }
+    NearestSearch search = {x, y, exclude, results, max_results, 0};
+    nearest_visit(&search, root);
+    if (distances) {
+        for (int i = 0; i < search.count; i++) {
+            distances[i] = sqrt(body_distance_squared(results[i], x, y));
+        }
+    }
+    return search.count;
+}
+
+// Collects the bodies within the radius from the cells that reach it
+static int radius_visit(QuadTreeNode* node, double x, double y, double radius_squared,
+                        const CelestialBody* exclude, CelestialBody* results[], int max_results) {
+    if (node == NULL || max_results <= 0 || node->body_count == 0 ||
+        cell_distance_squared(node, x, y) > radius_squared) {
+        return 0;
+    }
+    if (node->nw == NULL) {
+        CelestialBody* body = node->body;
+        if (body != NULL && body != exclude && body_distance_squared(body, x, y) <= radius_squared) {
+            results[0] = body;
+            return 1;
+        }
+        return 0;
+    }
+    int count = 0;
+    count += radius_visit(node->nw, x, y, radius_squared, exclude, results + count, max_results - count);
+    count += radius_visit(node->ne, x, y, radius_squared, exclude, results + count, max_results - count);
+    count += radius_visit(node->sw, x, y, radius_squared, exclude, results + count, max_results - count);
+    count += radius_visit(node->se, x, y, radius_squared, exclude, results + count, max_results - count);
+    return count;
+}
+
+// Bodies within radius of (x, y) other than exclude, in tree order;
+// returns how many were written (at most max_results). distances may be
+// NULL.
+int quadtree_within_radius(QuadTreeNode* root, double x, double y, double radius,
+                           const CelestialBody* exclude, CelestialBody* results[], double distances[],
+                           int max_results) {
+    int count = radius_visit(root, x, y, radius * radius, exclude, results, max_results);
+    if (distances) {
+        for (int i = 0; i < count; i++) {
+            distances[i] = sqrt(body_distance_squared(results[i], x, y));
+        }
+    }
+    return count;
+}
+
+// Bodies inside [min_x, max_x] x [min_y, max_y] other than exclude, in
+// tree order; returns how many were written (at most max_results)
+int quadtree_within_rect(QuadTreeNode* node, double min_x, double min_y, double max_x, double max_y,
+                         const CelestialBody* exclude, CelestialBody* results[], int max_results) {
+    if (node == NULL || max_results <= 0 || node->body_count == 0 ||
+        node->x > max_x || node->x + node->width < min_x ||
+        node->y > max_y || node->y + node->height < min_y) {
+        return 0;
+    }
+    if (node->nw == NULL) {
+        CelestialBody* body = node->body;
+        if (body != NULL && body != exclude && body->x >= min_x && body->x <= max_x &&
+            body->y >= min_y && body->y <= max_y) {
+            results[0] = body;
+            return 1;
+        }
+        return 0;
+    }
+    int count = 0;
+    count += quadtree_within_rect(node->nw, min_x, min_y, max_x, max_y, exclude, results + count,
+                                  max_results - count);
+    count += quadtree_within_rect(node->ne, min_x, min_y, max_x, max_y, exclude, results + count,
+                                  max_results - count);
+    count += quadtree_within_rect(node->sw, min_x, min_y, max_x, max_y, exclude, results + count,
+                                  max_results - count);
+    count += quadtree_within_rect(node->se, min_x, min_y, max_x, max_y, exclude, results + count,
+                                  max_results - count);
+    return count;
+}
+
+// Answers one query of a batch
+static void run_query(QuadTreeNode* root, SpatialQuery* query) {
+    switch (query->kind) {
+        case QUERY_NEAREST:
+            query->count = quadtree_nearest(root, query->x, query->y, query->exclude, query->results,
+                                            query->distances, query->max_results);
+            break;
+        case QUERY_RADIUS:
+            query->count = quadtree_within_radius(root, query->x, query->y, query->radius, query->exclude,
+                                                  query->results, query->distances, query->max_results);
+            break;
+        case QUERY_RECT:
+            query->count = quadtree_within_rect(root, query->x, query->y, query->max_x, query->max_y,
+                                                query->exclude, query->results, query->max_results);
+            break;
+    }
+}
+
+// One worker's share of a batch: queries [first, last)
+typedef struct {
+    QuadTreeNode* root;
+    SpatialQuery* queries;
+    int first, last;
+} QueryTask;
+
+static void run_query_task(void* arg) {
+    QueryTask* task = (QueryTask*)arg;
+    for (int q = task->first; q < task->last; q++) {
+        run_query(task->root, &task->queries[q]);
+    }
+}
+
+// Runs every query of a batch, split into contiguous ranges across pool's
+// workers (NULL = this thread), filling in each query's answers and count
+void quadtree_query_batch(QuadTreeNode* root, SpatialQuery queries[], int query_count, ThreadPool* pool) {
+    int workers = pool ? thread_pool_size(pool) : 1;
+    if (workers > QUERY_MAX_WORKERS) {
+        workers = QUERY_MAX_WORKERS;
+    }
+    if (workers > query_count) {
+        workers = query_count;
+    }
+    if (workers < 1) {
+        workers = 1;
+    }
+
+    // Consecutive queries usually ask about nearby points, so contiguous
+    // ranges keep each worker in one part of the tree
+    QueryTask tasks[QUERY_MAX_WORKERS];
+    for (int w = 0; w < workers; w++) {
+        tasks[w].root = root;
+        tasks[w].queries = queries;
+        tasks[w].first = (int)((long)query_count * w / workers);
+        tasks[w].last = (int)((long)query_count * (w + 1) / workers);
+    }
+    if (workers == 1) {
+        run_query_task(&tasks[0]);
+        return;
+    }
+    for (int w = 0; w < workers; w++) {
+        thread_pool_submit(pool, run_query_task, &tasks[w]);
+    }
+    thread_pool_wait(pool);
+}
@@ -0,0 +1,55 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include "simulation.h"
+#include "thread_pool.h"
+
+// Spatial queries on a finished quadtree (centres of mass calculated, which
+// also sets every node's body count). Only cells that can hold an answer
+// are opened, so a query costs about the depth of the tree plus the bodies
+// it returns instead of a scan over all bodies. Queries only read the
+// tree, so any number can run at once; bodies outside the tree's region
+// are never found.
+
+typedef enum {
+    QUERY_NEAREST,  // The k bodies nearest to a point, nearest first
+    QUERY_RADIUS,   // Bodies within a radius of a point
+    QUERY_RECT      // Bodies inside a rectangle
+} QueryKind;
+
+// One query of a batch, with room for its answers
+typedef struct {
+    QueryKind kind;
+    double x, y;                  // Point (nearest, radius) or lower corner (rect)
+    double max_x, max_y;          // Upper corner (rect)
+    double radius;                // Search radius (radius)
+    const CelestialBody* exclude; // Body never returned, e.g. the one asking (may be NULL)
+    CelestialBody** results;      // Room for max_results answers
+    double* distances;            // Distance of each answer from the point (nearest, radius; may be NULL)
+    int max_results;              // k for nearest queries
+    int count;                    // Answers written
+} SpatialQuery;
+
+// The max_results bodies nearest to (x, y), nearest first, other than
+// exclude; returns how many were found. distances may be NULL.
+int quadtree_nearest(QuadTreeNode* root, double x, double y, const CelestialBody* exclude,
+                     CelestialBody* results[], double distances[], int max_results);
+
+// Bodies within radius of (x, y) other than exclude, in tree order;
+// returns how many were written (at most max_results). distances may be
+// NULL.
+int quadtree_within_radius(QuadTreeNode* root, double x, double y, double radius,
+                           const CelestialBody* exclude, CelestialBody* results[], double distances[],
+                           int max_results);
+
+// Bodies inside [min_x, max_x] x [min_y, max_y] other than exclude, in
+// tree order; returns how many were written (at most max_results).
+// exclude may be NULL, as for the renderer's viewport query.
+int quadtree_within_rect(QuadTreeNode* root, double min_x, double min_y, double max_x, double max_y,
+                         const CelestialBody* exclude, CelestialBody* results[], int max_results);
+
+// Runs every query of a batch, split into contiguous ranges across pool's
+// workers (NULL = this thread), filling in each query's answers and count
+void quadtree_query_batch(QuadTreeNode* root, SpatialQuery queries[], int query_count, ThreadPool* pool);
+
+#endif
@@ -0,0 +1,380 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+
+#include "recorder.h"
+#include "thread_pool.h"
+
+// Extra frame buffers beyond one per encoder thread, so the render stage
+// always has a buffer to draw into while every worker is busy
+#define EXTRA_FRAME_SLOTS 2
+
+// Largest payload of a stored (uncompressed) deflate block
+#define DEFLATE_MAX_STORED 65535
+
+// A preallocated frame buffer with its own software renderer
+typedef struct {
+    FrameRecorder* owner;
+    SDL_Surface* surface;        // ARGB8888 pixels written by the renderer
+    SDL_Renderer* renderer;      // Software renderer targeting the surface
+    Uint8* scratch;              // Per-slot row buffer used while encoding
+    long index;                  // Sequence number of the frame in the slot
+    bool busy;                   // Owned by the render stage or an encoder
+} FrameSlot;
+
+struct FrameRecorder {
+    char out_dir[512];
+    int width, height;
+    RecordFormat format;
+    ThreadPool* pool;            // Encoder threads
+    FrameSlot* slots;
+    int num_slots;
+    FrameSlot* current;          // Slot between begin_frame and end_frame
+    long next_index;             // Sequence number of the next recorded frame
+    long frames_written;
+    long frames_dropped;
+    long write_errors;
+    SDL_mutex* lock;             // Protects busy flags and counters
+};
+
+// ***********************
+// PNG encoding
+// ***********************
+
+static Uint32 crc_table[256];
+
+// Builds the CRC-32 lookup table used for PNG chunks
+static void init_crc_table(void) {
+    for (Uint32 n = 0; n < 256; n++) {
+        Uint32 c = n;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[n] = c;
+    }
+}
+
+static Uint32 crc_update(Uint32 crc, const Uint8* data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+// Streams the zlib payload of a single IDAT chunk as stored deflate blocks
+typedef struct {
+    FILE* file;
+    Uint32 crc;                  // Running CRC of the IDAT chunk
+    Uint32 adler_a, adler_b;     // Running Adler-32 of the raw image data
+    size_t block_left;           // Bytes left in the current stored block
+    size_t total_left;           // Raw bytes left in the whole stream
+} PngStream;
+
+// Writes bytes that belong to the IDAT chunk, updating its CRC
+static void png_emit(PngStream* stream, const Uint8* data, size_t len) {
+    fwrite(data, 1, len, stream->file);
+    stream->crc = crc_update(stream->crc, data, len);
+}
+
+static void write_be32(FILE* file, Uint32 value) {
+    Uint8 bytes[4] = { value >> 24, (value >> 16) & 0xFF, (value >> 8) & 0xFF, value & 0xFF };
+    fwrite(bytes, 1, 4, file);
+}
+
+// Appends raw (filtered) image bytes to the stream
+static void png_put(PngStream* stream, const Uint8* data, size_t len) {
+    while (len > 0) {
+        if (stream->block_left == 0) {
+            // Start a new stored block
+            size_t n = stream->total_left < DEFLATE_MAX_STORED ? stream->total_left : DEFLATE_MAX_STORED;
+            Uint8 header[5] = {
+                stream->total_left <= DEFLATE_MAX_STORED ? 1 : 0,  // BFINAL, BTYPE=00
+                n & 0xFF, (n >> 8) & 0xFF, ~n & 0xFF, (~n >> 8) & 0xFF
+            };
+            png_emit(stream, header, sizeof(header));
+            stream->block_left = n;
+        }
+
+        size_t chunk = len < stream->block_left ? len : stream->block_left;
+        png_emit(stream, data, chunk);
+
+        // Adler-32 over the raw bytes (reduce at most every 5552 bytes)
+        for (size_t done = 0; done < chunk; ) {
+            size_t run = chunk - done < 5552 ? chunk - done : 5552;
+            for (size_t i = 0; i < run; i++) {
+                stream->adler_a += data[done + i];
+                stream->adler_b += stream->adler_a;
+            }
+            stream->adler_a %= 65521;
+            stream->adler_b %= 65521;
+            done += run;
+        }
+
+        data += chunk;
+        len -= chunk;
+        stream->block_left -= chunk;
+        stream->total_left -= chunk;
+    }
+}
+
+// Writes the slot's surface as an 8-bit RGB PNG
+static bool write_png(FrameSlot* slot, FILE* file) {
+    int w = slot->surface->w;
+    int h = slot->surface->h;
+    size_t row_bytes = 1 + 3 * (size_t)w;        // Filter byte + RGB
+    size_t raw_bytes = row_bytes * h;
+    size_t num_blocks = (raw_bytes + DEFLATE_MAX_STORED - 1) / DEFLATE_MAX_STORED;
+
+    static const Uint8 signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    fwrite(signature, 1, sizeof(signature), file);
+
+    // IHDR: width, height, bit depth 8, color type 2 (RGB), default methods
+    Uint8 ihdr[17] = { 'I', 'H', 'D', 'R',
+                       w >> 24, (w >> 16) & 0xFF, (w >> 8) & 0xFF, w & 0xFF,
+                       h >> 24, (h >> 16) & 0xFF, (h >> 8) & 0xFF, h & 0xFF,
+                       8, 2, 0, 0, 0 };
+    write_be32(file, 13);
+    fwrite(ihdr, 1, sizeof(ihdr), file);
+    write_be32(file, crc_update(0xFFFFFFFFu, ihdr, sizeof(ihdr)) ^ 0xFFFFFFFFu);
+
+    // IDAT: zlib header + stored blocks + Adler-32
+    PngStream stream = { file, 0xFFFFFFFFu, 1, 0, 0, raw_bytes };
+    write_be32(file, (Uint32)(2 + num_blocks * 5 + raw_bytes + 4));
+    static const Uint8 idat_type[4] = { 'I', 'D', 'A', 'T' };
+    png_emit(&stream, idat_type, sizeof(idat_type));
+    static const Uint8 zlib_header[2] = { 0x78, 0x01 };
+    png_emit(&stream, zlib_header, sizeof(zlib_header));
+
+    Uint8* row = slot->scratch;
+    for (int y = 0; y < h; y++) {
+        const Uint32* pixels = (const Uint32*)((const Uint8*)slot->surface->pixels + y * slot->surface->pitch);
+        row[0] = 0;  // Filter type: none
+        for (int x = 0; x < w; x++) {
+            row[1 + 3 * x] = (pixels[x] >> 16) & 0xFF;
+            row[2 + 3 * x] = (pixels[x] >> 8) & 0xFF;
+            row[3 + 3 * x] = pixels[x] & 0xFF;
+        }
+        png_put(&stream, row, row_bytes);
+    }
+
+    Uint32 adler = (stream.adler_b << 16) | stream.adler_a;
+    Uint8 adler_bytes[4] = { adler >> 24, (adler >> 16) & 0xFF, (adler >> 8) & 0xFF, adler & 0xFF };
+    png_emit(&stream, adler_bytes, sizeof(adler_bytes));
+    write_be32(file, stream.crc ^ 0xFFFFFFFFu);
+
+    // IEND
+    static const Uint8 iend[4] = { 'I', 'E', 'N', 'D' };
+    write_be32(file, 0);
+    fwrite(iend, 1, sizeof(iend), file);
+    write_be32(file, crc_update(0xFFFFFFFFu, iend, sizeof(iend)) ^ 0xFFFFFFFFu);
+
+    return !ferror(file);
+}
+
+// ***********************
+// YUV encoding
+// ***********************
+
+// Writes the slot's surface as planar I420 (full-res Y, 2x2-averaged U and V)
+static bool write_yuv(FrameSlot* slot, FILE* file) {
+    int w = slot->surface->w;
+    int h = slot->surface->h;
+    int pitch = slot->surface->pitch;
+    const Uint8* base = (const Uint8*)slot->surface->pixels;
+    Uint8* row = slot->scratch;
+
+    // Luma plane
+    for (int y = 0; y < h; y++) {
+        const Uint32* pixels = (const Uint32*)(base + y * pitch);
+        for (int x = 0; x < w; x++) {
+            int r = (pixels[x] >> 16) & 0xFF;
+            int g = (pixels[x] >> 8) & 0xFF;
+            int b = pixels[x] & 0xFF;
+            row[x] = (Uint8)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+        }
+        fwrite(row, 1, w, file);
+    }
+
+    // Chroma planes: U first, then V
+    for (int plane = 0; plane < 2; plane++) {
+        for (int y = 0; y < h; y += 2) {
+            const Uint32* top = (const Uint32*)(base + y * pitch);
+            const Uint32* bottom = (const Uint32*)(base + (y + 1) * pitch);
+            for (int x = 0; x < w; x += 2) {
+                Uint32 quad[4] = { top[x], top[x + 1], bottom[x], bottom[x + 1] };
+                int r = 0, g = 0, b = 0;
+                for (int k = 0; k < 4; k++) {
+                    r += (quad[k] >> 16) & 0xFF;
+                    g += (quad[k] >> 8) & 0xFF;
+                    b += quad[k] & 0xFF;
+                }
+                r /= 4;
+                g /= 4;
+                b /= 4;
+                if (plane == 0) {
+                    row[x / 2] = (Uint8)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+                } else {
+                    row[x / 2] = (Uint8)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+                }
+            }
+            fwrite(row, 1, w / 2, file);
+        }
+    }
+
+    return !ferror(file);
+}
+
+// ***********************
+// Encoder task and recorder API
+// ***********************
+
+// Runs on an encoder thread: writes one frame and releases its slot
+static void encode_frame_task(void* arg) {
+    FrameSlot* slot = (FrameSlot*)arg;
+    FrameRecorder* recorder = slot->owner;
+
+    char path[600];
+    const char* extension = recorder->format == RECORD_FORMAT_PNG ? "png" : "yuv";
+    snprintf(path, sizeof(path), "%s/frame_%06ld.%s", recorder->out_dir, slot->index, extension);
+
+    bool ok = false;
+    FILE* file = fopen(path, "wb");
+    if (file) {
+        ok = recorder->format == RECORD_FORMAT_PNG ? write_png(slot, file) : write_yuv(slot, file);
+        if (fclose(file) != 0) {
+            ok = false;
+        }
+    }
+
+    SDL_LockMutex(recorder->lock);
+    if (ok) {
+        recorder->frames_written++;
+    } else {
+        if (recorder->write_errors == 0) {
+            fprintf(stderr, "Failed to write recorded frame %s\n", path);
+        }
+        recorder->write_errors++;
+    }
+    slot->busy = false;
+    SDL_UnlockMutex(recorder->lock);
+}
+
+// Creates the recorder, its frame buffers and its encoder threads
+FrameRecorder* recorder_create(const char* out_dir, int width, int height,
+                               RecordFormat format, int num_workers) {
+    if (width <= 0 || height <= 0 || (format == RECORD_FORMAT_YUV && (width % 2 || height % 2))) {
+        fprintf(stderr, "Invalid recording size %dx%d\n", width, height);
+        return NULL;
+    }
+    if (num_workers < 1) {
+        num_workers = 1;
+    }
+
+    FrameRecorder* recorder = (FrameRecorder*)calloc(1, sizeof(FrameRecorder));
+    if (recorder == NULL) {
+        fprintf(stderr, "Memory allocation failed for frame recorder\n");
+        exit(EXIT_FAILURE);
+    }
+
+    snprintf(recorder->out_dir, sizeof(recorder->out_dir), "%s", out_dir);
+    recorder->width = width;
+    recorder->height = height;
+    recorder->format = format;
+    recorder->lock = SDL_CreateMutex();
+    init_crc_table();
+
+    recorder->num_slots = num_workers + EXTRA_FRAME_SLOTS;
+    recorder->slots = (FrameSlot*)calloc(recorder->num_slots, sizeof(FrameSlot));
+    if (recorder->slots == NULL) {
+        fprintf(stderr, "Memory allocation failed for frame buffers\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < recorder->num_slots; i++) {
+        FrameSlot* slot = &recorder->slots[i];
+        slot->owner = recorder;
+        slot->surface = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_ARGB8888);
+        slot->renderer = slot->surface ? SDL_CreateSoftwareRenderer(slot->surface) : NULL;
+        slot->scratch = (Uint8*)malloc(1 + 3 * (size_t)width);
+        if (slot->surface == NULL || slot->renderer == NULL || slot->scratch == NULL) {
+            fprintf(stderr, "Frame buffer creation failed: %s\n", SDL_GetError());
+            recorder->num_slots = i + 1;
+            recorder_destroy(recorder);
+            return NULL;
+        }
+    }
+
+    recorder->pool = thread_pool_create(num_workers);
+    return recorder;
+}
+
+// Claims a free frame buffer and returns a renderer drawing into it
+SDL_Renderer* recorder_begin_frame(FrameRecorder* recorder) {
+    SDL_LockMutex(recorder->lock);
+    recorder->current = NULL;
+    for (int i = 0; i < recorder->num_slots; i++) {
+        if (!recorder->slots[i].busy) {
+            recorder->current = &recorder->slots[i];
+            recorder->current->busy = true;
+            break;
+        }
+    }
+    if (recorder->current == NULL) {
+        recorder->frames_dropped++;
+    }
+    SDL_UnlockMutex(recorder->lock);
+
+    return recorder->current ? recorder->current->renderer : NULL;
+}
+
+// Submits the current frame buffer to the encoder threads
+void recorder_end_frame(FrameRecorder* recorder) {
+    FrameSlot* slot = recorder->current;
+    if (slot == NULL) {
+        return;
+    }
+    recorder->current = NULL;
+
+    // Frame numbers only count frames that are actually encoded, so the
+    // output sequence has no gaps
+    slot->index = recorder->next_index++;
+    thread_pool_submit(recorder->pool, encode_frame_task, slot);
+}
+
+// Parses a record format name
+int recorder_parse_format(const char* name, RecordFormat* format) {
+    if (strcmp(name, "png") == 0) {
+        *format = RECORD_FORMAT_PNG;
+    } else if (strcmp(name, "yuv") == 0) {
+        *format = RECORD_FORMAT_YUV;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// Waits for pending frames and frees the recorder
+void recorder_destroy(FrameRecorder* recorder) {
+    if (recorder == NULL) {
+        return;
+    }
+
+    // Joining the pool finishes every queued frame
+    thread_pool_destroy(recorder->pool);
+    printf("Recorded %ld frames to %s (%ld dropped, %ld write errors)\n",
+           recorder->frames_written, recorder->out_dir,
+           recorder->frames_dropped, recorder->write_errors);
+
+    for (int i = 0; i < recorder->num_slots; i++) {
+        FrameSlot* slot = &recorder->slots[i];
+        if (slot->renderer) SDL_DestroyRenderer(slot->renderer);
+        if (slot->surface) SDL_FreeSurface(slot->surface);
+        free(slot->scratch);
+    }
+
+    free(recorder->slots);
+    SDL_DestroyMutex(recorder->lock);
+    free(recorder);
+}
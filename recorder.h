@@ -0,0 +1,39 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <SDL2/SDL.h>
+
+// Offscreen frame recorder. Frames are drawn with an SDL software renderer
+// straight into one of a small set of preallocated surfaces; the surface is
+// then handed to an encoder thread as-is (no copy) and returned to the free
+// set once it has been written. If every surface is still being encoded the
+// frame is dropped instead of stalling the simulation.
+typedef struct FrameRecorder FrameRecorder;
+
+// Output format of recorded frames (one file per frame)
+typedef enum {
+    RECORD_FORMAT_PNG,   // RGB PNG (stored deflate blocks, no zlib needed)
+    RECORD_FORMAT_YUV    // Raw planar YUV 4:2:0 (I420), BT.601 limited range
+} RecordFormat;
+
+// Creates a recorder writing width x height frames into out_dir using
+// num_workers encoder threads. Width and height must be even for YUV output.
+FrameRecorder* recorder_create(const char* out_dir, int width, int height,
+                               RecordFormat format, int num_workers);
+
+// Returns a renderer drawing into a free frame buffer, or NULL if all buffers
+// are busy (the frame is counted as dropped). Must be followed by
+// recorder_end_frame() when non-NULL.
+SDL_Renderer* recorder_begin_frame(FrameRecorder* recorder);
+
+// Hands the frame started by recorder_begin_frame() to the encoder threads
+void recorder_end_frame(FrameRecorder* recorder);
+
+// Parses "png" or "yuv"; returns 0 on success
+int recorder_parse_format(const char* name, RecordFormat* format);
+
+// Waits for pending frames to be written, prints a summary and frees the
+// recorder
+void recorder_destroy(FrameRecorder* recorder);
+
+#endif
@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "simulation.h"
+#include "thread_pool.h"
+#include "removal.h"
+
+// Most workers one pass is split across
+#define REMOVAL_MAX_WORKERS 64
+
+// Bodies per worker below which the pool is not worth waking
+#define REMOVAL_MIN_RANGE 4096
+
+static const char* reason_names[REMOVAL_REASONS] = {"Escaped", "Absorbed", "Collided"};
+
+// One worker's range [first, last) of both passes
+typedef struct {
+    const RemovalRules* rules;
+    const CelestialBody* bodies;
+    CelestialBody* out;
+    RemovalWorkspace* workspace;
+    int first, last;
+    int kept;         // Survivors in the range (flag pass)
+    int kept_before;  // Survivors in the ranges before it (copy pass)
+} RemovalTask;
+
+// Flag pass: marks the bodies of the range to remove and counts the rest
+static void flag_range(void* arg) {
+    RemovalTask* task = (RemovalTask*)arg;
+    const RemovalRules* rules = task->rules;
+    const CelestialBody* bodies = task->bodies;
+    int* flags = task->workspace->flags;
+    int kept = 0;
+    for (int i = task->first; i < task->last; i++) {
+        int flag = 0;
+        if (i >= rules->massive_count) {
+            const CelestialBody* body = &bodies[i];
+            // Written so a NaN position counts as outside
+            if (!(body->x >= -rules->region && body->x <= rules->region &&
+                  body->y >= -rules->region && body->y <= rules->region)) {
+                flag = -1;
+            } else {
+                for (int m = 0; m < rules->massive_count; m++) {
+                    double dx = body->x - bodies[m].x;
+                    double dy = body->y - bodies[m].y;
+                    double r = rules->capture_radius[m];
+                    if (dx * dx + dy * dy < r * r) {
+                        flag = 1 + m;
+                        break;
+                    }
+                }
+            }
+        }
+        flags[i] = flag;
+        kept += flag == 0;
+    }
+    task->kept = kept;
+}
+
+// Copy pass: moves the survivors of the range to their place in out and
+// lists the removed bodies after the earlier ranges' ones
+static void copy_range(void* arg) {
+    RemovalTask* task = (RemovalTask*)arg;
+    RemovalWorkspace* workspace = task->workspace;
+    int kept = task->kept_before;
+    int removed = task->first - task->kept_before;
+    for (int i = task->first; i < task->last; i++) {
+        int flag = workspace->flags[i];
+        if (flag == 0) {
+            task->out[kept] = task->bodies[i];
+            workspace->new_index[i] = kept++;
+            continue;
+        }
+        workspace->new_index[i] = -1;
+        Removal* removal = &workspace->removals[removed++];
+        removal->index = i;
+        removal->target = flag > 0 ? flag - 1 : -1;
+        removal->reason = flag < 0 ? REMOVAL_ESCAPED : (flag == 1 ? REMOVAL_ABSORBED : REMOVAL_COLLIDED);
+    }
+}
+
+// Runs one pass over the tasks, on pool's workers if there is more than one
+static void run_removal_tasks(RemovalTask tasks[], int task_count, ThreadPool* pool, ThreadPoolTask pass) {
+    if (task_count == 1) {
+        pass(&tasks[0]);
+        return;
+    }
+    for (int t = 0; t < task_count; t++) {
+        thread_pool_submit(pool, pass, &tasks[t]);
+    }
+    thread_pool_wait(pool);
+}
+
+// Makes room for count bodies in the per-body arrays
+static void reserve_workspace(RemovalWorkspace* workspace, int count) {
+    if (count <= workspace->capacity) {
+        return;
+    }
+    workspace->new_index = (int*)realloc(workspace->new_index, count * sizeof(int));
+    workspace->flags = (int*)realloc(workspace->flags, count * sizeof(int));
+    if (workspace->new_index == NULL || workspace->flags == NULL) {
+        fprintf(stderr, "Memory allocation failed for body removal\n");
+        exit(EXIT_FAILURE);
+    }
+    workspace->capacity = count;
+}
+
+// Flags the bodies of bodies[0..body_count) that the rules remove and, if
+// there are any, copies the survivors in order into out (room for
+// body_count) and fills in new_index and the removal list. Returns the
+// number of survivors; when that is body_count nothing was copied. The
+// ranges are split across pool's workers (NULL = this thread).
+int remove_bodies(RemovalWorkspace* workspace, const RemovalRules* rules, const CelestialBody bodies[],
+                  int body_count, CelestialBody out[], ThreadPool* pool) {
+    workspace->removal_count = 0;
+    reserve_workspace(workspace, body_count);
+
+    int workers = pool ? thread_pool_size(pool) : 1;
+    if (workers > REMOVAL_MAX_WORKERS) {
+        workers = REMOVAL_MAX_WORKERS;
+    }
+    if (workers > body_count / REMOVAL_MIN_RANGE) {
+        workers = body_count / REMOVAL_MIN_RANGE;
+    }
+    if (workers < 1) {
+        workers = 1;
+    }
+    RemovalTask tasks[REMOVAL_MAX_WORKERS];
+    for (int w = 0; w < workers; w++) {
+        RemovalTask* task = &tasks[w];
+        task->rules = rules;
+        task->bodies = bodies;
+        task->out = out;
+        task->workspace = workspace;
+        task->first = (int)((long)body_count * w / workers);
+        task->last = (int)((long)body_count * (w + 1) / workers);
+    }
+    run_removal_tasks(tasks, workers, pool, flag_range);
+
+    // Exclusive prefix sum of the survivor counts
+    int kept = 0;
+    for (int w = 0; w < workers; w++) {
+        tasks[w].kept_before = kept;
+        kept += tasks[w].kept;
+    }
+    if (kept == body_count) {
+        return body_count;  // The common case: nothing to move
+    }
+
+    int removed = body_count - kept;
+    if (removed > workspace->removal_capacity) {
+        workspace->removals = (Removal*)realloc(workspace->removals, removed * sizeof(Removal));
+        if (workspace->removals == NULL) {
+            fprintf(stderr, "Memory allocation failed for body removal\n");
+            exit(EXIT_FAILURE);
+        }
+        workspace->removal_capacity = removed;
+    }
+    run_removal_tasks(tasks, workers, pool, copy_range);
+    workspace->removal_count = removed;
+    return kept;
+}
+
+// Name of a reason, for logs
+const char* removal_reason_name(RemovalReason reason) {
+    return (unsigned)reason < REMOVAL_REASONS ? reason_names[reason] : "Unknown";
+}
+
+// Frees the workspace's arrays
+void removal_workspace_free(RemovalWorkspace* workspace) {
+    free(workspace->new_index);
+    free(workspace->flags);
+    free(workspace->removals);
+    workspace->new_index = NULL;
+    workspace->flags = NULL;
+    workspace->removals = NULL;
+    workspace->capacity = 0;
+    workspace->removal_capacity = 0;
+    workspace->removal_count = 0;
+}
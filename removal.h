@@ -0,0 +1,64 @@
+#ifndef REMOVAL_H
+#define REMOVAL_H
+
+#include "simulation.h"
+#include "thread_pool.h"
+
+// Removal of light bodies that have left the simulation for good. Bodies
+// outside the simulation region are never inserted into the tree but
+// would still be integrated, drawn and logged; bodies that have hit the
+// Sun or a planet would go on as if they had passed through it. Every few
+// steps one parallel pass flags them and the survivors are compacted, in
+// order, into a second array (stream compaction: each worker counts the
+// survivors of its range, a prefix sum over the counts gives every range
+// its place in the output, and the ranges are then copied independently).
+// The massive bodies are never removed, so they keep their indices.
+
+// Why a body was removed
+typedef enum {
+    REMOVAL_ESCAPED,   // Left the simulation region
+    REMOVAL_ABSORBED,  // Fell into the Sun (body 0)
+    REMOVAL_COLLIDED,  // Hit a planet
+    REMOVAL_REASONS
+} RemovalReason;
+
+// What is removed
+typedef struct {
+    double region;                // Bodies outside [-region, region] on either axis have escaped
+    const double* capture_radius; // Per massive body: bodies closer than this hit it
+    int massive_count;            // Leading bodies that are never removed (and can capture)
+} RemovalRules;
+
+// One removed body
+typedef struct {
+    int index;                    // Position in the array before the compaction
+    RemovalReason reason;
+    int target;                   // Body it hit (-1 if it escaped); its index did not change
+} Removal;
+
+// Scratch arrays of the passes, grown as needed, and the outcome of the
+// last pass
+typedef struct {
+    int* new_index;               // Per body: its index after the compaction, -1 = removed
+    int* flags;                   // Per body: 0 = kept, -1 = escaped, else 1 + the body it hit
+    int capacity;
+    Removal* removals;            // Bodies removed by the last pass, in array order
+    int removal_count;
+    int removal_capacity;
+} RemovalWorkspace;
+
+// Flags the bodies of bodies[0..body_count) that the rules remove and, if
+// there are any, copies the survivors in order into out (room for
+// body_count) and fills in new_index and the removal list. Returns the
+// number of survivors; when that is body_count nothing was copied. The
+// ranges are split across pool's workers (NULL = this thread).
+int remove_bodies(RemovalWorkspace* workspace, const RemovalRules* rules, const CelestialBody bodies[],
+                  int body_count, CelestialBody out[], ThreadPool* pool);
+
+// Name of a reason, for logs
+const char* removal_reason_name(RemovalReason reason);
+
+// Frees the workspace's arrays
+void removal_workspace_free(RemovalWorkspace* workspace);
+
+#endif
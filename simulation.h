@@ -0,0 +1,84 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+// Shared definitions for the Barnes-Hut simulation in main.c and the
+// modules that work on its bodies and quadtree
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+
+// Gravitational constant for simulation
+#define G 1.0                // Adjusted gravitational constant for this simulation
+#define EPSILON 1e-9         // Small value to prevent division by zero
+
+// Barnes-Hut opening angle threshold
+#define THETA 0.5
+
+// Simulation region for the quad tree
+#define SIMULATION_REGION 50.0
+
+// Number of planets and asteroids
+#define NUM_PLANETS 9
+#define NUM_ASTEROIDS 200
+#define MAX_BODIES (NUM_PLANETS + NUM_ASTEROIDS)
+
+// Structure to represent a celestial body (from quadtree2.c)
+typedef struct {
+    double x, y;        // Position coordinates
+    double vx, vy;      // Velocity components
+    double mass;        // Mass of the body
+    double radius;      // Radius of the body (for collision detection)
+    double fx, fy;      // Force from the last evaluation (for time-step control)
+    // Additional fields for our simulation
+    char name[20];      // Name of the body
+    Uint32 color;       // Color for rendering
+    int id;             // Stable number, kept when removals move the body in the array
+} CelestialBody;
+
+struct QuadTreeNode;
+
+// Blocks of tree nodes handed out in order and released all at once, so a
+// tree rebuilt every step does not go through malloc and free per node.
+// Every owner (the simulation, each ensemble member) has its own.
+typedef struct NodeArena {
+    struct QuadTreeNode** blocks;  // Blocks never move once allocated
+    int block_count;
+    int used;                      // Nodes handed out since the last reset
+} NodeArena;
+
+// Quad-Tree node structure (from quadtree2.c)
+typedef struct QuadTreeNode {
+    double x, y, width, height;  // Boundaries of the node
+    CelestialBody* body;         // Pointer to a body (if leaf)
+    struct QuadTreeNode *nw, *ne, *sw, *se;  // Child nodes
+    double total_mass;           // Sum of masses in this region
+    double center_x, center_y;   // Center of mass of this node
+    int body_count;              // Bodies in this region (set with the center of mass)
+    int visits;                  // Force-walk visits this frame (for the overlay), see COUNT_VISIT
+    NodeArena* arena;            // Arena the node came from (NULL = malloc)
+} QuadTreeNode;
+
+// Counts a force-walk visit of a node. The force pool's workers walk the
+// same tree at once, so the count is a relaxed atomic add rather than ++.
+#define COUNT_VISIT(node) __atomic_fetch_add(&(node)->visits, 1, __ATOMIC_RELAXED)
+
+// Quad tree functions from quadtree2.c
+CelestialBody* create_body(double x, double y, double vx, double vy, double mass, double radius);
+QuadTreeNode* create_quadtree(double x, double y, double width, double height);
+QuadTreeNode* create_quadtree_in(NodeArena* arena, double x, double y, double width, double height);
+void node_arena_reset(NodeArena* arena);
+void node_arena_free(NodeArena* arena);
+bool is_in_bounds(QuadTreeNode* node, CelestialBody* body);
+void subdivide(QuadTreeNode* node);
+QuadTreeNode* get_quadrant(QuadTreeNode* node, CelestialBody* body);
+void insert_body(QuadTreeNode* node, CelestialBody* body);
+void calculate_center_of_mass(QuadTreeNode* node);
+void free_quadtree(QuadTreeNode* node);
+void calculate_force_from_quadtree(CelestialBody* body, QuadTreeNode* node, double theta, double* fx, double* fy);
+void calculate_force_and_potential_from_quadtree(CelestialBody* body, QuadTreeNode* node, double theta,
+                                                 double* fx, double* fy, double* potential);
+void calculate_short_range_force_from_quadtree(CelestialBody* body, QuadTreeNode* node, double theta,
+                                               double split_radius, double* fx, double* fy);
+void update_body(CelestialBody* body, double fx, double fy, double dt);
+
+#endif
@@ -26,13 +26,9 @@
 // Data Structures
 // ************************
 
-// Planet structure
+// Planet display data; the physical state lives in bodies[]
 typedef struct {
     char name[20];
-    double mass;       // Mass of the planet
-    double x, y;       // Position
-    double vx, vy;     // Velocity
-    double ax, ay;     // Acceleration
     double radius;     // Display radius
     Uint32 color;      // RGB color
 
@@ -48,8 +44,6 @@ typedef struct {
     double mass;         // Mass of the body
     double radius;       // Radius for display
     double fx, fy;       // Force components (for logging)
-    int type;            // 0 for planet, 1 for asteroid
-    int planet_index;    // Index in the planets array (if type == 0)
 } CelestialBody;
 
 // Quad tree node structure
@@ -65,8 +59,12 @@ typedef struct QuadTreeNode {
 // Global Variables
 // ************************
 
+// Every body the tree and the renderer work on, in place: the planets
+// (Sun first) followed by the asteroids
+#define NUM_BODIES (NUM_PLANETS + NUM_ASTEROIDS)
+CelestialBody bodies[NUM_BODIES];
+CelestialBody* const asteroids = &bodies[NUM_PLANETS];
 Planet planets[NUM_PLANETS];
-CelestialBody asteroids[NUM_ASTEROIDS];
 
 // Planet initialization data
 char* names[] = {"Sun", "Mercury", "Venus", "Earth", "Mars", "Jupiter", "Saturn", "Uranus", "Neptune"};
@@ -78,13 +76,36 @@ Uint32 colors[] = {0xFFFF00, 0x808080, 0xFFA500, 0x0000FF, 0xFF0000, 0xA52A2A, 0
 // Quad Tree Functions
 // ************************
 
+// Tree nodes are handed out from blocks that are kept between steps, so
+// rebuilding the tree does not touch the heap once the pool has grown
+#define NODE_BLOCK_SIZE 256
+static QuadTreeNode** node_blocks = NULL;  // Blocks never move once allocated
+static int node_block_count = 0;
+static int nodes_used = 0;                 // Nodes handed out since the last reset
+
+// Takes the next node from the pool, adding a block if all are in use
+static QuadTreeNode* allocate_node(void) {
+    int block = nodes_used / NODE_BLOCK_SIZE;
+    if (block == node_block_count) {
+        QuadTreeNode** blocks = (QuadTreeNode**)realloc(node_blocks, (node_block_count + 1) * sizeof(QuadTreeNode*));
+        if (blocks == NULL) {
+            fprintf(stderr, "Memory allocation failed for quad-tree pool\n");
+            exit(EXIT_FAILURE);
+        }
+        node_blocks = blocks;
+        node_blocks[block] = (QuadTreeNode*)malloc(NODE_BLOCK_SIZE * sizeof(QuadTreeNode));
+        if (node_blocks[block] == NULL) {
+            fprintf(stderr, "Memory allocation failed for quad-tree node\n");
+            exit(EXIT_FAILURE);
+        }
+        node_block_count++;
+    }
+    return &node_blocks[block][nodes_used++ % NODE_BLOCK_SIZE];
+}
+
 // Creates a new quad tree node
 QuadTreeNode* create_quadtree(double x, double y, double width, double height) {
-    QuadTreeNode* node = (QuadTreeNode*)malloc(sizeof(QuadTreeNode));
-    if (node == NULL) {
-        fprintf(stderr, "Memory allocation failed for quad-tree node\n");
-        exit(EXIT_FAILURE);
-    }
+    QuadTreeNode* node = allocate_node();
     node->x = x;
     node->y = y;
     node->width = width;
@@ -198,14 +219,9 @@ void calculate_center_of_mass(QuadTreeNode* node) {
     }
 }
 
-// Frees the quad tree
-void free_quadtree(QuadTreeNode* node) {
-    if (node == NULL) return;
-    free_quadtree(node->nw);
-    free_quadtree(node->ne);
-    free_quadtree(node->sw);
-    free_quadtree(node->se);
-    free(node);
+// Returns every node to the pool; trees built before are no longer valid
+void reset_quadtree_pool(void) {
+    nodes_used = 0;
 }
 
 // Calculates gravitational force using Barnes-Hut
@@ -263,16 +279,18 @@ void update_body(CelestialBody* body, double fx, double fy, double dt) {
 // Initialize planets
 void initialize_planets() {
     for (int i = 0; i < NUM_PLANETS; i++) {
-        strcpy(planets[i].name, names[i]);
-        planets[i].mass = masses[i];
-        planets[i].x = semi_major_axes[i];
-        planets[i].y = 0.0;
-        planets[i].vx = 0.0;
+        bodies[i].mass = masses[i];
+        bodies[i].x = semi_major_axes[i];
+        bodies[i].y = 0.0;
+        bodies[i].vx = 0.0;
         // Set orbital velocity for planets (except Sun)
-        planets[i].vy = (i == 0) ? 0.0 : sqrt(G / semi_major_axes[i]);
-        planets[i].ax = 0.0;
-        planets[i].ay = 0.0;
-        planets[i].radius = (i == 0) ? 20.0 : 10.0; // Sun is bigger
+        bodies[i].vy = (i == 0) ? 0.0 : sqrt(G / semi_major_axes[i]);
+        bodies[i].radius = (i == 0) ? 20.0 : 10.0; // Sun is bigger
+        bodies[i].fx = 0.0;
+        bodies[i].fy = 0.0;
+
+        strcpy(planets[i].name, names[i]);
+        planets[i].radius = bodies[i].radius;
         planets[i].color = colors[i];
         planets[i].trajectory_count = 0;
     }
@@ -298,7 +316,6 @@ void initialize_asteroids() {
         asteroids[i].radius = 2.0;
         asteroids[i].fx = 0.0;
         asteroids[i].fy = 0.0;
-        asteroids[i].type = 1; // 1 for asteroid
     }
 }
 
@@ -306,70 +323,37 @@ void initialize_asteroids() {
 // Simulation Update Functions
 // ************************
 
-// Updates the entire simulation using Barnes-Hut
+// Updates the entire simulation using Barnes-Hut. The tree points straight
+// into bodies[], so nothing is copied or allocated per step
 void update_simulation_barnes_hut(double dt, int* frame_count, int trajectory_interval) {
-    // Create CelestialBody array for all objects
-    int total_bodies = NUM_PLANETS + NUM_ASTEROIDS;
-    CelestialBody* all_bodies = (CelestialBody*)malloc(total_bodies * sizeof(CelestialBody));
-    
-    // Add planets to the array
-    for (int i = 0; i < NUM_PLANETS; i++) {
-        all_bodies[i].x = planets[i].x;
-        all_bodies[i].y = planets[i].y;
-        all_bodies[i].vx = planets[i].vx;
-        all_bodies[i].vy = planets[i].vy;
-        all_bodies[i].mass = planets[i].mass;
-        all_bodies[i].radius = planets[i].radius;
-        all_bodies[i].fx = 0.0;
-        all_bodies[i].fy = 0.0;
-        all_bodies[i].type = 0; // 0 for planet
-        all_bodies[i].planet_index = i;
-    }
-    
-    // Add asteroids to the array
-    for (int i = 0; i < NUM_ASTEROIDS; i++) {
-        all_bodies[NUM_PLANETS + i] = asteroids[i];
-    }
-    
-    // Create quad tree
+    // Build the quad tree from the pooled nodes
+    reset_quadtree_pool();
     QuadTreeNode* root = create_quadtree(-SIMULATION_REGION, -SIMULATION_REGION, 
                                         2 * SIMULATION_REGION, 2 * SIMULATION_REGION);
-    
-    // Insert all bodies into the quad tree
-    for (int i = 0; i < total_bodies; i++) {
-        insert_body(root, &all_bodies[i]);
+    for (int i = 0; i < NUM_BODIES; i++) {
+        insert_body(root, &bodies[i]);
     }
     
     // Calculate center of mass for all nodes
     calculate_center_of_mass(root);
     
-    // Calculate forces and update positions
-    for (int i = 0; i < total_bodies; i++) {
-        double fx = 0.0, fy = 0.0;
-        calculate_force_from_quadtree(&all_bodies[i], root, THETA, &fx, &fy);
-        update_body(&all_bodies[i], fx, fy, dt);
-        
-        // Update original data structures
-        if (all_bodies[i].type == 0) {
-            int idx = all_bodies[i].planet_index;
-            planets[idx].x = all_bodies[i].x;
-            planets[idx].y = all_bodies[i].y;
-            planets[idx].vx = all_bodies[i].vx;
-            planets[idx].vy = all_bodies[i].vy;
-            planets[idx].ax = fx / planets[idx].mass;
-            planets[idx].ay = fy / planets[idx].mass;
-        } else {
-            int idx = i - NUM_PLANETS;
-            asteroids[idx] = all_bodies[i];
-        }
+    // Calculate every force before moving anything, so all bodies see the
+    // same positions the tree was built from
+    for (int i = 0; i < NUM_BODIES; i++) {
+        bodies[i].fx = 0.0;
+        bodies[i].fy = 0.0;
+        calculate_force_from_quadtree(&bodies[i], root, THETA, &bodies[i].fx, &bodies[i].fy);
+    }
+    for (int i = 0; i < NUM_BODIES; i++) {
+        update_body(&bodies[i], bodies[i].fx, bodies[i].fy, dt);
     }
     
     // Update planet trajectories
     if (*frame_count % trajectory_interval == 0) {
         for (int i = 0; i < NUM_PLANETS; i++) {
             if (planets[i].trajectory_count < MAX_TRAJECTORY_POINTS) {
-                planets[i].trajectory_x[planets[i].trajectory_count] = planets[i].x;
-                planets[i].trajectory_y[planets[i].trajectory_count] = planets[i].y;
+                planets[i].trajectory_x[planets[i].trajectory_count] = bodies[i].x;
+                planets[i].trajectory_y[planets[i].trajectory_count] = bodies[i].y;
                 planets[i].trajectory_count++;
             } else {
                 // Shift array to make room for new point
@@ -377,17 +361,13 @@ void update_simulation_barnes_hut(double dt, int* frame_count, int trajectory_in
                     planets[i].trajectory_x[j] = planets[i].trajectory_x[j + 1];
                     planets[i].trajectory_y[j] = planets[i].trajectory_y[j + 1];
                 }
-                planets[i].trajectory_x[MAX_TRAJECTORY_POINTS - 1] = planets[i].x;
-                planets[i].trajectory_y[MAX_TRAJECTORY_POINTS - 1] = planets[i].y;
+                planets[i].trajectory_x[MAX_TRAJECTORY_POINTS - 1] = bodies[i].x;
+                planets[i].trajectory_y[MAX_TRAJECTORY_POINTS - 1] = bodies[i].y;
             }
         }
     }
     
     (*frame_count)++;
-    
-    // Clean up
-    free_quadtree(root);
-    free(all_bodies);
 }
 
 // ************************
@@ -446,8 +426,8 @@ void render_planets(SDL_Renderer* renderer, double pixels_per_AU) {
 
     // Draw planets
     for (int i = 0; i < NUM_PLANETS; i++) {
-        int screen_x = WIDTH / 2 + (int)(planets[i].x * pixels_per_AU);
-        int screen_y = HEIGHT / 2 - (int)(planets[i].y * pixels_per_AU);
+        int screen_x = WIDTH / 2 + (int)(bodies[i].x * pixels_per_AU);
+        int screen_y = HEIGHT / 2 - (int)(bodies[i].y * pixels_per_AU);
         int radius = (int)planets[i].radius;
 
         Uint8 r = (planets[i].color >> 16) & 0xFF;
@@ -511,11 +491,33 @@ void render_scene(SDL_Renderer* renderer, double pixels_per_AU, TTF_Font* font)
     SDL_RenderPresent(renderer);
 }
 
+// Steps the simulation without a window and reports the time per step
+int run_benchmark(int steps) {
+    initialize_planets();
+    initialize_asteroids();
+    
+    int frame_count = 0;
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int i = 0; i < steps; i++) {
+        update_simulation_barnes_hut(0.001, &frame_count, 10);
+    }
+    double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    
+    printf("%d bodies, %d steps in %.3f s (%.4f ms/step)\n",
+           NUM_BODIES, steps, seconds, 1000.0 * seconds / (steps > 0 ? steps : 1));
+    return 0;
+}
+
 // ************************
 // Main Function
 // ************************
 
-int main() {
+int main(int argc, char* argv[]) {
+    // --bench N times N steps instead of opening the window
+    if (argc == 3 && strcmp(argv[1], "--bench") == 0) {
+        return run_benchmark(atoi(argv[2]));
+    }
+    
     // Simulation parameters
     double pixels_per_AU = 120.0;  // Display scale
     double zoom_step = 20.0;       // Zoom increment
@@ -0,0 +1,251 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+
+#include "simulation.h"
+#include "telemetry.h"
+
+struct Telemetry {
+    SDL_Thread* thread;
+    SDL_mutex* lock;             // Protects everything below
+    SDL_cond* wake;              // Signalled when a snapshot is ready or on quit
+    bool busy;                   // The worker owns the snapshot
+    bool quit;
+
+    CelestialBody* snapshot;     // Copy of the bodies being analysed
+    int snapshot_count;
+    int snapshot_capacity;
+    double snapshot_time;
+    double snapshot_theta;
+    bool snapshot_rebases;       // The snapshot becomes the new reference
+    bool rebase_requested;       // The next snapshot does
+
+    int force_samples;           // Bodies checked per snapshot
+    Uint32 rng_state;            // Private RNG (rand() is not thread-safe)
+
+    bool have_reference;         // E0 and L0 are set
+    int reference;               // Rebases so far
+    double energy0;
+    double angular_momentum0;
+    TelemetryReport latest;
+};
+
+// Xorshift32 step; the monitor keeps its own generator
+static Uint32 next_random(Telemetry* telemetry) {
+    Uint32 x = telemetry->rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    telemetry->rng_state = x;
+    return x;
+}
+
+// Direct-summation force on bodies[index] (reference for the error check)
+static void direct_force(const CelestialBody bodies[], int count, int index, double* fx, double* fy) {
+    const CelestialBody* body = &bodies[index];
+    *fx = 0.0;
+    *fy = 0.0;
+    for (int j = 0; j < count; j++) {
+        if (j == index) continue;
+        double dx = bodies[j].x - body->x;
+        double dy = bodies[j].y - body->y;
+        double distance_squared = dx*dx + dy*dy;
+        double distance = sqrt(distance_squared);
+        if (distance < EPSILON) continue;
+        double force_magnitude = G * body->mass * bodies[j].mass / distance_squared;
+        *fx += force_magnitude * dx / distance;
+        *fy += force_magnitude * dy / distance;
+    }
+}
+
+// Analyses the current snapshot (runs on the worker, without the lock)
+static void analyse_snapshot(Telemetry* telemetry, TelemetryReport* report) {
+    CelestialBody* bodies = telemetry->snapshot;
+    int count = telemetry->snapshot_count;
+    double theta = telemetry->snapshot_theta;
+
+    // Build a private tree over the snapshot
+    QuadTreeNode* root = create_quadtree(-SIMULATION_REGION, -SIMULATION_REGION,
+                                         2 * SIMULATION_REGION, 2 * SIMULATION_REGION);
+    for (int i = 0; i < count; i++) {
+        insert_body(root, &bodies[i]);
+    }
+    calculate_center_of_mass(root);
+
+    // Kinetic energy, potential energy and angular momentum. The walk that
+    // measures the potential leaves each body's tree force in its fx/fy,
+    // for the error check below (the snapshot is ours to overwrite).
+    double kinetic = 0.0, potential = 0.0, angular_momentum = 0.0;
+    for (int i = 0; i < count; i++) {
+        CelestialBody* body = &bodies[i];
+        double phi = 0.0;
+        body->fx = 0.0;
+        body->fy = 0.0;
+        calculate_force_and_potential_from_quadtree(body, root, theta, &body->fx, &body->fy, &phi);
+        kinetic += 0.5 * body->mass * (body->vx * body->vx + body->vy * body->vy);
+        // Each pair appears twice in the sum, hence the factor 1/2
+        potential += 0.5 * body->mass * phi;
+        angular_momentum += body->mass * (body->x * body->vy - body->y * body->vx);
+    }
+
+    // Tree force error against direct summation on a random subset
+    int samples = telemetry->force_samples < count ? telemetry->force_samples : count;
+    double error_sum_sq = 0.0, error_max = 0.0;
+    int measured = 0;
+    for (int s = 0; s < samples; s++) {
+        int index = (int)(next_random(telemetry) % (Uint32)count);
+        double tree_fx = bodies[index].fx, tree_fy = bodies[index].fy;
+        double exact_fx, exact_fy;
+        direct_force(bodies, count, index, &exact_fx, &exact_fy);
+
+        double exact = sqrt(exact_fx * exact_fx + exact_fy * exact_fy);
+        if (exact < EPSILON * EPSILON) continue;
+        double ex = tree_fx - exact_fx;
+        double ey = tree_fy - exact_fy;
+        double error = sqrt(ex * ex + ey * ey) / exact;
+        error_sum_sq += error * error;
+        if (error > error_max) error_max = error;
+        measured++;
+    }
+
+    free_quadtree(root);
+
+    double energy = kinetic + potential;
+    if (!telemetry->have_reference || telemetry->snapshot_rebases) {
+        if (telemetry->have_reference) {
+            telemetry->reference++;
+        }
+        telemetry->energy0 = energy;
+        telemetry->angular_momentum0 = angular_momentum;
+        telemetry->have_reference = true;
+    }
+
+    report->valid = true;
+    report->time = telemetry->snapshot_time;
+    report->theta = theta;
+    report->kinetic = kinetic;
+    report->potential = potential;
+    report->energy = energy;
+    report->energy_drift = telemetry->energy0 != 0.0
+        ? (energy - telemetry->energy0) / fabs(telemetry->energy0) : 0.0;
+    report->reference = telemetry->reference;
+    report->angular_momentum = angular_momentum;
+    report->angular_momentum_drift = telemetry->angular_momentum0 != 0.0
+        ? (angular_momentum - telemetry->angular_momentum0) / fabs(telemetry->angular_momentum0) : 0.0;
+    report->force_samples = measured;
+    report->force_error_rms = measured > 0 ? sqrt(error_sum_sq / measured) : 0.0;
+    report->force_error_max = error_max;
+}
+
+// Worker thread: analyses snapshots as they are submitted
+static int telemetry_main(void* data) {
+    Telemetry* telemetry = (Telemetry*)data;
+
+    SDL_LockMutex(telemetry->lock);
+    for (;;) {
+        while (!telemetry->busy && !telemetry->quit) {
+            SDL_CondWait(telemetry->wake, telemetry->lock);
+        }
+        if (telemetry->quit) {
+            break;
+        }
+        SDL_UnlockMutex(telemetry->lock);
+
+        TelemetryReport report;
+        analyse_snapshot(telemetry, &report);
+
+        SDL_LockMutex(telemetry->lock);
+        telemetry->latest = report;
+        telemetry->busy = false;
+    }
+    SDL_UnlockMutex(telemetry->lock);
+    return 0;
+}
+
+// Starts the monitor's worker thread
+Telemetry* telemetry_create(int force_samples) {
+    Telemetry* telemetry = (Telemetry*)calloc(1, sizeof(Telemetry));
+    if (telemetry == NULL) {
+        fprintf(stderr, "Memory allocation failed for telemetry\n");
+        exit(EXIT_FAILURE);
+    }
+
+    telemetry->force_samples = force_samples;
+    telemetry->rng_state = 0x9E3779B9u;
+    telemetry->lock = SDL_CreateMutex();
+    telemetry->wake = SDL_CreateCond();
+    telemetry->thread = SDL_CreateThread(telemetry_main, "telemetry", telemetry);
+    if (telemetry->lock == NULL || telemetry->wake == NULL || telemetry->thread == NULL) {
+        fprintf(stderr, "Telemetry thread creation failed: %s\n", SDL_GetError());
+        exit(EXIT_FAILURE);
+    }
+    return telemetry;
+}
+
+// Hands a copy of the bodies to the worker if it is idle
+bool telemetry_submit(Telemetry* telemetry, const CelestialBody bodies[], int body_count,
+                      double time, double theta) {
+    SDL_LockMutex(telemetry->lock);
+    bool idle = !telemetry->busy;
+    SDL_UnlockMutex(telemetry->lock);
+    if (!idle || body_count <= 0) {
+        return false;
+    }
+
+    // The worker is idle, so the snapshot buffer is ours until busy is set
+    if (body_count > telemetry->snapshot_capacity) {
+        free(telemetry->snapshot);
+        telemetry->snapshot = (CelestialBody*)malloc(body_count * sizeof(CelestialBody));
+        if (telemetry->snapshot == NULL) {
+            fprintf(stderr, "Memory allocation failed for telemetry snapshot\n");
+            exit(EXIT_FAILURE);
+        }
+        telemetry->snapshot_capacity = body_count;
+    }
+    memcpy(telemetry->snapshot, bodies, body_count * sizeof(CelestialBody));
+    telemetry->snapshot_count = body_count;
+    telemetry->snapshot_time = time;
+    telemetry->snapshot_theta = theta;
+    telemetry->snapshot_rebases = telemetry->rebase_requested;
+    telemetry->rebase_requested = false;
+
+    SDL_LockMutex(telemetry->lock);
+    telemetry->busy = true;
+    SDL_CondSignal(telemetry->wake);
+    SDL_UnlockMutex(telemetry->lock);
+    return true;
+}
+
+// Makes the next snapshot the reference for the drifts; a snapshot
+// already being analysed still belongs to the old system
+void telemetry_rebase(Telemetry* telemetry) {
+    telemetry->rebase_requested = true;
+}
+
+// Copies the most recent finished report
+void telemetry_latest(Telemetry* telemetry, TelemetryReport* report) {
+    SDL_LockMutex(telemetry->lock);
+    *report = telemetry->latest;
+    SDL_UnlockMutex(telemetry->lock);
+}
+
+// Stops the worker and frees the monitor
+void telemetry_destroy(Telemetry* telemetry) {
+    if (telemetry == NULL) {
+        return;
+    }
+
+    SDL_LockMutex(telemetry->lock);
+    telemetry->quit = true;
+    SDL_CondSignal(telemetry->wake);
+    SDL_UnlockMutex(telemetry->lock);
+    SDL_WaitThread(telemetry->thread, NULL);
+
+    SDL_DestroyCond(telemetry->wake);
+    SDL_DestroyMutex(telemetry->lock);
+    free(telemetry->snapshot);
+    free(telemetry);
+}
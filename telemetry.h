@@ -0,0 +1,48 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdbool.h>
+#include "simulation.h"
+
+// Background accuracy monitor. Snapshots of the bodies are analysed on a
+// worker thread: total energy (kinetic + tree-approximated potential),
+// angular momentum, their drift relative to the first snapshot, and the
+// tree force error against direct summation for a random subset of bodies.
+typedef struct Telemetry Telemetry;
+
+// Latest analysis result
+typedef struct {
+    bool valid;                    // False until the first snapshot is done
+    double time;                   // Simulation time of the snapshot
+    double theta;                  // Opening angle used for the snapshot
+    double kinetic;                // Kinetic energy
+    double potential;              // Tree-approximated potential energy
+    double energy;                 // kinetic + potential
+    double energy_drift;           // (E - E0) / |E0|
+    int reference;                 // Rebases so far; drifts only compare within one
+    double angular_momentum;       // Total L_z about the origin
+    double angular_momentum_drift; // (L - L0) / |L0|
+    int force_samples;             // Bodies checked against direct summation
+    double force_error_rms;        // RMS relative force error of the samples
+    double force_error_max;        // Largest relative force error
+} TelemetryReport;
+
+// Starts the worker thread; force_samples bodies are checked per snapshot
+Telemetry* telemetry_create(int force_samples);
+
+// Copies the bodies for analysis unless the worker is still busy with the
+// previous snapshot. Returns true if the snapshot was taken.
+bool telemetry_submit(Telemetry* telemetry, const CelestialBody bodies[], int body_count,
+                      double time, double theta);
+
+// Makes the next snapshot taken the reference for the drifts, for when
+// bodies were added or removed and the old totals no longer apply
+void telemetry_rebase(Telemetry* telemetry);
+
+// Copies the most recent finished report
+void telemetry_latest(Telemetry* telemetry, TelemetryReport* report);
+
+// Stops the worker thread and frees the monitor
+void telemetry_destroy(Telemetry* telemetry);
+
+#endif
@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+
+#include "thread_pool.h"
+
+// Initial capacity of the task queue (grows on demand)
+#define INITIAL_QUEUE_CAPACITY 64
+
+// A queued task
+typedef struct {
+    ThreadPoolTask task;
+    void* arg;
+} QueuedTask;
+
+struct ThreadPool {
+    SDL_Thread** threads;        // Worker threads
+    int num_threads;
+    QueuedTask* queue;           // Ring buffer of pending tasks
+    int capacity;                // Size of the ring buffer
+    int head;                    // Index of the oldest pending task
+    int count;                   // Number of pending tasks
+    int running;                 // Tasks being executed by workers
+    bool shutting_down;          // Set by thread_pool_destroy
+    SDL_mutex* lock;             // Protects the queue, the counts and the flag above
+    SDL_cond* work_available;    // Signalled when a task is queued
+    SDL_cond* idle;              // Signalled when the last running task finishes
+};
+
+// Worker thread: pops tasks until the pool shuts down and the queue is empty
+static int worker_main(void* data) {
+    ThreadPool* pool = (ThreadPool*)data;
+
+    for (;;) {
+        SDL_LockMutex(pool->lock);
+        while (pool->count == 0 && !pool->shutting_down) {
+            SDL_CondWait(pool->work_available, pool->lock);
+        }
+        if (pool->count == 0) {
+            // Shutting down and nothing left to do
+            SDL_UnlockMutex(pool->lock);
+            break;
+        }
+        QueuedTask next = pool->queue[pool->head];
+        pool->head = (pool->head + 1) % pool->capacity;
+        pool->count--;
+        pool->running++;
+        SDL_UnlockMutex(pool->lock);
+
+        next.task(next.arg);
+
+        SDL_LockMutex(pool->lock);
+        pool->running--;
+        if (pool->count == 0 && pool->running == 0) {
+            SDL_CondBroadcast(pool->idle);
+        }
+        SDL_UnlockMutex(pool->lock);
+    }
+    return 0;
+}
+
+// Creates a pool with the given number of worker threads
+ThreadPool* thread_pool_create(int num_threads) {
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+
+    ThreadPool* pool = (ThreadPool*)calloc(1, sizeof(ThreadPool));
+    if (pool == NULL) {
+        fprintf(stderr, "Memory allocation failed for thread pool\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pool->capacity = INITIAL_QUEUE_CAPACITY;
+    pool->queue = (QueuedTask*)malloc(pool->capacity * sizeof(QueuedTask));
+    pool->threads = (SDL_Thread**)calloc(num_threads, sizeof(SDL_Thread*));
+    pool->lock = SDL_CreateMutex();
+    pool->work_available = SDL_CreateCond();
+    pool->idle = SDL_CreateCond();
+    if (pool->queue == NULL || pool->threads == NULL ||
+        pool->lock == NULL || pool->work_available == NULL || pool->idle == NULL) {
+        fprintf(stderr, "Thread pool initialization failed: %s\n", SDL_GetError());
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < num_threads; i++) {
+        pool->threads[i] = SDL_CreateThread(worker_main, "pool_worker", pool);
+        if (pool->threads[i] == NULL) {
+            fprintf(stderr, "Worker thread creation failed: %s\n", SDL_GetError());
+            exit(EXIT_FAILURE);
+        }
+        pool->num_threads++;
+    }
+
+    return pool;
+}
+
+// Queues a task for execution on a worker thread
+void thread_pool_submit(ThreadPool* pool, ThreadPoolTask task, void* arg) {
+    SDL_LockMutex(pool->lock);
+
+    // Grow the ring buffer if it is full, unwrapping it into the new storage
+    if (pool->count == pool->capacity) {
+        int new_capacity = pool->capacity * 2;
+        QueuedTask* new_queue = (QueuedTask*)malloc(new_capacity * sizeof(QueuedTask));
+        if (new_queue == NULL) {
+            fprintf(stderr, "Memory allocation failed for thread pool queue\n");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < pool->count; i++) {
+            new_queue[i] = pool->queue[(pool->head + i) % pool->capacity];
+        }
+        free(pool->queue);
+        pool->queue = new_queue;
+        pool->capacity = new_capacity;
+        pool->head = 0;
+    }
+
+    int tail = (pool->head + pool->count) % pool->capacity;
+    pool->queue[tail].task = task;
+    pool->queue[tail].arg = arg;
+    pool->count++;
+
+    SDL_CondSignal(pool->work_available);
+    SDL_UnlockMutex(pool->lock);
+}
+
+// Number of worker threads in the pool
+int thread_pool_size(ThreadPool* pool) {
+    return pool->num_threads;
+}
+
+// Blocks until the queue is empty and no task is running
+void thread_pool_wait(ThreadPool* pool) {
+    SDL_LockMutex(pool->lock);
+    while (pool->count > 0 || pool->running > 0) {
+        SDL_CondWait(pool->idle, pool->lock);
+    }
+    SDL_UnlockMutex(pool->lock);
+}
+
+// Drains the queue, joins all workers and frees the pool
+void thread_pool_destroy(ThreadPool* pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    SDL_LockMutex(pool->lock);
+    pool->shutting_down = true;
+    SDL_CondBroadcast(pool->work_available);
+    SDL_UnlockMutex(pool->lock);
+
+    for (int i = 0; i < pool->num_threads; i++) {
+        SDL_WaitThread(pool->threads[i], NULL);
+    }
+
+    SDL_DestroyCond(pool->work_available);
+    SDL_DestroyCond(pool->idle);
+    SDL_DestroyMutex(pool->lock);
+    free(pool->threads);
+    free(pool->queue);
+    free(pool);
+}
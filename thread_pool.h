@@ -0,0 +1,27 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+// Fixed-size pool of worker threads (built on SDL threads) that executes
+// submitted tasks in FIFO order.
+typedef struct ThreadPool ThreadPool;
+
+// A unit of work run on one of the pool's workers
+typedef void (*ThreadPoolTask)(void* arg);
+
+// Creates a pool with the given number of worker threads (at least one)
+ThreadPool* thread_pool_create(int num_threads);
+
+// Queues a task; never blocks on running tasks
+void thread_pool_submit(ThreadPool* pool, ThreadPoolTask task, void* arg);
+
+// Number of worker threads in the pool
+int thread_pool_size(ThreadPool* pool);
+
+// Waits until every task submitted so far has finished (the pool stays
+// usable, so a caller can fan work out and join it every step)
+void thread_pool_wait(ThreadPool* pool);
+
+// Finishes all queued tasks, then stops the workers and frees the pool
+void thread_pool_destroy(ThreadPool* pool);
+
+#endif
@@ -0,0 +1,113 @@
+#include <math.h>
+#include <stdbool.h>
+
+#include "simulation.h"
+#include "telemetry.h"
+#include "timestep.h"
+
+// Limits on the energy-feedback multiplier
+#define MIN_SCALE 0.01
+#define MAX_SCALE 4.0
+
+// Sets up the controller
+void timestep_init(TimestepController* controller, double min_dt, double max_dt, double tolerance) {
+    controller->eta = 0.02;
+    controller->scale = 1.0;
+    controller->tolerance = tolerance;
+    controller->min_dt = min_dt;
+    controller->max_dt = max_dt;
+    controller->max_growth = 1.25;
+    controller->limiting_body = -1;
+    controller->particle_ratio_sq = INFINITY;
+    controller->particle_body = -1;
+    controller->last_report_time = 0.0;
+    controller->last_report_drift = 0.0;
+    controller->have_report = false;
+    controller->history_head = 0;
+    controller->history_count = 0;
+}
+
+// Chooses the next dt from the current forces
+double timestep_choose(TimestepController* controller, const CelestialBody bodies[], int body_count,
+                       double current_dt) {
+    double min_ratio_sq = INFINITY;  // Smallest (r / |a|)^2 over the bodies
+    controller->limiting_body = -1;
+
+    for (int i = 1; i < body_count; i++) {
+        double ax = bodies[i].fx / bodies[i].mass;
+        double ay = bodies[i].fy / bodies[i].mass;
+        double accel_sq = ax * ax + ay * ay;
+        if (accel_sq < EPSILON * EPSILON) continue;
+
+        double dx = bodies[i].x - bodies[0].x;
+        double dy = bodies[i].y - bodies[0].y;
+        double ratio_sq = (dx * dx + dy * dy) / accel_sq;
+        if (ratio_sq < min_ratio_sq) {
+            min_ratio_sq = ratio_sq;
+            controller->limiting_body = i;
+        }
+    }
+    if (controller->particle_ratio_sq < min_ratio_sq) {
+        min_ratio_sq = controller->particle_ratio_sq;
+        controller->limiting_body = controller->particle_body;
+    }
+    controller->particle_ratio_sq = INFINITY;
+
+    double dt = controller->max_dt;
+    if (controller->limiting_body >= 0) {
+        // Time scale sqrt(r / |a|) = (min_ratio_sq)^(1/4)
+        dt = controller->eta * controller->scale * sqrt(sqrt(min_ratio_sq));
+    }
+
+    // Shrink immediately, grow gradually
+    if (dt > current_dt * controller->max_growth) dt = current_dt * controller->max_growth;
+    if (dt > controller->max_dt) dt = controller->max_dt;
+    if (dt < controller->min_dt) dt = controller->min_dt;
+    return dt;
+}
+
+// Notes the time-step measure of a test-particle pass for the next choice
+void timestep_note_particles(TimestepController* controller, double min_ratio_sq, int body) {
+    if (min_ratio_sq < controller->particle_ratio_sq) {
+        controller->particle_ratio_sq = min_ratio_sq;
+        controller->particle_body = body;
+    }
+}
+
+// Tunes the scale factor from the energy drift rate between two reports
+void timestep_energy_feedback(TimestepController* controller, const TelemetryReport* report) {
+    if (report == NULL || !report->valid) {
+        return;
+    }
+    if (controller->have_report && report->time == controller->last_report_time) {
+        return;  // Already used
+    }
+
+    if (controller->have_report && report->time > controller->last_report_time &&
+        report->reference == controller->last_report_reference) {
+        double elapsed = report->time - controller->last_report_time;
+        double rate = fabs(report->energy_drift - controller->last_report_drift) / elapsed;
+
+        if (rate > controller->tolerance) {
+            controller->scale *= 0.7;
+        } else if (rate < 0.25 * controller->tolerance) {
+            controller->scale *= 1.1;
+        }
+        if (controller->scale < MIN_SCALE) controller->scale = MIN_SCALE;
+        if (controller->scale > MAX_SCALE) controller->scale = MAX_SCALE;
+    }
+
+    controller->last_report_time = report->time;
+    controller->last_report_drift = report->energy_drift;
+    controller->last_report_reference = report->reference;
+    controller->have_report = true;
+}
+
+// Appends a dt to the history ring buffer
+void timestep_record(TimestepController* controller, double dt) {
+    controller->history[controller->history_head] = dt;
+    controller->history_head = (controller->history_head + 1) % DT_HISTORY_LENGTH;
+    if (controller->history_count < DT_HISTORY_LENGTH) {
+        controller->history_count++;
+    }
+}
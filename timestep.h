@@ -0,0 +1,58 @@
+#ifndef TIMESTEP_H
+#define TIMESTEP_H
+
+#include <stdbool.h>
+#include "simulation.h"
+#include "telemetry.h"
+
+// Number of chosen time steps kept for display
+#define DT_HISTORY_LENGTH 512
+
+// Adaptive global time-step controller. Each step it picks
+//     dt = eta * scale * min_i sqrt(|r_i - r_sun| / |a_i|)
+// (the orbital time scale of the most strongly accelerated body, which also
+// shrinks during close encounters), limited by min_dt/max_dt and by how fast
+// dt may grow. The scale factor is tuned from the telemetry energy drift so
+// the drift rate stays below the tolerance while dt is kept as large as
+// possible.
+typedef struct {
+    double eta;                 // Fraction of the shortest time scale
+    double scale;               // Energy-feedback multiplier
+    double tolerance;           // Allowed |energy drift| per unit simulated time
+    double min_dt, max_dt;
+    double max_growth;          // Largest factor dt may grow by in one step
+    int limiting_body;          // Body that set the last kinematic limit
+    double particle_ratio_sq;   // Smallest (r / |a|)^2 of the last test-particle pass (INFINITY = none)
+    int particle_body;          // The particle it belongs to
+
+    double last_report_time;    // Telemetry report used for the last feedback
+    double last_report_drift;
+    int last_report_reference;  // Drifts measured from another reference do not compare
+    bool have_report;
+
+    double history[DT_HISTORY_LENGTH];  // Ring buffer of chosen dt values
+    int history_head;                   // Next slot to write
+    int history_count;
+} TimestepController;
+
+// Sets up the controller with its limits and energy-drift tolerance
+void timestep_init(TimestepController* controller, double min_dt, double max_dt, double tolerance);
+
+// Chooses the next dt from the forces stored in the bodies (fx, fy) and
+// the test particles noted since the last choice. Body 0 is the Sun and
+// only serves as the reference point.
+double timestep_choose(TimestepController* controller, const CelestialBody bodies[], int body_count,
+                       double current_dt);
+
+// Notes the time-step measure of a test-particle pass, whose forces are
+// only known after dt was chosen; the next choice takes it into account
+// (one step late) and then forgets it
+void timestep_note_particles(TimestepController* controller, double min_ratio_sq, int body);
+
+// Adjusts the scale factor from a telemetry report (ignored if already seen)
+void timestep_energy_feedback(TimestepController* controller, const TelemetryReport* report);
+
+// Records a dt in the history (called for every step, adaptive or not)
+void timestep_record(TimestepController* controller, double dt);
+
+#endif
@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+
+#include "trajectory.h"
+
+// Creates a store for track_count bodies keeping up to max_points vertices each
+TrajectoryStore* trajectory_store_create(int track_count, double tolerance, int max_points) {
+    TrajectoryStore* store = (TrajectoryStore*)calloc(1, sizeof(TrajectoryStore));
+    if (store == NULL) {
+        fprintf(stderr, "Memory allocation failed for trajectory store\n");
+        exit(EXIT_FAILURE);
+    }
+
+    store->tolerance = tolerance;
+    store->max_chunks = (max_points + TRAJECTORY_CHUNK_POINTS - 1) / TRAJECTORY_CHUNK_POINTS;
+    if (store->max_chunks < 2) {
+        store->max_chunks = 2;  // Dropping a chunk must leave some history
+    }
+    store->free_chunk = -1;
+
+    store->tracks = (Trajectory*)calloc(track_count > 0 ? track_count : 1, sizeof(Trajectory));
+    if (store->tracks == NULL) {
+        fprintf(stderr, "Memory allocation failed for trajectories\n");
+        exit(EXIT_FAILURE);
+    }
+    store->track_count = track_count;
+    store->track_capacity = track_count > 0 ? track_count : 1;
+    for (int i = 0; i < track_count; i++) {
+        store->tracks[i].first_chunk = -1;
+        store->tracks[i].last_chunk = -1;
+    }
+    return store;
+}
+
+// Appends count empty tracks (for bodies added to the simulation);
+// returns the index of the first
+int trajectory_store_add_tracks(TrajectoryStore* store, int count) {
+    int first = store->track_count;
+    if (first + count > store->track_capacity) {
+        int capacity = store->track_capacity;
+        while (capacity < first + count) {
+            capacity *= 2;  // Amortized: repeated small additions copy each track O(1) times
+        }
+        Trajectory* tracks = (Trajectory*)realloc(store->tracks, capacity * sizeof(Trajectory));
+        if (tracks == NULL) {
+            fprintf(stderr, "Memory allocation failed for trajectories\n");
+            exit(EXIT_FAILURE);
+        }
+        store->tracks = tracks;
+        store->track_capacity = capacity;
+    }
+    memset(store->tracks + first, 0, count * sizeof(Trajectory));
+    for (int i = first; i < first + count; i++) {
+        store->tracks[i].first_chunk = -1;
+        store->tracks[i].last_chunk = -1;
+    }
+    store->track_count = first + count;
+    return first;
+}
+
+// Takes a chunk from the free list, growing the pool if it is empty
+static int allocate_chunk(TrajectoryStore* store) {
+    if (store->free_chunk < 0) {
+        int old_capacity = store->chunk_capacity;
+        int new_capacity = old_capacity > 0 ? old_capacity * 2 : 64;
+        TrajectoryChunk* chunks = (TrajectoryChunk*)realloc(store->chunks,
+                                                            new_capacity * sizeof(TrajectoryChunk));
+        if (chunks == NULL) {
+            fprintf(stderr, "Memory allocation failed for trajectory pool\n");
+            exit(EXIT_FAILURE);
+        }
+        store->chunks = chunks;
+        store->chunk_capacity = new_capacity;
+
+        // Thread the new chunks onto the free list
+        for (int i = new_capacity - 1; i >= old_capacity; i--) {
+            store->chunks[i].next = store->free_chunk;
+            store->free_chunk = i;
+        }
+    }
+
+    int index = store->free_chunk;
+    store->free_chunk = store->chunks[index].next;
+    store->chunks[index].count = 0;
+    store->chunks[index].next = -1;
+    store->chunks_in_use++;
+    return index;
+}
+
+// Returns a chunk to the free list
+static void release_chunk(TrajectoryStore* store, int index) {
+    store->chunks[index].next = store->free_chunk;
+    store->free_chunk = index;
+    store->chunks_in_use--;
+}
+
+// Appends a vertex to a track, dropping its oldest chunk when over the limit
+static void store_vertex(TrajectoryStore* store, Trajectory* track, double x, double y) {
+    if (track->last_chunk < 0 || store->chunks[track->last_chunk].count == TRAJECTORY_CHUNK_POINTS) {
+        int index = allocate_chunk(store);
+        if (track->last_chunk < 0) {
+            track->first_chunk = index;
+        } else {
+            store->chunks[track->last_chunk].next = index;
+        }
+        track->last_chunk = index;
+        track->chunk_count++;
+
+        if (track->chunk_count > store->max_chunks) {
+            int oldest = track->first_chunk;
+            track->first_chunk = store->chunks[oldest].next;
+            track->chunk_count--;
+            track->first_vertex += TRAJECTORY_CHUNK_POINTS;  // Only full chunks are dropped
+            release_chunk(store, oldest);
+        }
+    }
+
+    TrajectoryChunk* chunk = &store->chunks[track->last_chunk];
+    chunk->x[chunk->count] = (float)x;
+    chunk->y[chunk->count] = (float)y;
+    chunk->count++;
+    track->end_vertex++;
+    store->vertices++;
+
+    track->anchor_x = x;
+    track->anchor_y = y;
+    track->have_sleeve = false;
+    track->reach = 0.0;
+}
+
+// Wraps an angle into (-pi, pi]
+static double wrap_angle(double angle) {
+    while (angle > M_PI) angle -= 2.0 * M_PI;
+    while (angle <= -M_PI) angle += 2.0 * M_PI;
+    return angle;
+}
+
+// Narrows the sleeve of a track by a sample; returns false if the sample
+// cannot lie within the tolerance of a segment from the anchor that also
+// serves every earlier sample
+static bool fit_sample(Trajectory* track, double x, double y, double tolerance) {
+    double dx = x - track->anchor_x;
+    double dy = y - track->anchor_y;
+    double distance = sqrt(dx * dx + dy * dy);
+
+    // Any segment from the anchor passes close enough to this sample
+    if (distance <= tolerance) {
+        return true;
+    }
+
+    // Coming back towards the anchor would leave earlier samples past the
+    // end of the segment
+    if (distance < track->reach - tolerance) {
+        return false;
+    }
+
+    double angle = atan2(dy, dx);
+    double half_width = asin(tolerance / distance);
+    if (!track->have_sleeve) {
+        track->have_sleeve = true;
+        track->base_angle = angle;
+        track->sleeve_min = -half_width;
+        track->sleeve_max = half_width;
+    } else {
+        double relative = wrap_angle(angle - track->base_angle);
+        if (relative < track->sleeve_min || relative > track->sleeve_max) {
+            return false;
+        }
+        if (relative - half_width > track->sleeve_min) track->sleeve_min = relative - half_width;
+        if (relative + half_width < track->sleeve_max) track->sleeve_max = relative + half_width;
+    }
+
+    if (distance > track->reach) {
+        track->reach = distance;
+    }
+    return true;
+}
+
+// Offers the current position of a body
+void trajectory_add_sample(TrajectoryStore* store, int track_index, double x, double y) {
+    Trajectory* track = &store->tracks[track_index];
+    store->samples++;
+
+    if (!track->started) {
+        track->started = true;
+        store_vertex(store, track, x, y);
+    } else if (!fit_sample(track, x, y, store->tolerance)) {
+        // The previous sample ends the segment and anchors the next one
+        store_vertex(store, track, track->last_x, track->last_y);
+        fit_sample(track, x, y, store->tolerance);
+    }
+
+    track->last_x = x;
+    track->last_y = y;
+}
+
+// Forgets the history of a body
+void trajectory_clear(TrajectoryStore* store, int track_index) {
+    Trajectory* track = &store->tracks[track_index];
+    int index = track->first_chunk;
+    while (index >= 0) {
+        int next = store->chunks[index].next;
+        release_chunk(store, index);
+        index = next;
+    }
+
+    track->first_chunk = -1;
+    track->last_chunk = -1;
+    track->chunk_count = 0;
+    track->first_vertex = track->end_vertex;
+    track->started = false;
+    track->have_sleeve = false;
+    track->reach = 0.0;
+}
+
+// Drops the tracks of removed bodies and moves the rest down to follow
+// them: track i becomes new_index[i] (never above i), or is released if
+// that is -1. new_index covers every track.
+void trajectory_store_compact(TrajectoryStore* store, const int new_index[]) {
+    int kept = 0;
+    for (int i = 0; i < store->track_count; i++) {
+        if (new_index[i] < 0) {
+            trajectory_clear(store, i);
+            continue;
+        }
+        // Tracks only move down, so each destination has been read already
+        store->tracks[new_index[i]] = store->tracks[i];
+        kept = new_index[i] + 1;
+    }
+    store->track_count = kept;
+}
+
+// Returns the chunk holding the given vertex of a track, and the vertex's
+// position in it (NULL if the vertex is no longer or not yet stored)
+const TrajectoryChunk* trajectory_find_vertex(const TrajectoryStore* store, int track_index,
+                                              long vertex, int* offset) {
+    const Trajectory* track = &store->tracks[track_index];
+    if (vertex < track->first_vertex || vertex >= track->end_vertex) {
+        return NULL;
+    }
+
+    // Every chunk but the newest is full
+    long skip = (vertex - track->first_vertex) / TRAJECTORY_CHUNK_POINTS;
+    int index = track->first_chunk;
+    for (long i = 0; i < skip; i++) {
+        index = store->chunks[index].next;
+    }
+    *offset = (int)((vertex - track->first_vertex) % TRAJECTORY_CHUNK_POINTS);
+    return &store->chunks[index];
+}
+
+// Returns the chunk at the given index (-1 yields NULL)
+const TrajectoryChunk* trajectory_chunk(const TrajectoryStore* store, int index) {
+    return index >= 0 ? &store->chunks[index] : NULL;
+}
+
+// Bytes currently used for stored vertices
+size_t trajectory_memory_used(const TrajectoryStore* store) {
+    return (size_t)store->chunks_in_use * sizeof(TrajectoryChunk);
+}
+
+// Frees the store and its pool
+void trajectory_store_destroy(TrajectoryStore* store) {
+    if (store == NULL) {
+        return;
+    }
+    free(store->chunks);
+    free(store->tracks);
+    free(store);
+}
@@ -0,0 +1,99 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Points per pool chunk
+#define TRAJECTORY_CHUNK_POINTS 64
+
+// Adaptive trajectory history. Positions are offered every step, but a
+// vertex is only stored when the path can no longer be represented by a
+// straight segment from the previous vertex within the tolerance. This is
+// an incremental form of Douglas-Peucker simplification (sleeve fitting):
+// every sample since the last vertex narrows the range of directions a
+// segment from that vertex may take, and once the newest sample falls
+// outside that range the previous sample becomes a vertex. Straight parts
+// of a path cost nothing, tight curves get dense vertices.
+//
+// Vertices are stored as floats in fixed-size chunks taken from one pool
+// shared by all tracks. When a track reaches its length limit its oldest
+// chunk goes back to the pool.
+
+// A run of stored vertices
+typedef struct {
+    float x[TRAJECTORY_CHUNK_POINTS];
+    float y[TRAJECTORY_CHUNK_POINTS];
+    int count;                      // Vertices used in this chunk
+    int next;                       // Next (newer) chunk of the track, -1 = none
+} TrajectoryChunk;
+
+// History of one body
+typedef struct {
+    int first_chunk, last_chunk;    // Oldest and newest chunk, -1 = empty
+    int chunk_count;
+    long first_vertex;              // Index of the oldest kept vertex
+    long end_vertex;                // One past the newest vertex; indices never reuse,
+                                    // so a reader can tell what changed since it last looked
+
+    // Sleeve state
+    bool started;
+    double anchor_x, anchor_y;      // Last stored vertex
+    double last_x, last_y;          // Latest sample (live end of the line)
+    bool have_sleeve;
+    double base_angle;              // Direction of the first sample leaving the anchor
+    double sleeve_min, sleeve_max;  // Allowed directions relative to base_angle
+    double reach;                   // Largest distance from the anchor so far
+} Trajectory;
+
+// Shared pool and the tracks using it
+typedef struct {
+    double tolerance;               // Largest distance of a skipped sample from the path
+    int max_chunks;                 // Chunks kept per track
+
+    Trajectory* tracks;
+    int track_count;
+    int track_capacity;
+
+    TrajectoryChunk* chunks;        // Pool; chunks are referred to by index
+    int chunk_capacity;
+    int free_chunk;                 // Head of the free list (linked via next)
+    int chunks_in_use;
+
+    long samples;                   // Positions offered
+    long vertices;                  // Vertices stored
+} TrajectoryStore;
+
+// Creates a store for track_count bodies keeping up to max_points vertices each
+TrajectoryStore* trajectory_store_create(int track_count, double tolerance, int max_points);
+
+// Appends count empty tracks (for bodies added to the simulation);
+// returns the index of the first
+int trajectory_store_add_tracks(TrajectoryStore* store, int count);
+
+// Drops the tracks of removed bodies and moves the rest down to follow
+// them: track i becomes new_index[i] (never above i), or is released if
+// that is -1. new_index covers every track.
+void trajectory_store_compact(TrajectoryStore* store, const int new_index[]);
+
+// Offers the current position of a body
+void trajectory_add_sample(TrajectoryStore* store, int track, double x, double y);
+
+// Forgets the history of a body
+void trajectory_clear(TrajectoryStore* store, int track);
+
+// Returns the chunk holding the given vertex of a track, and the vertex's
+// position in it (NULL if the vertex is no longer or not yet stored)
+const TrajectoryChunk* trajectory_find_vertex(const TrajectoryStore* store, int track,
+                                              long vertex, int* offset);
+
+// Returns the chunk at the given index (-1 yields NULL)
+const TrajectoryChunk* trajectory_chunk(const TrajectoryStore* store, int index);
+
+// Bytes currently used for stored vertices
+size_t trajectory_memory_used(const TrajectoryStore* store);
+
+// Frees the store and its pool
+void trajectory_store_destroy(TrajectoryStore* store);
+
+#endif